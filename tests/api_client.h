@@ -0,0 +1,105 @@
+// Client side of the API server tests and benchmarks, talking to 127.0.0.1.
+// Include after vgpu_monitor.cpp.
+#pragma once
+
+struct Response {
+    int status = 0;
+    std::map<std::string, std::string> headers; // lower-case names
+    std::string body;
+};
+
+// Blocking HTTP/1.1 client on one keep-alive connection
+class Client {
+public:
+    explicit Client(int port)
+    {
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+            throw std::runtime_error("cannot connect to the API server");
+        }
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        struct timeval timeout = { 2, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+
+    ~Client()
+    {
+        close(fd);
+    }
+
+    void send(const std::string& raw)
+    {
+        if (write(fd, raw.data(), raw.size()) != static_cast<ssize_t>(raw.size())) {
+            throw std::runtime_error("cannot send to the API server");
+        }
+    }
+
+    // Reads one response, status 0 when the server closed the connection
+    Response receive()
+    {
+        Response response;
+        size_t header_end;
+        while ((header_end = buffer.find("\r\n\r\n")) == std::string::npos) {
+            if (!fill()) {
+                return response;
+            }
+        }
+        std::string head = buffer.substr(0, header_end);
+        buffer.erase(0, header_end + 4);
+
+        response.status = std::atoi(head.c_str() + strlen("HTTP/1.1 "));
+        size_t pos = head.find("\r\n");
+        while (pos != std::string::npos) {
+            size_t next = head.find("\r\n", pos + 2);
+            std::string line = head.substr(pos + 2, next == std::string::npos ? std::string::npos : next - pos - 2);
+            size_t colon = line.find(':');
+            std::string name = line.substr(0, colon);
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            response.headers[name] = line.substr(colon + 2);
+            pos = next;
+        }
+
+        size_t length = std::stoul(response.headers["content-length"]);
+        while (buffer.size() < length) {
+            if (!fill()) {
+                response.status = 0;
+                return response;
+            }
+        }
+        response.body = buffer.substr(0, length);
+        buffer.erase(0, length);
+        return response;
+    }
+
+    Response get(const std::string& path, const std::string& extra_headers = "")
+    {
+        send("GET " + path + " HTTP/1.1\r\nHost: localhost\r\n" + extra_headers + "\r\n");
+        return receive();
+    }
+
+    // True once the server closed its end
+    bool closed()
+    {
+        return !fill();
+    }
+
+private:
+    bool fill()
+    {
+        char chunk[16384];
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n <= 0) {
+            return false;
+        }
+        buffer.append(chunk, n);
+        return true;
+    }
+
+    int fd = -1;
+    std::string buffer;
+};
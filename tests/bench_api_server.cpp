@@ -0,0 +1,104 @@
+// API server latency at a steady 1k requests per second. Requests are sent on a
+// fixed 1 ms schedule over four keep-alive connections, cycling through the pod
+// list, its ETag revalidation, a single pod and /healthz. Latency runs from
+// writing the request to reading the whole response; the pacing sleep is left
+// out, its wakeup jitter is the machine's and not the server's.
+#include "vgpu_monitor.cpp"
+
+#include "api_client.h"
+#include "fake_backends.h"
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+void publish(DeviceScheduler& scheduler, CycleScratch& scratch, size_t pods)
+{
+    latest_snapshot.clear();
+    for (size_t i = 0; i < pods; i++) {
+        std::string pod = make_pod_key("ns" + std::to_string(i % 3), "pod-" + std::to_string(i));
+        latest_snapshot.push_back({ pod, 0, static_cast<unsigned int>(i % 100), 1000 + i, 8192 });
+        latest_snapshot.push_back({ pod, 1, 5, 10, 8192 });
+    }
+    std::sort(latest_snapshot.begin(), latest_snapshot.end(), [](const PodGpuSample& a, const PodGpuSample& b) {
+        return std::tie(a.pod, a.gpu_id) < std::tie(b.pod, b.gpu_id);
+    });
+    publish_api_snapshot(scheduler, scratch);
+    first_snapshot_published = true;
+}
+
+// Arg: pods in the snapshot
+void BM_LatencyAtOneThousandQps(benchmark::State& state)
+{
+    spdlog::set_level(spdlog::level::off);
+    reset_monitor_state();
+    api_snapshot.reset();
+    stamp_heartbeat();
+    gpu_uuids = { "GPU-aaaa", "GPU-bbbb" };
+    DeviceScheduler scheduler(2, DeviceScheduler::Config {});
+    CycleScratch scratch;
+    ApiServer server(0);
+    const size_t pods = state.range(0);
+    publish(scheduler, scratch, pods);
+
+    std::vector<std::unique_ptr<Client>> clients;
+    for (int i = 0; i < 4; i++) {
+        clients.push_back(std::make_unique<Client>(server.port()));
+    }
+    std::string etag = clients[0]->get("/api/v1/pods").headers["etag"];
+
+    // Warm up connections and caches
+    for (int i = 0; i < 100; i++) {
+        clients[i % clients.size()]->get("/api/v1/pods/ns1/pod-1");
+    }
+
+    std::vector<double> latencies_us;
+    int64_t i = 0;
+    auto start = Clock::now() + 10ms;
+    for (auto _ : state) {
+        std::this_thread::sleep_until(start + std::chrono::microseconds(1000 * i));
+        Client& client = *clients[i % clients.size()];
+        auto sent = Clock::now();
+        Response response;
+        switch (i % 4) {
+        case 0:
+            response = client.get("/api/v1/pods");
+            break;
+        case 1:
+            response = client.get("/api/v1/pods", "If-None-Match: " + etag + "\r\n");
+            break;
+        case 2:
+            response = client.get("/api/v1/pods/ns" + std::to_string(i % pods % 3) + "/pod-" + std::to_string(i % pods));
+            break;
+        default:
+            response = client.get("/healthz");
+        }
+        std::chrono::duration<double> latency = Clock::now() - sent;
+        if (response.status == 0) {
+            state.SkipWithError("the API server closed the connection");
+            break;
+        }
+        state.SetIterationTime(latency.count());
+        latencies_us.push_back(latency.count() * 1e6);
+        i++;
+    }
+
+    if (latencies_us.empty()) {
+        return;
+    }
+    std::sort(latencies_us.begin(), latencies_us.end());
+    state.counters["p50_us"] = latencies_us[latencies_us.size() / 2];
+    state.counters["p99_us"] = latencies_us[latencies_us.size() * 99 / 100];
+    state.counters["max_us"] = latencies_us.back();
+    api_snapshot.reset();
+}
+
+// Three seconds at 1k requests per second
+BENCHMARK(BM_LatencyAtOneThousandQps)->ArgName("pods")->Arg(128)->Iterations(3000)->UseManualTime()->Unit(benchmark::kMicrosecond);
+
+} // namespace
+
+BENCHMARK_MAIN();
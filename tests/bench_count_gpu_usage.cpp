@@ -0,0 +1,98 @@
+// count_gpu_usage on a 16 GPU node for NVIDIA_VISIBLE_DEVICES lists of up to
+// 64 entries, vGPU splitting repeats each UUID. Compares the UUID index with the
+// substring scan over all GPUs it replaced.
+#include "vgpu_monitor.cpp"
+
+#include "fake_backends.h"
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+// The stringstream split and substring scan count_gpu_usage used before the index
+std::map<int, int> count_gpu_usage_substring(const std::string& dockerGPUs)
+{
+    std::map<int, int> gpuUsageCount;
+    std::vector<std::string> dockerUUIDs;
+    std::stringstream ss(dockerGPUs);
+    std::string uuid;
+    while (std::getline(ss, uuid, ',')) {
+        uuid.erase(0, uuid.find_first_not_of(" "));
+        uuid.erase(uuid.find_last_not_of(" ") + 1);
+        dockerUUIDs.push_back(uuid);
+    }
+    for (const auto& dockerUUID : dockerUUIDs) {
+        for (size_t i = 0; i < gpu_uuids.size(); i++) {
+            if (gpu_uuids[i].find(dockerUUID) != std::string::npos) {
+                gpuUsageCount[i]++;
+            }
+        }
+    }
+    return gpuUsageCount;
+}
+
+struct Node {
+    Node()
+    {
+        spdlog::set_level(spdlog::level::off);
+        reset_monitor_state();
+        for (unsigned int i = 0; i < 16; i++) {
+            char uuid[64];
+            snprintf(uuid, sizeof(uuid), "GPU-%08x-6b2d-4f1c-9e3a-%012x", 0x5a17c0de + i * 7919, 0x2f00 + i);
+            FakeGpu gpu;
+            gpu.uuid = uuid;
+            gpu.memory = 80ull << 30;
+            backend.gpus.push_back(gpu);
+        }
+        gpu_backend = &backend;
+        get_gpu_uuids();
+    }
+
+    ~Node()
+    {
+        gpu_backend = nullptr;
+    }
+
+    // entries UUIDs spread evenly over the GPUs in order, 64 entries list each GPU 4 times
+    std::string visible_devices(int entries) const
+    {
+        std::string value;
+        for (int i = 0; i < entries; i++) {
+            value += (i == 0 ? "" : ",") + backend.gpus[i * backend.gpus.size() / entries % backend.gpus.size()].uuid;
+        }
+        return value;
+    }
+
+    FakeGpuBackend backend;
+};
+
+void BM_CountGpuUsageIndex(benchmark::State& state)
+{
+    Node node;
+    std::string value = node.visible_devices(state.range(0));
+    if (count_gpu_usage(value) != count_gpu_usage_substring(value)) {
+        state.SkipWithError("the index and the substring scan disagree");
+        return;
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(count_gpu_usage(value));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_CountGpuUsageSubstring(benchmark::State& state)
+{
+    Node node;
+    std::string value = node.visible_devices(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(count_gpu_usage_substring(value));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_CountGpuUsageIndex)->ArgName("entries")->Arg(1)->Arg(16)->Arg(64);
+BENCHMARK(BM_CountGpuUsageSubstring)->ArgName("entries")->Arg(1)->Arg(16)->Arg(64);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,102 @@
+// Soak of the sampling loop on the fake backends with the logger main()
+// installs, at its level and pattern, its console writing to /dev/null. Every
+// cycle changes the usage of every pod and republishes the API snapshot, as
+// main() does. Heap allocations and RSS are reported per tenth of the run: the
+// first tenth includes the warm-up, the later ones should stay flat.
+#include "vgpu_monitor.cpp"
+
+#include "fake_backends.h"
+#include "heap_counter.h"
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+// Resident set size in KiB
+size_t rss_kb()
+{
+    size_t pages = 0;
+    size_t resident = 0;
+    std::ifstream("/proc/self/statm") >> pages >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Points stdout at /dev/null while alive, the console sink of init_logger writes there
+class DiscardStdout {
+public:
+    DiscardStdout()
+    {
+        fflush(stdout);
+        saved = dup(STDOUT_FILENO);
+        int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+
+    ~DiscardStdout()
+    {
+        fflush(stdout);
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+
+    DiscardStdout(const DiscardStdout&) = delete;
+    DiscardStdout& operator=(const DiscardStdout&) = delete;
+
+private:
+    int saved;
+};
+
+void BM_SoakAtTheShippedLogLevel(benchmark::State& state)
+{
+    FakeNode node(4);
+    for (int i = 0; i < 32; i++) {
+        node.add_pod(make_pod_key("team-" + std::to_string(i % 4), "trainer-with-a-long-name-" + std::to_string(i)), i % 4, (1ull + i % 8) << 30, i);
+    }
+    auto now = std::chrono::steady_clock::now();
+    std::array<size_t, 10> allocations {};
+    std::array<size_t, 10> rss {};
+    const int64_t cycles = state.max_iterations;
+
+    {
+        DiscardStdout discard;
+        init_logger();
+        int64_t cycle = 0;
+        for (auto _ : state) {
+            for (const auto& pod : node.pods) {
+                node.set_usage(pod.first, (1ull + (cycle + pod.second.pid) % 8) << 30, cycle % 100);
+            }
+
+            // Every GPU is due again after the longest interval
+            now += std::chrono::seconds(30);
+            heap_allocations = 0;
+            counting = true;
+            node.harness.run_scheduled_cycle(now);
+            publish_api_snapshot(node.harness.scheduler, node.harness.scratch);
+            counting = false;
+
+            size_t tenth = cycle * 10 / cycles;
+            allocations[tenth] += heap_allocations;
+            if ((cycle + 1) * 10 / cycles != static_cast<int64_t>(tenth)) {
+                rss[tenth] = rss_kb();
+            }
+            cycle++;
+        }
+        spdlog::set_level(spdlog::level::off);
+    }
+    api_snapshot.reset();
+
+    for (size_t i = 0; i < allocations.size(); i++) {
+        std::string tenth = std::to_string(i + 1) + "0pct";
+        state.counters["allocs_" + tenth] = allocations[i];
+        state.counters["rss_kb_" + tenth] = rss[i];
+    }
+    state.counters["rss_growth_kb"] = static_cast<double>(rss.back()) - static_cast<double>(rss[0]);
+}
+
+// 32 pods on 4 GPUs for 20000 cycles, a bit over 27 hours of the default 5 s interval
+BENCHMARK(BM_SoakAtTheShippedLogLevel)->Iterations(20000)->Unit(benchmark::kMicrosecond);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,130 @@
+// Clean-up cost per cycle with 1% pod churn: 1% of the pods leave every 5
+// second cycle and as many new ones arrive. Every live pod is sampled first,
+// untimed. Timed is the step that finds stale slots: the full scan over
+// gpu_data it used to be, which keeps gone pods forever, against the deadline
+// queues with eviction after the tombstone period.
+#include "vgpu_monitor.cpp"
+
+#include "fake_backends.h"
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+using GpuData = std::map<std::string, std::map<unsigned int, std::pair<unsigned int, unsigned long long>>>;
+
+const std::time_t cycle_seconds = 5;
+const std::time_t expiry_seconds = 10;
+const std::time_t tombstone_seconds = 300;
+
+// The live pods of a node with steady churn
+class Churn {
+public:
+    explicit Churn(int pods)
+    {
+        for (int i = 0; i < pods; i++) {
+            arrive();
+        }
+    }
+
+    // Replace the oldest 1% of the pods with new ones
+    void step()
+    {
+        size_t leaving = std::max<size_t>(1, live.size() / 100);
+        for (size_t i = 0; i < leaving; i++) {
+            uids.erase(live.front());
+            live.pop_front();
+            arrive();
+        }
+    }
+
+    std::deque<std::string> live;
+    std::map<std::string, std::string> uids;
+
+private:
+    void arrive()
+    {
+        live.push_back(make_pod_key("team-" + std::to_string(next % 50), "job-" + std::to_string(next)));
+        uids[live.back()] = "uid-" + std::to_string(next);
+        next++;
+    }
+
+    int next = 0;
+};
+
+void BM_ExpiryFullScan(benchmark::State& state)
+{
+    spdlog::set_level(spdlog::level::off);
+    Churn churn(state.range(0));
+    GpuData gpu_data;
+    std::map<std::string, std::map<unsigned int, std::time_t>> last_update_times;
+    std::time_t now = 1000000;
+    for (auto _ : state) {
+        state.PauseTiming();
+        churn.step();
+        now += cycle_seconds;
+        for (const auto& pod : churn.live) {
+            gpu_data[pod][0] = { 50, 1ull << 30 };
+            last_update_times[pod][0] = now;
+        }
+        state.ResumeTiming();
+
+        // Zero out every slot not updated within the expiry time
+        for (auto& pod : gpu_data) {
+            for (auto& gpu_item : pod.second) {
+                if (last_update_times[pod.first].find(gpu_item.first) == last_update_times[pod.first].end()
+                    || last_update_times[pod.first][gpu_item.first] + expiry_seconds < now) {
+                    gpu_item.second = { 0, 0 };
+                }
+            }
+        }
+    }
+    state.counters["tracked_pods"] = gpu_data.size();
+}
+
+void BM_ExpiryDeadlineQueue(benchmark::State& state)
+{
+    spdlog::set_level(spdlog::level::off);
+    reset_monitor_state();
+    CycleHarness harness(1);
+    Churn churn(state.range(0));
+    DeadlineQueue<std::pair<std::string, unsigned int>> slot_expiry(expiry_seconds);
+    pod_tombstones.set_timeout(tombstone_seconds);
+    std::time_t now = 1000000;
+    size_t evicted = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        churn.step();
+        now += cycle_seconds;
+        for (const auto& pod : churn.live) {
+            harness.gpu_data[pod][0] = { 50, 1ull << 30 };
+            pod_tombstones.touch(pod, now);
+            slot_expiry.touch({ pod, 0 }, now);
+            cache_pod_uid(churn.uids.at(pod), pod);
+        }
+        state.ResumeTiming();
+
+        // The clean-up of update_and_clean_gpu_data
+        slot_expiry.expire(now, [&](const std::pair<std::string, unsigned int>& slot) {
+            auto pod = harness.gpu_data.find(slot.first);
+            if (pod != harness.gpu_data.end() && pod->second.find(slot.second) != pod->second.end()) {
+                pod->second[slot.second] = { 0, 0 };
+            }
+        });
+        pod_tombstones.expire(now, [&](const std::string& pod_id) {
+            evict_pod(pod_id, harness.gpu_data, slot_expiry, harness.sm_util, harness.mem_used, harness.total_mem);
+            evicted++;
+        });
+    }
+    state.counters["tracked_pods"] = harness.gpu_data.size();
+    state.counters["cached_pod_uids"] = pod_uid_to_id.size();
+    state.counters["evicted_per_cycle"] = benchmark::Counter(evicted, benchmark::Counter::kAvgIterations);
+}
+
+// 200 cycles, a bit over three tombstone periods
+BENCHMARK(BM_ExpiryFullScan)->ArgName("pods")->Arg(1000)->Arg(10000)->Iterations(200)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_ExpiryDeadlineQueue)->ArgName("pods")->Arg(1000)->Arg(10000)->Iterations(200)->Unit(benchmark::kMicrosecond);
+
+} // namespace
+
+BENCHMARK_MAIN();
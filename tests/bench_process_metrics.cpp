@@ -0,0 +1,99 @@
+// Per-process series cost per GPU sample on a steady set of processes. Timed is
+// ProcessMetrics::update and expose as a cycle calls them, against the same
+// update with a /proc/<pid>/stat read for every process, which it used to do.
+#include "vgpu_monitor.cpp"
+
+#include "fake_backends.h"
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+// The processes of one GPU, each with its procfs entries
+class Processes {
+public:
+    explicit Processes(size_t count)
+        : samples(&pool)
+    {
+        for (size_t i = 0; i < count; i++) {
+            unsigned int pid = 1000 + i;
+            char docker_id[13];
+            snprintf(docker_id, sizeof(docker_id), "%012x", pid);
+            pods.push_back(make_pod_key("ns" + std::to_string(i % 3), "pod-" + std::to_string(i)));
+            proc.add_process(pid, "00000000-0000-0000-0000-000000000000", docker_id_of(docker_id));
+            ids.push_back(docker_id);
+        }
+        for (size_t i = 0; i < count; i++) {
+            samples.push_back({ static_cast<unsigned int>(1000 + i), &pods[i], ids[i], static_cast<unsigned int>(i % 100), (1ull + i % 8) << 30 });
+        }
+    }
+
+    FakeProcfs proc;
+    std::vector<std::string> pods;
+    std::vector<std::string> ids;
+    std::pmr::unsynchronized_pool_resource pool;
+    std::pmr::vector<ProcessSample> samples;
+};
+
+struct Families {
+    Families()
+        : sm_util(prometheus::BuildGauge().Name("pod_process_gpu_sm_util").Help("").Register(*registry))
+        , mem_used(prometheus::BuildGauge().Name("pod_process_gpu_memory_used").Help("").Register(*registry))
+    {
+    }
+
+    std::shared_ptr<prometheus::Registry> registry = std::make_shared<prometheus::Registry>();
+    prometheus::Family<prometheus::Gauge>& sm_util;
+    prometheus::Family<prometheus::Gauge>& mem_used;
+};
+
+// Arg: processes on the GPU
+void BM_SteadyCycle(benchmark::State& state)
+{
+    spdlog::set_level(spdlog::level::off);
+    Processes processes(state.range(0));
+    Families families;
+    FakeDocker docker;
+    ProcessMetrics metrics(families.sm_util, families.mem_used, 4096);
+    metrics.update(0, processes.samples);
+    metrics.expose(std::numeric_limits<size_t>::max());
+    size_t stat_reads = metrics.total_cost().stat_reads;
+
+    for (auto _ : state) {
+        metrics.update(0, processes.samples);
+        metrics.expose(std::numeric_limits<size_t>::max());
+        cycle_arena.reset();
+    }
+    state.counters["stat_reads"] = benchmark::Counter(metrics.total_cost().stat_reads - stat_reads, benchmark::Counter::kAvgIterations);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Arg: processes on the GPU
+void BM_SteadyCycleReadingEveryStartTime(benchmark::State& state)
+{
+    spdlog::set_level(spdlog::level::off);
+    Processes processes(state.range(0));
+    Families families;
+    FakeDocker docker;
+    ProcessMetrics metrics(families.sm_util, families.mem_used, 4096);
+    metrics.update(0, processes.samples);
+    metrics.expose(std::numeric_limits<size_t>::max());
+
+    for (auto _ : state) {
+        for (const auto& sample : processes.samples) {
+            benchmark::DoNotOptimize(process_start_time(sample.pid));
+        }
+        metrics.update(0, processes.samples);
+        metrics.expose(std::numeric_limits<size_t>::max());
+        cycle_arena.reset();
+    }
+    state.counters["stat_reads"] = benchmark::Counter(static_cast<double>(state.range(0)));
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_SteadyCycle)->ArgName("processes")->Arg(16)->Arg(256)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_SteadyCycleReadingEveryStartTime)->ArgName("processes")->Arg(16)->Arg(256)->Unit(benchmark::kMicrosecond);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,101 @@
+// Bytes on the wire per cycle for the pod series of a node: delta-encoded push
+// frames against scraping the Prometheus text exposition, plain (the Dockerfile
+// builds prometheus-cpp without compression) and deflated. Bodies only, HTTP
+// headers cost about the same either way.
+#include "vgpu_monitor.cpp"
+
+#include "fake_backends.h"
+#include "fake_collector.h"
+
+#include <benchmark/benchmark.h>
+#include <prometheus/text_serializer.h>
+
+namespace {
+
+using namespace std::chrono_literals;
+
+size_t deflated_size(const std::string& text)
+{
+    uLongf size = compressBound(text.size());
+    std::string out(size, '\0');
+    compress2(reinterpret_cast<Bytef*>(&out[0]), &size, reinterpret_cast<const Bytef*>(text.data()), text.size(), Z_DEFAULT_COMPRESSION);
+    return size;
+}
+
+// Args: pods on the node, percent of pods whose usage changes per cycle
+void BM_WireBytesPerCycle(benchmark::State& state)
+{
+    spdlog::set_level(spdlog::level::off);
+    const int pods = state.range(0);
+    const int changed = pods * state.range(1) / 100;
+
+    FakeNode node(8);
+    std::vector<std::string> keys;
+    for (int i = 0; i < pods; i++) {
+        keys.push_back(make_pod_key("team-" + std::to_string(i % 20), "trainer-" + std::to_string(i)));
+        node.add_pod(keys.back(), i % 8, (1ull + i % 16) << 30, i % 100);
+    }
+
+    FakeCollector collector;
+    AsyncHttpClient http_client;
+    SnapshotPusher pusher(collector.url(), "node-1", 0s, 64);
+    auto push = [&] {
+        size_t frames = collector.frames().size();
+        pusher.add_snapshot(latest_snapshot);
+        auto deadline = std::chrono::steady_clock::now() + 5s;
+        while ((collector.frames().size() == frames || !http_client.idle()) && std::chrono::steady_clock::now() < deadline) {
+            pusher.flush(http_client);
+            http_client.run_until(std::chrono::steady_clock::now() + 1ms);
+        }
+    };
+
+    // The full snapshot is sent once, steady state is deltas
+    node.harness.run_cycle();
+    push();
+    size_t full_bytes = collector.frames().back().wire_bytes;
+
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> pick(0, pods - 1);
+    std::uniform_int_distribution<int> util(0, 100);
+    size_t text_bytes = 0;
+    size_t deflated_text_bytes = 0;
+    int64_t cycles = 0;
+    for (auto _ : state) {
+        for (int i = 0; i < changed; i++) {
+            node.set_usage(keys[pick(rng)], (1ull + util(rng) % 16) << 30, util(rng));
+        }
+        node.harness.run_cycle();
+        push();
+        std::string text = prometheus::TextSerializer().Serialize(node.harness.registry->Collect());
+        text_bytes += text.size();
+        deflated_text_bytes += deflated_size(text);
+        cycles++;
+    }
+
+    size_t push_bytes = 0;
+    size_t updates = 0;
+    auto frames = collector.frames();
+    for (size_t i = 1; i < frames.size(); i++) {
+        push_bytes += frames[i].wire_bytes;
+        updates += frames[i].updates;
+    }
+    state.counters["push_full_bytes"] = full_bytes;
+    state.counters["updates_per_cycle"] = static_cast<double>(updates) / cycles;
+    state.counters["push_bytes_per_cycle"] = static_cast<double>(push_bytes) / cycles;
+    state.counters["text_bytes_per_cycle"] = static_cast<double>(text_bytes) / cycles;
+    state.counters["text_deflate_bytes_per_cycle"] = static_cast<double>(deflated_text_bytes) / cycles;
+    state.counters["text_to_push_ratio"] = static_cast<double>(text_bytes) / std::max<size_t>(push_bytes, 1);
+}
+
+BENCHMARK(BM_WireBytesPerCycle)
+    ->ArgNames({ "pods", "changed_pct" })
+    ->Args({ 100, 10 })
+    ->Args({ 1000, 1 })
+    ->Args({ 1000, 10 })
+    ->Args({ 1000, 100 })
+    ->Iterations(10)
+    ->Unit(benchmark::kMillisecond);
+
+} // namespace
+
+BENCHMARK_MAIN();
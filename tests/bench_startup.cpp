@@ -0,0 +1,162 @@
+// Time to first metrics: from start to the first complete snapshot on a node
+// whose GPU processes all still need docker lookups. Runs the warm-up main()
+// runs at startup with `parallelism` lookup threads; parallelism 0 resolves the
+// containers one after another in the first cycle, as before the warm-up.
+//
+// BM_FirstCycleAfterRestart times the first sampling cycle of a restarted
+// monitor against a steady-state cycle, with and without the cache file.
+#include "vgpu_monitor.cpp"
+
+#include "fake_backends.h"
+#include "fake_https_server.h"
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+// Args: GPU pods on the node, lookup threads
+void BM_TimeToFirstMetrics(benchmark::State& state)
+{
+    spdlog::set_level(spdlog::level::off);
+    const int pod_count = state.range(0);
+    const unsigned int parallelism = state.range(1);
+
+    // The docker CLI takes tens of milliseconds per command, a LIST of a busy cluster a few hundred
+    FakeNode node(8);
+    FakeDocker docker(20ms);
+    FakeHttpsServer apiserver;
+    apiserver.set_latency(200ms);
+    std::string items;
+    for (int i = 0; i < pod_count; i++) {
+        std::string pod_namespace = "team-" + std::to_string(i % 4);
+        std::string name = "trainer-" + std::to_string(i);
+        std::string key = make_pod_key(pod_namespace, name);
+        node.add_pod(key, i % 8);
+        const auto& pod = node.pods.at(key);
+        docker.add_container(pod.docker_id, "k8s_main_" + name + "_" + pod_namespace + "_" + pod.uid + "_0",
+            node.backend.gpus[pod.gpu].uuid, gpu_ids[pod.gpu]);
+        items += std::string(items.empty() ? "" : ",") + R"({"metadata":{"name":")" + name + R"(","namespace":")" + pod_namespace
+            + R"("},"spec":{"containers":[{"name":"main","resources":{"limits":{"nvidia.com/gpu":"1"}}}]},"status":{"phase":"Running"}})";
+    }
+    apiserver.respond(200, R"({"items":[)" + items + "]}");
+
+    for (auto _ : state) {
+        node.cold_start();
+        AsyncHttpClient http_client;
+        ApiServerPodList pods(apiserver.url("/api/v1/pods"), "token", apiserver.ca_file, 5000ms, 4000ms);
+        ondemand::parser parser;
+        auto apply_pods = [&](const std::string& body) {
+            return get_pods(node.harness.gpu_data, body, parser) == 0;
+        };
+
+        // The startup sequence of main()
+        auto start = Clock::now();
+        unsigned int device_count = 0;
+        pods.poll(http_client, start, apply_pods);
+        auto enumerating = std::async(std::launch::async, init_devices, std::ref(device_count));
+        if (serve_until_ready(http_client, enumerating) != 0) {
+            state.SkipWithError("init_devices failed");
+            break;
+        }
+        if (parallelism > 0) {
+            std::vector<ContainerLookup> lookups = collect_container_lookups(device_count);
+            auto resolving = std::async(std::launch::async, run_container_lookups, std::ref(lookups), parallelism);
+            serve_until_ready(http_client, resolving);
+            apply_container_lookups(lookups);
+        }
+        while (pods.in_flight(http_client)) {
+            http_client.run_until(Clock::now() + 10ms);
+        }
+        node.harness.run_cycle();
+        auto elapsed = Clock::now() - start;
+
+        size_t reported = std::count_if(latest_snapshot.begin(), latest_snapshot.end(), [](const PodGpuSample& sample) { return sample.mem_used != 0; });
+        if (reported != static_cast<size_t>(pod_count)) {
+            state.SkipWithError("first snapshot is incomplete");
+            break;
+        }
+        state.SetIterationTime(std::chrono::duration<double>(elapsed).count());
+    }
+    state.counters["docker_commands"] = benchmark::Counter(docker.calls(), benchmark::Counter::kAvgIterations);
+}
+
+BENCHMARK(BM_TimeToFirstMetrics)
+    ->ArgNames({ "pods", "parallelism" })
+    ->ArgsProduct({ { 64 }, { 0, 1, 4, 16 } })
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
+
+enum class Restart {
+    None, // Steady state, the caches are warm in memory
+    CacheFile, // Restarted, the caches are restored from VGPU_MONITOR_CACHE_FILE
+    Cold, // Restarted without a cache file
+};
+
+// Args: GPU pods on the node, Restart
+void BM_FirstCycleAfterRestart(benchmark::State& state)
+{
+    spdlog::set_level(spdlog::level::off);
+    const int pod_count = state.range(0);
+    const auto restart = static_cast<Restart>(state.range(1));
+
+    FakeNode node(8);
+    FakeDocker docker(20ms);
+    std::vector<std::string> keys;
+    for (int i = 0; i < pod_count; i++) {
+        std::string pod_namespace = "team-" + std::to_string(i % 4);
+        std::string name = "trainer-" + std::to_string(i);
+        keys.push_back(make_pod_key(pod_namespace, name));
+        node.add_pod(keys.back(), i % 8);
+        const auto& pod = node.pods.at(keys.back());
+        docker.add_container(pod.docker_id, "k8s_main_" + name + "_" + pod_namespace + "_" + pod.uid + "_0",
+            node.backend.gpus[pod.gpu].uuid, gpu_ids[pod.gpu]);
+    }
+    char pattern[] = "/tmp/vgpu_monitor_cache.XXXXXX";
+    std::string cache_dir = mkdtemp(pattern);
+    std::string cache_file = cache_dir + "/vgpu_monitor.cache";
+    save_caches(cache_file);
+    node.harness.run_cycle();
+
+    for (auto _ : state) {
+        if (restart != Restart::None) {
+            node.cold_start();
+            get_gpu_uuids();
+            // The pods as the first pod list reports them
+            for (const auto& key : keys) {
+                node.harness.gpu_data[key][0] = { 0, 0 };
+            }
+            if (restart == Restart::CacheFile) {
+                load_caches(cache_file);
+            }
+        }
+
+        auto start = Clock::now();
+        node.harness.run_cycle();
+        if (restart != Restart::None) {
+            drop_unverified_caches();
+        }
+        auto elapsed = Clock::now() - start;
+
+        size_t reported = std::count_if(latest_snapshot.begin(), latest_snapshot.end(), [](const PodGpuSample& sample) { return sample.mem_used != 0; });
+        if (reported != static_cast<size_t>(pod_count)) {
+            state.SkipWithError("cycle is incomplete");
+            break;
+        }
+        state.SetIterationTime(std::chrono::duration<double>(elapsed).count());
+    }
+    state.counters["docker_commands"] = benchmark::Counter(docker.calls(), benchmark::Counter::kAvgIterations);
+    std::filesystem::remove_all(cache_dir);
+}
+
+BENCHMARK(BM_FirstCycleAfterRestart)
+    ->ArgNames({ "pods", "restart" })
+    ->ArgsProduct({ { 64 }, { static_cast<int>(Restart::None), static_cast<int>(Restart::CacheFile), static_cast<int>(Restart::Cold) } })
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,482 @@
+// Test doubles for the monitor's external dependencies. Include after vgpu_monitor.cpp.
+#pragma once
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+
+// In-memory GPU topology. Handles are pointers to the FakeGpu structs, so MIG
+// instances are devices of their own, like with NVML.
+struct FakeGpu {
+    std::string uuid;
+    unsigned long long memory = 0;
+    unsigned int utilization = 0;
+    std::vector<nvmlProcessInfo_t> processes;
+    std::vector<nvmlProcessUtilizationSample_t> samples;
+
+    // MIG: instances occupy slots below max_mig_devices, other slots are unconfigured
+    bool mig_enabled = false;
+    unsigned int max_mig_devices = 7;
+    unsigned int mig_slot = 0;
+    std::vector<FakeGpu> mig_instances;
+
+    FakeGpu& add_mig_instance(unsigned int slot, const std::string& instance_uuid, unsigned long long instance_memory)
+    {
+        mig_enabled = true;
+        FakeGpu instance;
+        instance.uuid = instance_uuid;
+        instance.memory = instance_memory;
+        instance.mig_slot = slot;
+        mig_instances.push_back(instance);
+        return mig_instances.back();
+    }
+
+    void add_process(unsigned int pid, unsigned long long used_memory, unsigned int sm_util)
+    {
+        nvmlProcessInfo_t info = {};
+        info.pid = pid;
+        info.usedGpuMemory = used_memory;
+        processes.push_back(info);
+        nvmlProcessUtilizationSample_t sample = {};
+        sample.pid = pid;
+        sample.smUtil = sm_util;
+        samples.push_back(sample);
+    }
+};
+
+class FakeGpuBackend : public GpuBackend {
+public:
+    std::vector<FakeGpu> gpus;
+    size_t calls = 0;
+
+    static nvmlDevice_t handle(FakeGpu& gpu)
+    {
+        return reinterpret_cast<nvmlDevice_t>(&gpu);
+    }
+
+    nvmlReturn_t init() override
+    {
+        calls++;
+        return NVML_SUCCESS;
+    }
+
+    nvmlReturn_t shutdown() override
+    {
+        calls++;
+        return NVML_SUCCESS;
+    }
+
+    const char* error_string(nvmlReturn_t result) override
+    {
+        return result == NVML_SUCCESS ? "Success" : "Fake NVML error";
+    }
+
+    nvmlReturn_t device_count(unsigned int* count) override
+    {
+        calls++;
+        *count = gpus.size();
+        return NVML_SUCCESS;
+    }
+
+    nvmlReturn_t device_handle(unsigned int index, nvmlDevice_t* device) override
+    {
+        calls++;
+        if (index >= gpus.size()) {
+            return NVML_ERROR_INVALID_ARGUMENT;
+        }
+        *device = handle(gpus[index]);
+        return NVML_SUCCESS;
+    }
+
+    nvmlReturn_t device_uuid(nvmlDevice_t device, char* uuid, unsigned int length) override
+    {
+        calls++;
+        snprintf(uuid, length, "%s", gpu(device).uuid.c_str());
+        return NVML_SUCCESS;
+    }
+
+    nvmlReturn_t memory_info(nvmlDevice_t device, nvmlMemory_t* memory) override
+    {
+        calls++;
+        const FakeGpu& fake = gpu(device);
+        memory->total = fake.memory;
+        memory->used = 0;
+        for (const auto& process : fake.processes) {
+            memory->used += process.usedGpuMemory;
+        }
+        memory->free = memory->total - memory->used;
+        return NVML_SUCCESS;
+    }
+
+    nvmlReturn_t mig_mode(nvmlDevice_t device, unsigned int* current_mode, unsigned int* pending_mode) override
+    {
+        calls++;
+        *current_mode = gpu(device).mig_enabled ? NVML_DEVICE_MIG_ENABLE : NVML_DEVICE_MIG_DISABLE;
+        *pending_mode = *current_mode;
+        return NVML_SUCCESS;
+    }
+
+    nvmlReturn_t max_mig_device_count(nvmlDevice_t device, unsigned int* count) override
+    {
+        calls++;
+        *count = gpu(device).max_mig_devices;
+        return NVML_SUCCESS;
+    }
+
+    nvmlReturn_t mig_device_handle(nvmlDevice_t device, unsigned int index, nvmlDevice_t* mig_device) override
+    {
+        calls++;
+        for (auto& instance : gpu(device).mig_instances) {
+            if (instance.mig_slot == index) {
+                *mig_device = handle(instance);
+                return NVML_SUCCESS;
+            }
+        }
+        return NVML_ERROR_NOT_FOUND;
+    }
+
+    nvmlReturn_t compute_running_processes(nvmlDevice_t device, unsigned int* count, nvmlProcessInfo_t* infos) override
+    {
+        calls++;
+        return copy_out(gpu(device).processes, count, infos);
+    }
+
+    nvmlReturn_t process_utilization(nvmlDevice_t device, nvmlProcessUtilizationSample_t* samples, unsigned int* count, unsigned long long) override
+    {
+        calls++;
+        // NVML reports NOT_FOUND when no process was sampled since last_seen
+        if (gpu(device).samples.empty()) {
+            *count = 0;
+            return NVML_ERROR_NOT_FOUND;
+        }
+        return copy_out(gpu(device).samples, count, samples);
+    }
+
+    nvmlReturn_t utilization_rates(nvmlDevice_t device, nvmlUtilization_t* utilization) override
+    {
+        calls++;
+        utilization->gpu = gpu(device).utilization;
+        utilization->memory = 0;
+        return NVML_SUCCESS;
+    }
+
+private:
+    static FakeGpu& gpu(nvmlDevice_t device)
+    {
+        return *reinterpret_cast<FakeGpu*>(device);
+    }
+
+    template <typename T>
+    static nvmlReturn_t copy_out(const std::vector<T>& items, unsigned int* count, T* out)
+    {
+        if (*count < items.size()) {
+            *count = items.size();
+            return NVML_ERROR_INSUFFICIENT_SIZE;
+        }
+        std::copy(items.begin(), items.end(), out);
+        *count = items.size();
+        return NVML_SUCCESS;
+    }
+};
+
+// Scratch directory laid out like the host /proc the monitor reads, installed as proc_root
+class FakeProcfs {
+public:
+    FakeProcfs()
+    {
+        char pattern[] = "/tmp/vgpu_monitor_proc.XXXXXX";
+        root = mkdtemp(pattern);
+        proc_root = root;
+    }
+
+    ~FakeProcfs()
+    {
+        std::filesystem::remove_all(root);
+        proc_root = "/workspace/proc";
+    }
+
+    FakeProcfs(const FakeProcfs&) = delete;
+    FakeProcfs& operator=(const FakeProcfs&) = delete;
+
+    // A process of the container docker_id (64 hex digits) in the pod with pod_uid
+    void add_process(unsigned int pid, const std::string& pod_uid, const std::string& docker_id,
+        const std::string& comm = "python", unsigned long long start_time = 1000)
+    {
+        std::string dir = root + "/" + std::to_string(pid);
+        std::filesystem::create_directories(dir);
+        std::ofstream(dir + "/cgroup") << "0::/kubepods/besteffort/pod" << pod_uid << "/" << docker_id << "\n";
+        std::ofstream(dir + "/comm") << comm << "\n";
+        set_start_time(pid, start_time, comm);
+    }
+
+    void set_start_time(unsigned int pid, unsigned long long start_time, const std::string& comm = "python")
+    {
+        // Fields 3 to 21 are irrelevant to the monitor, start time is field 22
+        std::ofstream stat(root + "/" + std::to_string(pid) + "/stat");
+        stat << pid << " (" << comm << ") S";
+        for (int field = 4; field < 22; field++) {
+            stat << " 0";
+        }
+        stat << " " << start_time << " 0 0\n";
+    }
+
+    void remove_process(unsigned int pid)
+    {
+        std::filesystem::remove_all(root + "/" + std::to_string(pid));
+    }
+
+    std::string root;
+};
+
+// A 64 digit container ID whose first 12 digits are short_id
+inline std::string docker_id_of(const std::string& short_id)
+{
+    return short_id + std::string(64 - short_id.size(), '0');
+}
+
+// Forget everything the monitor learned in a previous test
+inline void reset_monitor_state()
+{
+    gpu_ids.clear();
+    gpu_uuids.clear();
+    gpu_uuid_aliases.clear();
+    gpu_uuid_index.clear();
+    mig_instance_memory.clear();
+    mig_instance_ids.clear();
+    gpu_usage.clear();
+    pod_id_to_docker_id.clear();
+    gpu_memory = 0;
+    gpu_index.clear();
+    pod_uid_to_id.clear();
+    pod_id_to_uids.clear();
+    pod_gpu_capacity.clear();
+    pod_mig_slots.clear();
+    docker_mig_devices.clear();
+    GPUAllocation = 1;
+    pod_containers.clear();
+    node_name = "node-1";
+    series_budget = 0;
+    folded_series_gauge = nullptr;
+    kubelet_gpu_usage.clear();
+    kubelet_device_pods.clear();
+    latest_snapshot.clear();
+    snapshot_generation = 0;
+    pod_tombstones = DeadlineQueue<std::string>(300);
+    pod_series.clear();
+    folded_series.reset();
+    process_metrics.reset();
+    unverified_pod_uids.clear();
+    unverified_docker_ids.clear();
+    cache_generation = 0;
+    saved_cache_generation = 0;
+}
+
+// The registry, families and cycle state main() owns, for running sampling cycles in tests
+struct CycleHarness {
+    explicit CycleHarness(unsigned int device_count)
+        : device_count(device_count)
+        , scheduler(device_count, DeviceScheduler::Config {})
+    {
+    }
+
+    // One update_and_clean_gpu_data pass that samples every GPU
+    void run_cycle()
+    {
+        scheduler = DeviceScheduler(device_count, DeviceScheduler::Config {});
+        run_scheduled_cycle(std::chrono::steady_clock::now());
+    }
+
+    // One pass at now that only samples the GPUs the harness's scheduler finds due
+    void run_scheduled_cycle(std::chrono::steady_clock::time_point now)
+    {
+        nvmlDevice_t device = nullptr;
+        update_and_clean_gpu_data(gpu_data, slot_expiry, scratch, scheduler, now, device, device_count, registry,
+            std::chrono::high_resolution_clock::now(), sm_util, mem_used, total_mem);
+        cycle_arena.reset();
+    }
+
+    const PodGpuSample* sample(const std::string& pod, unsigned int gpu_id) const
+    {
+        for (const auto& sample : latest_snapshot) {
+            if (sample.pod == pod && sample.gpu_id == gpu_id) {
+                return &sample;
+            }
+        }
+        return nullptr;
+    }
+
+    unsigned int device_count;
+    std::shared_ptr<prometheus::Registry> registry = std::make_shared<prometheus::Registry>();
+    prometheus::Family<prometheus::Gauge>& sm_util = prometheus::BuildGauge().Name("pod_gpu_sm_util").Help("").Register(*registry);
+    prometheus::Family<prometheus::Gauge>& mem_used = prometheus::BuildGauge().Name("pod_gpu_memory_used").Help("").Register(*registry);
+    prometheus::Family<prometheus::Gauge>& total_mem = prometheus::BuildGauge().Name("pod_total_gpu_memory").Help("").Register(*registry);
+    DeadlineQueue<std::pair<std::string, unsigned int>> slot_expiry { 10 };
+    CycleScratch scratch;
+    DeviceScheduler scheduler;
+    std::map<std::string, std::map<unsigned int, std::pair<unsigned int, unsigned long long>>> gpu_data;
+};
+
+// A node whose pods each run one process on one GPU, wired through the fake
+// NVML backend and procfs the way update_and_clean_gpu_data discovers them
+class FakeNode {
+public:
+    explicit FakeNode(unsigned int gpu_count, unsigned long long memory_per_gpu = 80ull << 30)
+        : harness(gpu_count)
+    {
+        reset_monitor_state();
+        for (unsigned int i = 0; i < gpu_count; i++) {
+            FakeGpu gpu;
+            gpu.uuid = "GPU-" + std::to_string(i);
+            gpu.memory = memory_per_gpu;
+            backend.gpus.push_back(gpu);
+            gpu_ids.push_back("/dev/nvidia" + std::to_string(i));
+        }
+        gpu_backend = &backend;
+        get_gpu_uuids();
+    }
+
+    ~FakeNode()
+    {
+        gpu_backend = nullptr;
+    }
+
+    FakeNode(const FakeNode&) = delete;
+    FakeNode& operator=(const FakeNode&) = delete;
+
+    // Start a pod with one process on gpu, as if the pod list and docker lookups resolved it
+    void add_pod(const std::string& pod_key, unsigned int gpu, unsigned long long memory = 1ull << 30, unsigned int sm_util = 10)
+    {
+        Pod pod;
+        pod.pid = next_pid++;
+        pod.gpu = gpu;
+        char uid[37];
+        snprintf(uid, sizeof(uid), "%08x-0000-0000-0000-000000000000", pod.pid);
+        char docker_id[13];
+        snprintf(docker_id, sizeof(docker_id), "%012x", pod.pid);
+        pod.uid = uid;
+        pod.docker_id = docker_id;
+
+        proc.add_process(pod.pid, pod.uid, docker_id_of(pod.docker_id));
+        backend.gpus[gpu].add_process(pod.pid, memory, sm_util);
+        cache_pod_uid(pod.uid, pod_key);
+        pod_id_to_docker_id[pod_key] = pod.docker_id;
+        gpu_usage[pod.docker_id] = { { 0, 1 } };
+        gpu_index[pod_key] = { { gpu_ids[gpu], 0 } };
+        harness.gpu_data[pod_key][0] = { 0, 0 };
+        pods[pod_key] = pod;
+    }
+
+    // Stop the pod's process, the monitor only learns about it from the samples
+    void stop_pod(const std::string& pod_key)
+    {
+        auto it = pods.find(pod_key);
+        if (it == pods.end()) {
+            return;
+        }
+        FakeGpu& gpu = backend.gpus[it->second.gpu];
+        unsigned int pid = it->second.pid;
+        gpu.processes.erase(std::remove_if(gpu.processes.begin(), gpu.processes.end(), [&](const nvmlProcessInfo_t& info) { return info.pid == pid; }), gpu.processes.end());
+        gpu.samples.erase(std::remove_if(gpu.samples.begin(), gpu.samples.end(), [&](const nvmlProcessUtilizationSample_t& sample) { return sample.pid == pid; }), gpu.samples.end());
+        proc.remove_process(pid);
+        pods.erase(it);
+    }
+
+    void set_usage(const std::string& pod_key, unsigned long long memory, unsigned int sm_util)
+    {
+        const Pod& pod = pods.at(pod_key);
+        FakeGpu& gpu = backend.gpus[pod.gpu];
+        for (auto& info : gpu.processes) {
+            if (info.pid == pod.pid) {
+                info.usedGpuMemory = memory;
+            }
+        }
+        for (auto& sample : gpu.samples) {
+            if (sample.pid == pod.pid) {
+                sample.smUtil = sm_util;
+            }
+        }
+    }
+
+    // Forget the pods like a restarted monitor, the GPUs, processes and containers stay
+    void cold_start()
+    {
+        reset_monitor_state();
+        for (unsigned int i = 0; i < backend.gpus.size(); i++) {
+            gpu_ids.push_back("/dev/nvidia" + std::to_string(i));
+        }
+        harness.gpu_data.clear();
+    }
+
+    struct Pod {
+        unsigned int pid = 0;
+        unsigned int gpu = 0;
+        std::string uid;
+        std::string docker_id;
+    };
+
+    FakeGpuBackend backend;
+    FakeProcfs proc;
+    CycleHarness harness;
+    std::map<std::string, Pod> pods;
+    unsigned int next_pid = 1000;
+};
+
+// A `docker` first on PATH that answers the ps, inspect and exec lookups of the
+// monitor from a table of containers, after an injectable latency
+class FakeDocker {
+public:
+    explicit FakeDocker(std::chrono::milliseconds latency = std::chrono::milliseconds(0))
+    {
+        char pattern[] = "/tmp/vgpu_monitor_docker.XXXXXX";
+        dir = mkdtemp(pattern);
+        std::filesystem::create_directories(dir + "/inspect");
+        std::filesystem::create_directories(dir + "/exec");
+        std::ofstream(dir + "/ps");
+        {
+            std::ofstream script(dir + "/docker");
+            script << "#!/bin/sh\n"
+                   << "echo \"$1\" >> " << dir << "/calls\n"
+                   << "sleep " << latency.count() / 1000.0 << "\n"
+                   << "case \"$1\" in\n"
+                   << "ps) cat " << dir << "/ps ;;\n"
+                   << "inspect) cat " << dir << "/inspect/\"$2\" ;;\n"
+                   << "exec) cat " << dir << "/exec/\"$3\" ;;\n"
+                   << "esac\n";
+        }
+        std::filesystem::permissions(dir + "/docker", std::filesystem::perms::owner_all);
+
+        const char* path = std::getenv("PATH");
+        saved_path = path ? path : "";
+        setenv("PATH", (dir + ":" + saved_path).c_str(), 1);
+    }
+
+    ~FakeDocker()
+    {
+        setenv("PATH", saved_path.c_str(), 1);
+        std::filesystem::remove_all(dir);
+    }
+
+    FakeDocker(const FakeDocker&) = delete;
+    FakeDocker& operator=(const FakeDocker&) = delete;
+
+    // A container named like the kubelet names them, k8s_<container>_<pod>_<namespace>_<uid>_<attempt>,
+    // that sees the GPU with gpu_uuid as device_file
+    void add_container(const std::string& docker_id, const std::string& name, const std::string& gpu_uuid, const std::string& device_file)
+    {
+        std::ofstream(dir + "/ps", std::ios::app) << docker_id << "   nvcr.io/pytorch   \"python\"   Up   " << name << "\n";
+        std::ofstream(dir + "/inspect/" + docker_id) << "                \"NVIDIA_VISIBLE_DEVICES=" << gpu_uuid << "\",\n";
+        std::ofstream(dir + "/exec/" + docker_id) << device_file << "\n";
+    }
+
+    // docker commands run so far
+    size_t calls() const
+    {
+        std::ifstream log(dir + "/calls");
+        return std::count(std::istreambuf_iterator<char>(log), std::istreambuf_iterator<char>(), '\n');
+    }
+
+    std::string dir;
+
+private:
+    std::string saved_path;
+};
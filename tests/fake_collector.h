@@ -0,0 +1,356 @@
+// Node-local collector for SnapshotPusher: accepts POSTed push frames over
+// HTTP/1.1 on 127.0.0.1, inflates and decodes them and rebuilds the series the
+// way a real collector would. Include after vgpu_monitor.cpp.
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <poll.h>
+
+class FakeCollector {
+public:
+    struct Frame {
+        bool full = false;
+        uint64_t sequence = 0;
+        std::string node;
+        size_t definitions = 0;
+        size_t updates = 0;
+        size_t removals = 0;
+        size_t wire_bytes = 0;
+    };
+
+    // Series state rebuilt from the frames, pod -> gpu_id -> (sm_util, mem_used, total_mem)
+    using Series = std::map<std::string, std::map<unsigned int, std::array<unsigned long long, 3>>>;
+
+    FakeCollector()
+    {
+        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(addr);
+        if (bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listen_fd, 8) != 0
+            || getsockname(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), &length) != 0) {
+            throw std::runtime_error("FakeCollector: cannot listen");
+        }
+        port = ntohs(addr.sin_port);
+        if (pipe(stop_pipe) != 0) {
+            throw std::runtime_error("FakeCollector: pipe() failed");
+        }
+        worker = std::thread([this] { run(); });
+    }
+
+    ~FakeCollector()
+    {
+        char byte = 0;
+        write(stop_pipe[1], &byte, 1);
+        worker.join();
+        close(stop_pipe[0]);
+        close(stop_pipe[1]);
+        close(listen_fd);
+    }
+
+    FakeCollector(const FakeCollector&) = delete;
+    FakeCollector& operator=(const FakeCollector&) = delete;
+
+    std::string url() const
+    {
+        return "http://127.0.0.1:" + std::to_string(port) + "/push";
+    }
+
+    // Delay between reading a frame and answering it
+    void set_latency(std::chrono::milliseconds value)
+    {
+        latency_ms = value.count();
+    }
+
+    // Answer the next count frames with status instead of accepting them
+    void fail_next(int status, int count = 1)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int i = 0; i < count; i++) {
+            scripted_statuses.push_back(status);
+        }
+    }
+
+    // Lose all state like a restarted collector, deltas get 409 until a full frame
+    void forget()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        has_state = false;
+        ids.clear();
+        series.clear();
+    }
+
+    std::vector<Frame> frames() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return accepted;
+    }
+
+    Series state() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return series;
+    }
+
+    // Requests seen, including rejected ones
+    int requests() const
+    {
+        return request_count;
+    }
+
+    // Frames that could not be inflated or decoded, or arrived out of sequence
+    std::vector<std::string> errors() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return decode_errors;
+    }
+
+private:
+    struct Reader {
+        const char* pos;
+        const char* end;
+
+        bool varint(uint64_t& value)
+        {
+            value = 0;
+            for (int shift = 0; shift < 64 && pos < end; shift += 7) {
+                uint8_t byte = static_cast<uint8_t>(*pos++);
+                value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool bytes(std::string& value)
+        {
+            uint64_t size;
+            if (!varint(size) || static_cast<uint64_t>(end - pos) < size) {
+                return false;
+            }
+            value.assign(pos, size);
+            pos += size;
+            return true;
+        }
+    };
+
+    void run()
+    {
+        while (true) {
+            struct pollfd fds[2] = { { listen_fd, POLLIN, 0 }, { stop_pipe[0], POLLIN, 0 } };
+            poll(fds, 2, -1);
+            if (fds[1].revents) {
+                return;
+            }
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                serve(fd);
+                close(fd);
+            }
+        }
+    }
+
+    // Wait for data or the stop pipe, false when the client left or we are stopping
+    bool wait(int fd, int timeout_ms)
+    {
+        struct pollfd fds[2] = { { fd, POLLIN, 0 }, { stop_pipe[0], POLLIN, 0 } };
+        return poll(fds, 2, timeout_ms) > 0 && !fds[1].revents;
+    }
+
+    bool read_more(int fd, std::string& in)
+    {
+        char buffer[16384];
+        if (!wait(fd, 5000)) {
+            return false;
+        }
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n <= 0) {
+            return false;
+        }
+        in.append(buffer, n);
+        return true;
+    }
+
+    void serve(int fd)
+    {
+        std::string in;
+        while (true) {
+            size_t header_end;
+            while ((header_end = in.find("\r\n\r\n")) == std::string::npos) {
+                if (!read_more(fd, in)) {
+                    return;
+                }
+            }
+            std::string head = in.substr(0, header_end);
+            in.erase(0, header_end + 4);
+            std::string lower = head;
+            std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+            size_t length_pos = lower.find("content-length:");
+            size_t length = length_pos == std::string::npos ? 0 : std::stoul(head.substr(length_pos + strlen("content-length:")));
+            if (lower.find("expect: 100-continue") != std::string::npos) {
+                static const char proceed[] = "HTTP/1.1 100 Continue\r\n\r\n";
+                write(fd, proceed, sizeof(proceed) - 1);
+            }
+            while (in.size() < length) {
+                if (!read_more(fd, in)) {
+                    return;
+                }
+            }
+            std::string body = in.substr(0, length);
+            in.erase(0, length);
+            request_count++;
+
+            long latency = latency_ms;
+            if (latency > 0) {
+                struct pollfd fds[2] = { { fd, POLLIN, 0 }, { stop_pipe[0], POLLIN, 0 } };
+                if (poll(fds, 2, static_cast<int>(latency)) != 0) {
+                    return;
+                }
+            }
+
+            int status = receive(body);
+            std::string response = "HTTP/1.1 " + std::to_string(status) + " Fake\r\nContent-Length: 0\r\n\r\n";
+            if (write(fd, response.data(), response.size()) != static_cast<ssize_t>(response.size())) {
+                return;
+            }
+        }
+    }
+
+    // Apply one frame, returns the HTTP status to answer with
+    int receive(const std::string& body)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!scripted_statuses.empty()) {
+            int status = scripted_statuses.front();
+            scripted_statuses.pop_front();
+            return status;
+        }
+
+        std::string frame;
+        uLongf size = 1 << 20;
+        frame.resize(size);
+        if (uncompress(reinterpret_cast<Bytef*>(&frame[0]), &size, reinterpret_cast<const Bytef*>(body.data()), body.size()) != Z_OK) {
+            decode_errors.push_back("inflate failed");
+            return 400;
+        }
+        frame.resize(size);
+
+        Frame decoded;
+        decoded.wire_bytes = body.size();
+        Reader reader { frame.data(), frame.data() + frame.size() };
+        if (frame.compare(0, 4, "VGPS") != 0 || frame.size() < 6 || frame[4] != 1) {
+            decode_errors.push_back("bad header");
+            return 400;
+        }
+        decoded.full = frame[5] & 1;
+        reader.pos += 6;
+        uint64_t timestamp;
+        if (!reader.varint(decoded.sequence) || !reader.varint(timestamp) || !reader.bytes(decoded.node)) {
+            decode_errors.push_back("bad header");
+            return 400;
+        }
+
+        if (!decoded.full && !has_state) {
+            return 409;
+        }
+        if (!decoded.full && decoded.sequence <= last_sequence) {
+            decode_errors.push_back("sequence " + std::to_string(decoded.sequence) + " after " + std::to_string(last_sequence));
+        }
+        if (decoded.full) {
+            ids.clear();
+            series.clear();
+        }
+
+        uint64_t count;
+        if (!reader.varint(count)) {
+            decode_errors.push_back("truncated definitions");
+            return 400;
+        }
+        decoded.definitions = count;
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t id;
+            uint64_t gpu_id;
+            std::string pod;
+            if (!reader.varint(id) || !reader.bytes(pod) || !reader.varint(gpu_id)) {
+                decode_errors.push_back("truncated definition");
+                return 400;
+            }
+            ids[id] = std::make_pair(pod, static_cast<unsigned int>(gpu_id));
+        }
+
+        if (!reader.varint(count)) {
+            decode_errors.push_back("truncated updates");
+            return 400;
+        }
+        decoded.updates = count;
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t id;
+            uint64_t sm_util;
+            uint64_t mem_used;
+            uint64_t total_mem;
+            if (!reader.varint(id) || !reader.varint(sm_util) || !reader.varint(mem_used) || !reader.varint(total_mem)) {
+                decode_errors.push_back("truncated update");
+                return 400;
+            }
+            std::array<unsigned long long, 3> values = { sm_util, mem_used, total_mem };
+            auto it = ids.find(id);
+            if (it == ids.end()) {
+                decode_errors.push_back("update of unknown series " + std::to_string(id));
+                continue;
+            }
+            series[it->second.first][it->second.second] = values;
+        }
+
+        if (!reader.varint(count)) {
+            decode_errors.push_back("truncated removals");
+            return 400;
+        }
+        decoded.removals = count;
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t id;
+            if (!reader.varint(id)) {
+                decode_errors.push_back("truncated removal");
+                return 400;
+            }
+            auto it = ids.find(id);
+            if (it == ids.end()) {
+                decode_errors.push_back("removal of unknown series " + std::to_string(id));
+                continue;
+            }
+            auto pod = series.find(it->second.first);
+            if (pod != series.end()) {
+                pod->second.erase(it->second.second);
+                if (pod->second.empty()) {
+                    series.erase(pod);
+                }
+            }
+            ids.erase(it);
+        }
+        if (reader.pos != reader.end) {
+            decode_errors.push_back("trailing bytes");
+        }
+
+        has_state = true;
+        last_sequence = decoded.sequence;
+        accepted.push_back(decoded);
+        return 204;
+    }
+
+    int port = 0;
+    int listen_fd = -1;
+    int stop_pipe[2] = { -1, -1 };
+    std::thread worker;
+    mutable std::mutex mutex;
+    std::deque<int> scripted_statuses;
+    bool has_state = false;
+    uint64_t last_sequence = 0;
+    std::map<uint64_t, std::pair<std::string, unsigned int>> ids;
+    Series series;
+    std::vector<Frame> accepted;
+    std::vector<std::string> decode_errors;
+    std::atomic<long> latency_ms { 0 };
+    std::atomic<int> request_count { 0 };
+};
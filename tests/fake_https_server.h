@@ -0,0 +1,205 @@
+// HTTPS server on 127.0.0.1 with a throwaway self-signed certificate and
+// injectable latency, standing in for the apiserver. Include after vgpu_monitor.cpp.
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <poll.h>
+#include <signal.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+class FakeHttpsServer {
+public:
+    // Latency that lasts until the client gives up
+    static constexpr std::chrono::milliseconds hang { -1 };
+
+    FakeHttpsServer()
+    {
+        // Writes to connections the client already timed out must not kill the test
+        signal(SIGPIPE, SIG_IGN);
+
+        char pattern[] = "/tmp/vgpu_monitor_https.XXXXXX";
+        dir = mkdtemp(pattern);
+        ca_file = dir + "/ca.crt";
+        make_certificate();
+
+        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(addr);
+        if (bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listen_fd, 8) != 0
+            || getsockname(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), &length) != 0) {
+            throw std::runtime_error("FakeHttpsServer: cannot listen");
+        }
+        port = ntohs(addr.sin_port);
+        if (pipe(stop_pipe) != 0) {
+            throw std::runtime_error("FakeHttpsServer: pipe() failed");
+        }
+        worker = std::thread([this] { run(); });
+    }
+
+    ~FakeHttpsServer()
+    {
+        char byte = 0;
+        write(stop_pipe[1], &byte, 1);
+        worker.join();
+        close(stop_pipe[0]);
+        close(stop_pipe[1]);
+        close(listen_fd);
+        SSL_CTX_free(ssl_ctx);
+        std::filesystem::remove_all(dir);
+    }
+
+    FakeHttpsServer(const FakeHttpsServer&) = delete;
+    FakeHttpsServer& operator=(const FakeHttpsServer&) = delete;
+
+    std::string url(const std::string& path) const
+    {
+        return "https://127.0.0.1:" + std::to_string(port) + path;
+    }
+
+    void respond(int status, const std::string& body)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        response_status = status;
+        response_body = body;
+    }
+
+    // Delay between reading a request and answering it
+    void set_latency(std::chrono::milliseconds value)
+    {
+        latency_ms = value.count();
+    }
+
+    int requests() const
+    {
+        return request_count;
+    }
+
+    std::string ca_file;
+
+private:
+    void make_certificate()
+    {
+        EVP_PKEY* key = EVP_EC_gen("P-256");
+        X509* cert = X509_new();
+        X509_set_version(cert, 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+        X509_gmtime_adj(X509_getm_notBefore(cert), -60);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600);
+        X509_set_pubkey(cert, key);
+        X509_NAME* name = X509_get_subject_name(cert);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("vgpu-monitor-test"), -1, -1, 0);
+        X509_set_issuer_name(cert, name);
+        X509V3_CTX ctx;
+        X509V3_set_ctx(&ctx, cert, cert, nullptr, nullptr, 0);
+        for (auto extension : { std::make_pair(NID_basic_constraints, "critical,CA:TRUE"), std::make_pair(NID_subject_alt_name, "IP:127.0.0.1") }) {
+            X509_EXTENSION* ext = X509V3_EXT_conf_nid(nullptr, &ctx, extension.first, extension.second);
+            X509_add_ext(cert, ext, -1);
+            X509_EXTENSION_free(ext);
+        }
+        X509_sign(cert, key, EVP_sha256());
+
+        FILE* file = fopen(ca_file.c_str(), "w");
+        PEM_write_X509(file, cert);
+        fclose(file);
+
+        ssl_ctx = SSL_CTX_new(TLS_server_method());
+        if (SSL_CTX_use_certificate(ssl_ctx, cert) != 1 || SSL_CTX_use_PrivateKey(ssl_ctx, key) != 1) {
+            throw std::runtime_error("FakeHttpsServer: cannot load the certificate");
+        }
+        X509_free(cert);
+        EVP_PKEY_free(key);
+    }
+
+    void run()
+    {
+        while (true) {
+            struct pollfd fds[2] = { { listen_fd, POLLIN, 0 }, { stop_pipe[0], POLLIN, 0 } };
+            poll(fds, 2, -1);
+            if (fds[1].revents) {
+                return;
+            }
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                serve(fd);
+                close(fd);
+            }
+        }
+    }
+
+    // Wait for the stop pipe, the client or the timeout, false if the client left or we are stopping
+    bool wait(int fd, int timeout_ms)
+    {
+        struct pollfd fds[2] = { { fd, POLLIN, 0 }, { stop_pipe[0], POLLIN, 0 } };
+        return poll(fds, 2, timeout_ms) != 0 && !fds[1].revents;
+    }
+
+    // Answer HTTP/1.1 requests on one connection until the client closes it
+    void serve(int fd)
+    {
+        SSL* ssl = SSL_new(ssl_ctx);
+        SSL_set_fd(ssl, fd);
+        if (!wait(fd, 5000) || SSL_accept(ssl) != 1) {
+            SSL_free(ssl);
+            return;
+        }
+
+        std::string request;
+        std::array<char, 4096> buffer;
+        while (true) {
+            size_t header_end;
+            while ((header_end = request.find("\r\n\r\n")) == std::string::npos) {
+                if (SSL_pending(ssl) == 0 && !wait(fd, 5000)) {
+                    SSL_free(ssl);
+                    return;
+                }
+                int n = SSL_read(ssl, buffer.data(), buffer.size());
+                if (n <= 0) {
+                    SSL_free(ssl);
+                    return;
+                }
+                request.append(buffer.data(), n);
+            }
+            request.erase(0, header_end + 4);
+            request_count++;
+
+            // Latency: nothing but a disconnect or shutdown ends it early
+            long latency = latency_ms;
+            if (latency != 0) {
+                struct pollfd fds[2] = { { fd, POLLIN, 0 }, { stop_pipe[0], POLLIN, 0 } };
+                if (poll(fds, 2, latency < 0 ? -1 : static_cast<int>(latency)) != 0) {
+                    SSL_free(ssl);
+                    return;
+                }
+            }
+
+            std::string response;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                response = "HTTP/1.1 " + std::to_string(response_status) + " Fake\r\nContent-Type: application/json\r\nContent-Length: "
+                    + std::to_string(response_body.size()) + "\r\n\r\n" + response_body;
+            }
+            if (SSL_write(ssl, response.data(), response.size()) <= 0) {
+                SSL_free(ssl);
+                return;
+            }
+        }
+    }
+
+    std::string dir;
+    int port = 0;
+    int listen_fd = -1;
+    int stop_pipe[2] = { -1, -1 };
+    SSL_CTX* ssl_ctx = nullptr;
+    std::thread worker;
+    std::mutex mutex;
+    int response_status = 200;
+    std::string response_body = R"({"items":[]})";
+    std::atomic<long> latency_ms { 0 };
+    std::atomic<int> request_count { 0 };
+};
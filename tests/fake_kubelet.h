@@ -0,0 +1,312 @@
+// Fake kubelet serving v1.PodResourcesLister/List over gRPC (HTTP/2 without TLS)
+// on a unix socket, for tests of PodResourcesClient. Include after vgpu_monitor.cpp.
+#pragma once
+
+#include <mutex>
+#include <poll.h>
+#include <sys/un.h>
+
+#include <nghttp2/nghttp2.h>
+
+// Protobuf wire-format writer for the PodResources messages the tests send
+struct ProtoWriter {
+    std::string out;
+
+    ProtoWriter& varint(uint32_t field, uint64_t value)
+    {
+        append_varint(field << 3);
+        append_varint(value);
+        return *this;
+    }
+
+    ProtoWriter& bytes(uint32_t field, std::string_view value)
+    {
+        append_varint((field << 3) | 2);
+        append_varint(value.size());
+        out.append(value);
+        return *this;
+    }
+
+    ProtoWriter& fixed64(uint32_t field, uint64_t value)
+    {
+        append_varint((field << 3) | 1);
+        out.append(reinterpret_cast<const char*>(&value), 8);
+        return *this;
+    }
+
+    ProtoWriter& fixed32(uint32_t field, uint32_t value)
+    {
+        append_varint((field << 3) | 5);
+        out.append(reinterpret_cast<const char*>(&value), 4);
+        return *this;
+    }
+
+    void append_varint(uint64_t value)
+    {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+};
+
+// ContainerDevices { string resource_name = 1; repeated string device_ids = 2; }
+inline std::string container_devices(const std::string& resource_name, const std::vector<std::string>& device_ids)
+{
+    ProtoWriter writer;
+    writer.bytes(1, resource_name);
+    for (const auto& device_id : device_ids) {
+        writer.bytes(2, device_id);
+    }
+    return writer.out;
+}
+
+// ContainerResources { string name = 1; repeated ContainerDevices devices = 2; }
+inline std::string container_resources(const std::string& name, const std::vector<std::string>& devices)
+{
+    ProtoWriter writer;
+    writer.bytes(1, name);
+    for (const auto& device : devices) {
+        writer.bytes(2, device);
+    }
+    return writer.out;
+}
+
+// PodResources { string name = 1; string namespace = 2; repeated ContainerResources containers = 3; }
+inline std::string pod_resources(const std::string& namespace_, const std::string& name, const std::vector<std::string>& containers)
+{
+    ProtoWriter writer;
+    writer.bytes(1, name);
+    writer.bytes(2, namespace_);
+    for (const auto& container : containers) {
+        writer.bytes(3, container);
+    }
+    return writer.out;
+}
+
+// ListPodResourcesResponse { repeated PodResources pod_resources = 1; }
+inline std::string list_response(const std::vector<std::string>& pods)
+{
+    ProtoWriter writer;
+    for (const auto& pod : pods) {
+        writer.bytes(1, pod);
+    }
+    return writer.out;
+}
+
+// Length-prefixed gRPC message
+inline std::string grpc_frame(const std::string& message)
+{
+    std::string frame(5, '\0');
+    uint32_t size = message.size();
+    frame[1] = static_cast<char>(size >> 24);
+    frame[2] = static_cast<char>(size >> 16);
+    frame[3] = static_cast<char>(size >> 8);
+    frame[4] = static_cast<char>(size);
+    return frame + message;
+}
+
+class FakeKubelet {
+public:
+    FakeKubelet()
+    {
+        char pattern[] = "/tmp/vgpu_monitor_kubelet.XXXXXX";
+        dir = mkdtemp(pattern);
+        socket_path = dir + "/kubelet.sock";
+
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path.c_str());
+        if (bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listen_fd, 8) != 0) {
+            throw std::runtime_error("FakeKubelet: cannot listen on " + socket_path);
+        }
+        if (pipe(stop_pipe) != 0) {
+            throw std::runtime_error("FakeKubelet: pipe() failed");
+        }
+        worker = std::thread([this] { run(); });
+    }
+
+    ~FakeKubelet()
+    {
+        char byte = 0;
+        write(stop_pipe[1], &byte, 1);
+        worker.join();
+        close(stop_pipe[0]);
+        close(stop_pipe[1]);
+        close(listen_fd);
+        unlink(socket_path.c_str());
+        rmdir(dir.c_str());
+    }
+
+    FakeKubelet(const FakeKubelet&) = delete;
+    FakeKubelet& operator=(const FakeKubelet&) = delete;
+
+    // Answer List with one gRPC message and the given grpc-status trailer
+    void respond(const std::string& message, int grpc_status = 0)
+    {
+        respond_raw(grpc_frame(message), grpc_status);
+    }
+
+    // Answer List with an arbitrary body, to test the framing checks
+    void respond_raw(const std::string& body, int grpc_status = 0)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        response_body = body;
+        response_status = grpc_status;
+    }
+
+    int requests() const
+    {
+        return request_count;
+    }
+
+    std::string socket_path;
+
+private:
+    struct Stream {
+        std::string body;
+        size_t sent = 0;
+        std::string status;
+    };
+
+    void run()
+    {
+        while (true) {
+            struct pollfd fds[2] = { { listen_fd, POLLIN, 0 }, { stop_pipe[0], POLLIN, 0 } };
+            poll(fds, 2, -1);
+            if (fds[1].revents) {
+                return;
+            }
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0 && !serve(fd)) {
+                return;
+            }
+        }
+    }
+
+    // Serve one HTTP/2 connection until the client closes it, false when stopping
+    bool serve(int fd)
+    {
+        nghttp2_session_callbacks* callbacks;
+        nghttp2_session_callbacks_new(&callbacks);
+        nghttp2_session_callbacks_set_send_callback(callbacks, send_callback);
+        nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, on_frame_recv);
+        nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, on_stream_close);
+        nghttp2_session* session;
+        connection_fd = fd;
+        nghttp2_session_server_new(&session, callbacks, this);
+        nghttp2_session_callbacks_del(callbacks);
+        nghttp2_submit_settings(session, NGHTTP2_FLAG_NONE, nullptr, 0);
+
+        bool stopping = false;
+        std::array<uint8_t, 16384> buffer;
+        while (nghttp2_session_send(session) == 0) {
+            struct pollfd fds[2] = { { fd, POLLIN, 0 }, { stop_pipe[0], POLLIN, 0 } };
+            poll(fds, 2, -1);
+            if (fds[1].revents) {
+                stopping = true;
+                break;
+            }
+            ssize_t n = read(fd, buffer.data(), buffer.size());
+            if (n <= 0 || nghttp2_session_mem_recv(session, buffer.data(), n) < 0) {
+                break;
+            }
+        }
+        nghttp2_session_del(session);
+        streams.clear();
+        close(fd);
+        return !stopping;
+    }
+
+    static ssize_t send_callback(nghttp2_session*, const uint8_t* data, size_t length, int, void* user_data)
+    {
+        auto* self = static_cast<FakeKubelet*>(user_data);
+        ssize_t n = write(self->connection_fd, data, length);
+        return n < 0 ? NGHTTP2_ERR_CALLBACK_FAILURE : n;
+    }
+
+    static int on_frame_recv(nghttp2_session* session, const nghttp2_frame* frame, void* user_data)
+    {
+        auto* self = static_cast<FakeKubelet*>(user_data);
+        bool request_done = (frame->hd.type == NGHTTP2_HEADERS || frame->hd.type == NGHTTP2_DATA) && (frame->hd.flags & NGHTTP2_FLAG_END_STREAM);
+        if (!request_done) {
+            return 0;
+        }
+        self->request_count++;
+
+        Stream& stream = self->streams[frame->hd.stream_id];
+        {
+            std::lock_guard<std::mutex> lock(self->mutex);
+            stream.body = self->response_body;
+            stream.status = std::to_string(self->response_status);
+        }
+        static const char status[] = "200";
+        static const char content_type[] = "application/grpc";
+        nghttp2_nv headers[] = {
+            { (uint8_t*)":status", (uint8_t*)status, 7, 3, NGHTTP2_NV_FLAG_NONE },
+            { (uint8_t*)"content-type", (uint8_t*)content_type, 12, sizeof(content_type) - 1, NGHTTP2_NV_FLAG_NONE },
+        };
+        nghttp2_data_provider provider;
+        provider.source.ptr = &stream;
+        provider.read_callback = read_body;
+        nghttp2_submit_response(session, frame->hd.stream_id, headers, 2, &provider);
+        return 0;
+    }
+
+    // Sends the body, then grpc-status in the trailers like a gRPC server
+    static ssize_t read_body(nghttp2_session* session, int32_t stream_id, uint8_t* buf, size_t length, uint32_t* data_flags, nghttp2_data_source* source, void*)
+    {
+        auto* stream = static_cast<Stream*>(source->ptr);
+        size_t n = std::min(length, stream->body.size() - stream->sent);
+        memcpy(buf, stream->body.data() + stream->sent, n);
+        stream->sent += n;
+        if (stream->sent == stream->body.size()) {
+            *data_flags |= NGHTTP2_DATA_FLAG_EOF | NGHTTP2_DATA_FLAG_NO_END_STREAM;
+            nghttp2_nv trailers[] = {
+                { (uint8_t*)"grpc-status", (uint8_t*)stream->status.data(), 11, stream->status.size(), NGHTTP2_NV_FLAG_NONE },
+            };
+            nghttp2_submit_trailer(session, stream_id, trailers, 1);
+        }
+        return n;
+    }
+
+    static int on_stream_close(nghttp2_session*, int32_t stream_id, uint32_t, void* user_data)
+    {
+        static_cast<FakeKubelet*>(user_data)->streams.erase(stream_id);
+        return 0;
+    }
+
+    std::string dir;
+    int listen_fd = -1;
+    int connection_fd = -1;
+    int stop_pipe[2] = { -1, -1 };
+    std::thread worker;
+    std::mutex mutex;
+    std::string response_body = grpc_frame("");
+    int response_status = 0;
+    std::atomic<int> request_count { 0 };
+    std::map<int32_t, Stream> streams;
+};
+
+// Run one List against the kubelet and apply the changed pods, false if the List failed
+inline bool list_pod_resources(PodResourcesClient& client,
+    std::map<std::string, std::map<unsigned int, std::pair<unsigned int, unsigned long long>>>& gpu_data,
+    std::set<std::string>* changed = nullptr)
+{
+    AsyncHttpClient http_client;
+    bool updated = false;
+    client.start(http_client, [&](const std::set<std::string>& changed_pods) {
+        if (changed) {
+            *changed = changed_pods;
+        }
+        apply_pod_resources(client, changed_pods, gpu_data);
+        updated = true;
+    });
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!http_client.idle() && std::chrono::steady_clock::now() < deadline) {
+        http_client.run_until(std::chrono::steady_clock::now() + std::chrono::milliseconds(10));
+    }
+    return updated;
+}
@@ -0,0 +1,95 @@
+// Replaces the global operator new and delete with malloc and free, counting
+// every allocation made while counting is on. Include in one file per executable.
+#pragma once
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+// operator new calls while counting is on
+bool counting = false;
+size_t heap_allocations = 0;
+
+// Heap use through any form of new, aligned ones included
+void* counted_allocate(size_t size, size_t alignment)
+{
+    if (counting) {
+        heap_allocations++;
+    }
+    void* p = nullptr;
+    if (alignment <= alignof(std::max_align_t)) {
+        p = std::malloc(size == 0 ? 1 : size);
+    }
+    else if (posix_memalign(&p, alignment, size == 0 ? 1 : size) != 0) {
+        p = nullptr;
+    }
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+} // namespace
+
+// The replacements stay out of line: inlined into a delete expression, free on
+// a pointer from new reads as a mismatched pair to -Wmismatched-new-delete
+[[gnu::noinline]] void* operator new(size_t size)
+{
+    return counted_allocate(size, alignof(std::max_align_t));
+}
+
+[[gnu::noinline]] void* operator new[](size_t size)
+{
+    return counted_allocate(size, alignof(std::max_align_t));
+}
+
+[[gnu::noinline]] void* operator new(size_t size, std::align_val_t alignment)
+{
+    return counted_allocate(size, static_cast<size_t>(alignment));
+}
+
+[[gnu::noinline]] void* operator new[](size_t size, std::align_val_t alignment)
+{
+    return counted_allocate(size, static_cast<size_t>(alignment));
+}
+
+[[gnu::noinline]] void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete[](void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete(void* p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete[](void* p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete(void* p, size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete[](void* p, size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
@@ -0,0 +1,268 @@
+// JSON API server: request parsing, ETag revalidation, health endpoints and
+// keep-alive connections. Latency is measured by bench_api_server.
+#include "vgpu_monitor.cpp"
+
+#include "api_client.h"
+#include "fake_backends.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+class ApiServerTest : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        reset_monitor_state();
+        spdlog::set_level(spdlog::level::off);
+        api_snapshot.reset();
+        first_snapshot_published = false;
+        stamp_heartbeat();
+        liveness_timeout = 60;
+        gpu_uuids = { "GPU-aaaa", "GPU-bbbb" };
+        server = std::make_unique<ApiServer>(0);
+    }
+
+    void TearDown() override
+    {
+        server.reset();
+        api_snapshot.reset();
+    }
+
+    void publish(size_t pods)
+    {
+        latest_snapshot.clear();
+        for (size_t i = 0; i < pods; i++) {
+            std::string pod = make_pod_key("ns" + std::to_string(i % 3), "pod-" + std::to_string(i));
+            latest_snapshot.push_back({ pod, 0, static_cast<unsigned int>(i % 100), 1000 + i, 8192 });
+            latest_snapshot.push_back({ pod, 1, 5, 10, 8192 });
+        }
+        std::sort(latest_snapshot.begin(), latest_snapshot.end(), [](const PodGpuSample& a, const PodGpuSample& b) {
+            return std::tie(a.pod, a.gpu_id) < std::tie(b.pod, b.gpu_id);
+        });
+        publish_api_snapshot(scheduler, scratch);
+        first_snapshot_published = true;
+    }
+
+    DeviceScheduler scheduler { 2, DeviceScheduler::Config {} };
+    CycleScratch scratch;
+    std::unique_ptr<ApiServer> server;
+};
+
+TEST_F(ApiServerTest, ServesPodsAndGpus)
+{
+    publish(2);
+    Client client(server->port());
+
+    Response pods = client.get("/api/v1/pods");
+    EXPECT_EQ(pods.status, 200);
+    EXPECT_EQ(pods.headers["content-type"], "application/json");
+    EXPECT_NE(pods.body.find(R"({"namespace":"ns1","name":"pod-1","gpus":[{"gpu_id":0,"sm_util":1,)"), std::string::npos);
+
+    Response pod = client.get("/api/v1/pods/ns0/pod-0?pretty=1");
+    EXPECT_EQ(pod.status, 200);
+    EXPECT_EQ(pod.body.find(R"({"namespace":"ns0","name":"pod-0",)"), 0u);
+    EXPECT_NE(pod.headers["etag"], pods.headers["etag"]);
+
+    Response gpus = client.get("/api/v1/gpus");
+    EXPECT_EQ(gpus.status, 200);
+    EXPECT_NE(gpus.body.find(R"("uuid":"GPU-bbbb")"), std::string::npos);
+
+    EXPECT_EQ(client.get("/api/v1/pods/ns0/missing").status, 404);
+    EXPECT_EQ(client.get("/api/v1/pods/pod-0").status, 404);
+    EXPECT_EQ(client.get("/metrics").status, 404);
+}
+
+TEST_F(ApiServerTest, NeedsASnapshotBeforeServingData)
+{
+    Client client(server->port());
+    EXPECT_EQ(client.get("/api/v1/pods").status, 503);
+    Response ready = client.get("/readyz");
+    EXPECT_EQ(ready.status, 503);
+    EXPECT_EQ(ready.body, R"({"status":"starting"})");
+
+    publish(1);
+    EXPECT_EQ(client.get("/api/v1/pods").status, 200);
+    EXPECT_EQ(client.get("/readyz").status, 200);
+}
+
+TEST_F(ApiServerTest, ReportsAStalledMainLoop)
+{
+    Client client(server->port());
+    EXPECT_EQ(client.get("/healthz").status, 200);
+    main_loop_heartbeat = (Clock::now() - 61s).time_since_epoch().count();
+    Response stalled = client.get("/healthz");
+    EXPECT_EQ(stalled.status, 503);
+    EXPECT_EQ(stalled.body, R"({"status":"stalled"})");
+}
+
+TEST_F(ApiServerTest, ServesOnlyTheProbesWithoutTheApi)
+{
+    ApiServer probes(0, false);
+    Client client(probes.port());
+    EXPECT_EQ(client.get("/readyz").status, 503);
+    EXPECT_EQ(client.get("/healthz").status, 200);
+
+    publish(1);
+    EXPECT_EQ(client.get("/readyz").status, 200);
+    EXPECT_EQ(client.get("/api/v1/pods").status, 404);
+    EXPECT_EQ(client.get("/api/v1/gpus").status, 404);
+}
+
+TEST_F(ApiServerTest, RevalidatesWithIfNoneMatch)
+{
+    publish(3);
+    Client client(server->port());
+    std::string etag = client.get("/api/v1/pods").headers["etag"];
+    ASSERT_FALSE(etag.empty());
+
+    for (const std::string& header : { etag, "W/" + etag, "\"other\", " + etag, "\"other\",W/" + etag + " ", std::string("*") }) {
+        Response response = client.get("/api/v1/pods", "If-None-Match: " + header + "\r\n");
+        EXPECT_EQ(response.status, 304) << header;
+        EXPECT_EQ(response.body, "") << header;
+        EXPECT_EQ(response.headers["etag"], etag) << header;
+    }
+    // Header names are case-insensitive
+    EXPECT_EQ(client.get("/api/v1/pods", "if-none-match:" + etag + "\r\n").status, 304);
+
+    for (const std::string& header : { std::string("\"other\""), etag.substr(0, etag.size() - 1), std::string("") }) {
+        EXPECT_EQ(client.get("/api/v1/pods", "If-None-Match: " + header + "\r\n").status, 200) << header;
+    }
+
+    // A new snapshot with other values changes the ETag of the list and of the changed pod only
+    std::string pod_etag = client.get("/api/v1/pods/ns1/pod-1").headers["etag"];
+    std::string other_pod_etag = client.get("/api/v1/pods/ns2/pod-2").headers["etag"];
+    latest_snapshot[2].sm_util = 99;
+    ASSERT_EQ(latest_snapshot[2].pod, "ns1/pod-1");
+    publish_api_snapshot(scheduler, scratch);
+    EXPECT_EQ(client.get("/api/v1/pods", "If-None-Match: " + etag + "\r\n").status, 200);
+    EXPECT_EQ(client.get("/api/v1/pods/ns1/pod-1", "If-None-Match: " + pod_etag + "\r\n").status, 200);
+    EXPECT_EQ(client.get("/api/v1/pods/ns2/pod-2", "If-None-Match: " + other_pod_etag + "\r\n").status, 304);
+}
+
+TEST_F(ApiServerTest, ForgetsPodsThatLeft)
+{
+    // The third snapshot reuses the buffers of the first, which still lists pod-3
+    publish(4);
+    publish(4);
+    publish(2);
+    Client client(server->port());
+    EXPECT_EQ(client.get("/api/v1/pods/ns1/pod-1").status, 200);
+    EXPECT_EQ(client.get("/api/v1/pods/ns2/pod-2").status, 404);
+    EXPECT_EQ(client.get("/api/v1/pods/ns0/pod-3").status, 404);
+    EXPECT_EQ(client.get("/api/v1/pods").body.find("pod-3"), std::string::npos);
+}
+
+TEST_F(ApiServerTest, AnswersPipelinedRequestsInOrder)
+{
+    publish(1);
+    Client client(server->port());
+    client.send("GET /healthz HTTP/1.1\r\n\r\nGET /api/v1/pods/ns0/missing HTTP/1.1\r\n\r\nGET /api/v1/gpus HTTP/1.1\r\n\r\n");
+    EXPECT_EQ(client.receive().status, 200);
+    EXPECT_EQ(client.receive().status, 404);
+    Response gpus = client.receive();
+    EXPECT_EQ(gpus.status, 200);
+    EXPECT_EQ(gpus.body.find(R"({"gpus":)"), 0u);
+}
+
+TEST_F(ApiServerTest, ReassemblesRequestsSplitAcrossReads)
+{
+    publish(1);
+    Client client(server->port());
+    std::string request = "GET /api/v1/pods/ns0/pod-0 HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    for (char c : request) {
+        client.send(std::string(1, c));
+    }
+    EXPECT_EQ(client.receive().status, 200);
+}
+
+TEST_F(ApiServerTest, RejectsUnsupportedRequests)
+{
+    publish(1);
+    {
+        Client client(server->port());
+        EXPECT_EQ(client.get("/api/v1/pods").status, 200);
+        client.send("POST /api/v1/pods HTTP/1.1\r\nContent-Length: 0\r\n\r\n");
+        EXPECT_EQ(client.receive().status, 405);
+        // The connection stays usable after a 405
+        EXPECT_EQ(client.get("/healthz").status, 200);
+    }
+    {
+        Client client(server->port());
+        client.send("garbage\r\n\r\n");
+        Response response = client.receive();
+        EXPECT_EQ(response.status, 400);
+        EXPECT_EQ(response.headers["connection"], "close");
+        EXPECT_TRUE(client.closed());
+    }
+    {
+        Client client(server->port());
+        client.send("GET /api/v1/pods HTTP/1.1\r\nX-Padding: " + std::string(10000, 'x'));
+        Response response = client.receive();
+        EXPECT_EQ(response.status, 431);
+        EXPECT_TRUE(client.closed());
+    }
+}
+
+TEST_F(ApiServerTest, ClosesWhenAsked)
+{
+    publish(1);
+    {
+        Client client(server->port());
+        Response response = client.get("/healthz", "Connection:  Close \r\n");
+        EXPECT_EQ(response.status, 200);
+        EXPECT_EQ(response.headers["connection"], "close");
+        EXPECT_TRUE(client.closed());
+    }
+    {
+        Client client(server->port());
+        client.send("GET /healthz HTTP/1.0\r\n\r\n");
+        EXPECT_EQ(client.receive().status, 200);
+        EXPECT_TRUE(client.closed());
+    }
+}
+
+TEST_F(ApiServerTest, ListensOnIpv4)
+{
+    // Dual-stack, or IPv4 only when the node has no IPv6, both accept 127.0.0.1
+    Client client(server->port());
+    EXPECT_EQ(client.get("/healthz").status, 200);
+    EXPECT_THROW(ApiServer(server->port()), std::runtime_error);
+}
+
+// The request mix of bench_api_server, interleaved on keep-alive connections
+TEST_F(ApiServerTest, AnswersInterleavedRequestsOnKeepAliveConnections)
+{
+    publish(128);
+    std::vector<std::unique_ptr<Client>> clients;
+    for (int i = 0; i < 4; i++) {
+        clients.push_back(std::make_unique<Client>(server->port()));
+    }
+    std::string etag = clients[0]->get("/api/v1/pods").headers["etag"];
+
+    for (int i = 0; i < 400; i++) {
+        Client& client = *clients[i % clients.size()];
+        switch (i % 4) {
+        case 0:
+            EXPECT_EQ(client.get("/api/v1/pods").headers["etag"], etag);
+            break;
+        case 1:
+            EXPECT_EQ(client.get("/api/v1/pods", "If-None-Match: " + etag + "\r\n").status, 304);
+            break;
+        case 2: {
+            std::string name = "pod-" + std::to_string(i % 128);
+            Response pod = client.get("/api/v1/pods/ns" + std::to_string(i % 128 % 3) + "/" + name);
+            EXPECT_EQ(pod.status, 200);
+            EXPECT_NE(pod.body.find("\"name\":\"" + name + "\""), std::string::npos);
+            break;
+        }
+        default:
+            EXPECT_EQ(client.get("/healthz").status, 200);
+        }
+    }
+}
+
+} // namespace
@@ -0,0 +1,188 @@
+// The resolution cache file: round trip, rejection of damaged or foreign files,
+// entries dropped after a restart and writes skipped while nothing changed.
+#include "vgpu_monitor.cpp"
+
+#include "fake_backends.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+class CacheTest : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        spdlog::set_level(spdlog::level::off);
+        char pattern[] = "/tmp/vgpu_monitor_cache.XXXXXX";
+        dir = mkdtemp(pattern);
+        path = dir + "/vgpu_monitor.cache";
+
+        node.add_pod("ns1/a", 0);
+        node.add_pod("ns2/a", 1);
+        pod_containers["ns1/a"] = "main";
+    }
+
+    void TearDown() override
+    {
+        std::filesystem::remove_all(dir);
+    }
+
+    // Forget everything like a restarted monitor, then enumerate the GPUs again as main() does
+    void restart()
+    {
+        node.cold_start();
+        get_gpu_uuids();
+    }
+
+    std::string read_file()
+    {
+        std::ifstream file(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    void write_file(const std::string& contents)
+    {
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << contents;
+    }
+
+    void expect_empty_caches()
+    {
+        EXPECT_TRUE(pod_uid_to_id.empty());
+        EXPECT_TRUE(pod_id_to_uids.empty());
+        EXPECT_TRUE(pod_id_to_docker_id.empty());
+        EXPECT_TRUE(gpu_usage.empty());
+        EXPECT_TRUE(gpu_index.empty());
+    }
+
+    FakeNode node { 2 };
+    std::string dir;
+    std::string path;
+};
+
+TEST_F(CacheTest, RestoresEveryCache)
+{
+    auto saved_uids = pod_uid_to_id;
+    auto saved_docker_ids = pod_id_to_docker_id;
+    auto saved_usage = gpu_usage;
+    auto saved_index = gpu_index;
+    ASSERT_EQ(save_caches(path), 0);
+
+    restart();
+    expect_empty_caches();
+    ASSERT_EQ(load_caches(path), 0);
+
+    EXPECT_EQ(pod_uid_to_id, saved_uids);
+    EXPECT_EQ(pod_id_to_docker_id, saved_docker_ids);
+    EXPECT_EQ(gpu_usage, saved_usage);
+    EXPECT_EQ(gpu_index, saved_index);
+    EXPECT_EQ(pod_id_to_uids.at("ns1/a"), (std::set<std::string> { node.pods.at("ns1/a").uid }));
+
+    // Nothing is confirmed until a cycle sees the processes
+    EXPECT_EQ(unverified_pod_uids.size(), 2u);
+    EXPECT_EQ(unverified_docker_ids.size(), 2u);
+}
+
+TEST_F(CacheTest, IgnoresABadChecksum)
+{
+    ASSERT_EQ(save_caches(path), 0);
+    std::string contents = read_file();
+    contents.back() ^= 0x01;
+    write_file(contents);
+
+    restart();
+    EXPECT_EQ(load_caches(path), -1);
+    expect_empty_caches();
+}
+
+TEST_F(CacheTest, IgnoresATruncatedFile)
+{
+    ASSERT_EQ(save_caches(path), 0);
+    std::string contents = read_file();
+
+    restart();
+    write_file(contents.substr(0, contents.size() - 1));
+    EXPECT_EQ(load_caches(path), -1);
+    expect_empty_caches();
+
+    write_file(contents.substr(0, sizeof(CacheFileHeader) - 1));
+    EXPECT_EQ(load_caches(path), -1);
+    expect_empty_caches();
+}
+
+TEST_F(CacheTest, IgnoresAnotherVersion)
+{
+    ASSERT_EQ(save_caches(path), 0);
+    std::string contents = read_file();
+    CacheFileHeader header;
+    memcpy(&header, contents.data(), sizeof(header));
+    header.version = cache_file_version + 1;
+    memcpy(&contents[0], &header, sizeof(header));
+    write_file(contents);
+
+    restart();
+    EXPECT_EQ(load_caches(path), -1);
+    expect_empty_caches();
+}
+
+TEST_F(CacheTest, DropsGpuUsageWhenTheGpusChanged)
+{
+    ASSERT_EQ(save_caches(path), 0);
+
+    // GPU positions in gpu_usage refer to another set of devices now
+    node.backend.gpus[1].uuid = "GPU-replaced";
+    restart();
+    ASSERT_EQ(load_caches(path), 0);
+    EXPECT_TRUE(gpu_usage.empty());
+    EXPECT_EQ(pod_uid_to_id.size(), 2u);
+    EXPECT_EQ(pod_id_to_docker_id.size(), 2u);
+}
+
+TEST_F(CacheTest, DropsEntriesNoProcessConfirms)
+{
+    ASSERT_EQ(save_caches(path), 0);
+    const auto gone = node.pods.at("ns2/a");
+    const auto live = node.pods.at("ns1/a");
+    node.stop_pod("ns2/a");
+
+    restart();
+    ASSERT_EQ(load_caches(path), 0);
+    node.harness.run_cycle();
+    drop_unverified_caches();
+
+    EXPECT_EQ(pod_uid_to_id.count(gone.uid), 0u);
+    EXPECT_EQ(pod_id_to_uids.count("ns2/a"), 0u);
+    EXPECT_EQ(pod_id_to_docker_id.count("ns2/a"), 0u);
+    EXPECT_EQ(gpu_usage.count(gone.docker_id), 0u);
+    EXPECT_EQ(gpu_index.count("ns2/a"), 0u);
+
+    EXPECT_EQ(pod_uid_to_id.at(live.uid), "ns1/a");
+    EXPECT_EQ(pod_id_to_docker_id.at("ns1/a"), live.docker_id);
+    EXPECT_EQ(gpu_usage.count(live.docker_id), 1u);
+    EXPECT_EQ(gpu_index.count("ns1/a"), 1u);
+    EXPECT_TRUE(unverified_pod_uids.empty());
+    EXPECT_TRUE(unverified_docker_ids.empty());
+}
+
+TEST_F(CacheTest, WritesOnlyAfterAChange)
+{
+    ASSERT_EQ(save_caches(path), 0);
+    std::filesystem::remove(path);
+
+    // Sampling the same pods again changes no cache
+    node.harness.run_cycle();
+    ASSERT_EQ(save_caches(path), 0);
+    EXPECT_FALSE(std::filesystem::exists(path));
+
+    node.add_pod("ns1/b", 0);
+    ASSERT_EQ(save_caches(path), 0);
+    EXPECT_TRUE(std::filesystem::exists(path));
+
+    // A restored file counts as saved
+    restart();
+    ASSERT_EQ(load_caches(path), 0);
+    std::filesystem::remove(path);
+    ASSERT_EQ(save_caches(path), 0);
+    EXPECT_FALSE(std::filesystem::exists(path));
+}
+
+} // namespace
@@ -0,0 +1,117 @@
+// Heap use of sampling cycles on the fake backends: once warmed up, cycles and
+// API snapshots over a steady set of pods allocate nothing, and the cycle arena
+// grows to the high-water mark of a cycle that overflowed it.
+#include "vgpu_monitor.cpp"
+
+#include "fake_backends.h"
+#include "heap_counter.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+class CycleArenaTest : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        spdlog::set_level(spdlog::level::off);
+        for (int i = 0; i < 32; i++) {
+            node.add_pod(make_pod_key("team-" + std::to_string(i % 4), "trainer-with-a-long-name-" + std::to_string(i)), i % 4, (1ull + i % 8) << 30, i);
+        }
+    }
+
+    void TearDown() override
+    {
+        api_snapshot.reset();
+        gpu_uuids.clear();
+    }
+
+    // Every GPU is due again after the longest interval
+    void run_cycle()
+    {
+        now += std::chrono::seconds(30);
+        node.harness.run_scheduled_cycle(now);
+    }
+
+    // Heap allocations of cycles run after warm_up cycles sized the arena and caches
+    size_t allocations(int warm_up, int cycles)
+    {
+        for (int i = 0; i < warm_up; i++) {
+            run_cycle();
+        }
+        size_t arena_before = cycle_arena.upstream_allocations();
+        heap_allocations = 0;
+        counting = true;
+        for (int i = 0; i < cycles; i++) {
+            run_cycle();
+        }
+        counting = false;
+        EXPECT_EQ(cycle_arena.upstream_allocations(), arena_before);
+        return heap_allocations;
+    }
+
+    FakeNode node { 4 };
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+};
+
+TEST_F(CycleArenaTest, SteadyCyclesDoNotAllocate)
+{
+    EXPECT_EQ(allocations(3, 100), 0u);
+}
+
+TEST_F(CycleArenaTest, SettlesAgainAfterNewPods)
+{
+    ASSERT_EQ(allocations(3, 10), 0u);
+    for (int i = 0; i < 64; i++) {
+        node.add_pod(make_pod_key("team-new", "trainer-with-a-long-name-" + std::to_string(i)), i % 4, 1ull << 30, 50);
+    }
+    EXPECT_EQ(allocations(3, 100), 0u);
+}
+
+TEST_F(CycleArenaTest, PublishesChangedSamplesWithoutAllocating)
+{
+    DeviceScheduler scheduler(4, DeviceScheduler::Config {});
+    CycleScratch scratch;
+    size_t total = 0;
+    for (int i = 0; i < 20; i++) {
+        // Every pod's usage changes every cycle
+        for (const auto& pod : node.pods) {
+            node.set_usage(pod.first, (1ull + (i + pod.second.pid) % 8) << 30, i);
+        }
+        heap_allocations = 0;
+        counting = i >= 3;
+        run_cycle();
+        publish_api_snapshot(scheduler, scratch);
+        counting = false;
+        total += heap_allocations;
+    }
+    EXPECT_EQ(total, 0u);
+}
+
+TEST(CycleArenaGrowthTest, GrowsToTheHighWaterMark)
+{
+    spdlog::set_level(spdlog::level::off);
+    CycleArena arena(256);
+    auto cycle = [&] {
+        std::pmr::vector<std::pmr::vector<char>> blocks(arena.resource());
+        for (int i = 0; i < 16; i++) {
+            blocks.emplace_back(1000);
+        }
+    };
+
+    cycle();
+    arena.reset();
+    size_t overflows = arena.upstream_allocations();
+    EXPECT_GT(overflows, 0u);
+    EXPECT_GE(arena.capacity(), 16u * 1000);
+    // Requested bytes plus padding, not the chunk sizes the monotonic arena grew by
+    EXPECT_LT(arena.capacity(), 20u * 1000);
+
+    for (int i = 0; i < 10; i++) {
+        cycle();
+        arena.reset();
+    }
+    EXPECT_EQ(arena.upstream_allocations(), overflows);
+}
+
+} // namespace
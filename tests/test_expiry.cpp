@@ -0,0 +1,222 @@
+// DeadlineQueue against a brute-force model, and eviction of pods that left
+// the node: their series, slots and cached resolutions go, other pods stay.
+#include "vgpu_monitor.cpp"
+
+#include "fake_backends.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+std::set<std::string> expire_all(DeadlineQueue<std::string>& queue, std::time_t now)
+{
+    std::set<std::string> expired;
+    queue.expire(now, [&](const std::string& key) { EXPECT_TRUE(expired.insert(key).second) << key; });
+    return expired;
+}
+
+TEST(DeadlineQueueTest, ExpiresKeysNotTouchedWithinTheTimeout)
+{
+    DeadlineQueue<std::string> queue(10);
+    queue.touch("a", 100);
+    queue.touch("b", 105);
+    EXPECT_TRUE(expire_all(queue, 110).empty());
+    EXPECT_EQ(expire_all(queue, 111), (std::set<std::string> { "a" }));
+    EXPECT_FALSE(queue.contains("a"));
+    EXPECT_TRUE(queue.contains("b"));
+    EXPECT_EQ(expire_all(queue, 116), (std::set<std::string> { "b" }));
+    EXPECT_EQ(queue.size(), 0u);
+}
+
+TEST(DeadlineQueueTest, TouchPostponesTheDeadline)
+{
+    DeadlineQueue<std::string> queue(10);
+    queue.touch("a", 100);
+    queue.touch("a", 108);
+    EXPECT_TRUE(expire_all(queue, 111).empty());
+    queue.touch("a", 115);
+    EXPECT_TRUE(expire_all(queue, 125).empty());
+    EXPECT_EQ(expire_all(queue, 126), (std::set<std::string> { "a" }));
+
+    // An older touch never moves the deadline back
+    queue.touch("b", 200);
+    queue.touch("b", 150);
+    EXPECT_TRUE(expire_all(queue, 210).empty());
+}
+
+TEST(DeadlineQueueTest, ErasedKeysNeverExpire)
+{
+    DeadlineQueue<std::string> queue(10);
+    queue.touch("a", 100);
+    queue.erase("a");
+    EXPECT_TRUE(expire_all(queue, 200).empty());
+
+    // Touched again after the erase, only the new deadline counts
+    queue.touch("b", 100);
+    queue.erase("b");
+    queue.touch("b", 150);
+    EXPECT_TRUE(expire_all(queue, 160).empty());
+    EXPECT_EQ(expire_all(queue, 161), (std::set<std::string> { "b" }));
+}
+
+TEST(DeadlineQueueTest, MatchesAFullScan)
+{
+    const std::time_t timeout = 30;
+    DeadlineQueue<std::string> queue(timeout);
+    std::map<std::string, std::time_t> last_seen;
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> key(0, 199);
+    std::uniform_int_distribution<int> action(0, 9);
+
+    std::time_t now = 1000;
+    for (int step = 0; step < 20000; step++) {
+        now += action(rng) == 0 ? 5 : 0;
+        std::string name = "pod-" + std::to_string(key(rng));
+        switch (action(rng)) {
+        case 0:
+            queue.erase(name);
+            last_seen.erase(name);
+            break;
+        case 1: {
+            // The keys a full scan would find past their deadline
+            std::set<std::string> expected;
+            for (auto it = last_seen.begin(); it != last_seen.end();) {
+                if (it->second + timeout < now) {
+                    expected.insert(it->first);
+                    it = last_seen.erase(it);
+                }
+                else {
+                    ++it;
+                }
+            }
+            ASSERT_EQ(expire_all(queue, now), expected) << "step " << step;
+            break;
+        }
+        default:
+            queue.touch(name, now);
+            last_seen[name] = std::max(last_seen[name], now);
+        }
+        ASSERT_EQ(queue.size(), last_seen.size());
+    }
+}
+
+class EvictionTest : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        spdlog::set_level(spdlog::level::off);
+        for (const char* key : { "ns1/a", "ns1/b", "ns2/a" }) {
+            node.add_pod(key, 0);
+        }
+        node.harness.run_cycle();
+    }
+
+    // Let the tombstone period pass for pods other than those in keep, as update_and_clean_gpu_data does
+    void evict_all_but(const std::set<std::string>& keep)
+    {
+        std::time_t later = std::time(nullptr) + 3600;
+        for (const auto& pod : keep) {
+            pod_tombstones.touch(pod, later);
+        }
+        pod_tombstones.expire(later, [&](const std::string& pod_id) {
+            evict_pod(pod_id, node.harness.gpu_data, node.harness.slot_expiry,
+                node.harness.sm_util, node.harness.mem_used, node.harness.total_mem);
+        });
+    }
+
+    std::set<std::string> exposed_pods()
+    {
+        std::set<std::string> pods;
+        for (const auto& family : node.harness.registry->Collect()) {
+            for (const auto& metric : family.metric) {
+                std::string pod_namespace;
+                std::string name;
+                for (const auto& label : metric.label) {
+                    if (label.name == "namespace") {
+                        pod_namespace = label.value;
+                    }
+                    else if (label.name == "pod") {
+                        name = label.value;
+                    }
+                }
+                pods.insert(make_pod_key(pod_namespace, name));
+            }
+        }
+        return pods;
+    }
+
+    FakeNode node { 2 };
+};
+
+TEST_F(EvictionTest, ForgetsEverythingAboutTheGonePod)
+{
+    const auto gone = node.pods.at("ns1/b");
+    node.stop_pod("ns1/b");
+    node.harness.run_cycle();
+    evict_all_but({ "ns1/a", "ns2/a" });
+
+    EXPECT_EQ(node.harness.gpu_data.count("ns1/b"), 0u);
+    EXPECT_FALSE(node.harness.slot_expiry.contains({ "ns1/b", 0 }));
+    EXPECT_EQ(pod_series.count("ns1/b"), 0u);
+    EXPECT_EQ(pod_id_to_docker_id.count("ns1/b"), 0u);
+    EXPECT_EQ(gpu_usage.count(gone.docker_id), 0u);
+    EXPECT_EQ(pod_uid_to_id.count(gone.uid), 0u);
+    EXPECT_EQ(pod_id_to_uids.count("ns1/b"), 0u);
+    EXPECT_EQ(gpu_index.count("ns1/b"), 0u);
+    EXPECT_EQ(pod_containers.count("ns1/b"), 0u);
+    EXPECT_EQ(exposed_pods(), (std::set<std::string> { "ns1/a", "ns2/a" }));
+
+    // Pods that share the name in another namespace, or the namespace, are untouched
+    for (const char* key : { "ns1/a", "ns2/a" }) {
+        const auto& pod = node.pods.at(key);
+        EXPECT_EQ(node.harness.gpu_data.count(key), 1u) << key;
+        EXPECT_TRUE(node.harness.slot_expiry.contains({ key, 0 })) << key;
+        EXPECT_EQ(pod_uid_to_id.at(pod.uid), key);
+        EXPECT_EQ(pod_id_to_docker_id.at(key), pod.docker_id);
+        EXPECT_EQ(gpu_usage.count(pod.docker_id), 1u) << key;
+        EXPECT_NE(node.harness.sample(key, 0), nullptr) << key;
+    }
+}
+
+TEST_F(EvictionTest, EvictsAllGonePodsInOneCycle)
+{
+    node.stop_pod("ns1/a");
+    node.stop_pod("ns2/a");
+    node.harness.run_cycle();
+    evict_all_but({ "ns1/b" });
+
+    EXPECT_EQ(exposed_pods(), (std::set<std::string> { "ns1/b" }));
+    EXPECT_EQ(pod_uid_to_id.size(), 1u);
+    EXPECT_EQ(pod_id_to_uids.size(), 1u);
+    EXPECT_EQ(pod_id_to_docker_id.size(), 1u);
+    EXPECT_EQ(node.harness.gpu_data.size(), 1u);
+    EXPECT_EQ(pod_tombstones.size(), 1u);
+}
+
+TEST_F(EvictionTest, ARecreatedPodStartsFresh)
+{
+    node.stop_pod("ns1/b");
+    node.harness.run_cycle();
+    evict_all_but({ "ns1/a", "ns2/a" });
+
+    // Same name, new UID and container
+    node.add_pod("ns1/b", 1, 2ull << 30, 70);
+    node.harness.run_cycle();
+    const PodGpuSample* sample = node.harness.sample("ns1/b", 0);
+    ASSERT_NE(sample, nullptr);
+    EXPECT_EQ(sample->sm_util, 70u);
+    EXPECT_EQ(exposed_pods(), (std::set<std::string> { "ns1/a", "ns1/b", "ns2/a" }));
+    EXPECT_TRUE(pod_tombstones.contains("ns1/b"));
+}
+
+TEST_F(EvictionTest, APodStillListedIsKept)
+{
+    // Sampled no more but listed by the apiserver, the series stay at 0
+    node.stop_pod("ns1/b");
+    node.harness.run_cycle();
+    evict_all_but({ "ns1/a", "ns1/b", "ns2/a" });
+    EXPECT_EQ(exposed_pods(), (std::set<std::string> { "ns1/a", "ns1/b", "ns2/a" }));
+    EXPECT_EQ(node.harness.gpu_data.count("ns1/b"), 1u);
+}
+
+} // namespace
@@ -0,0 +1,197 @@
+// AsyncHttpClient and the apiserver pod list against a local HTTPS server with
+// injected latency: deadlines of run_until, request timeouts and retry backoff.
+#include "vgpu_monitor.cpp"
+
+#include "fake_backends.h"
+#include "fake_https_server.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+// Slack for scheduling noise on a loaded test machine
+const auto slack = 50ms;
+// Upper bounds on wall-clock time only catch a client that blocks on a transfer
+// instead of keeping its deadline, so they stay far from the deadline itself
+const int overrun_factor = 10;
+
+class HttpClientTest : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        spdlog::set_level(spdlog::level::off);
+    }
+
+    std::unique_ptr<ApiServerPodList> pod_list(std::chrono::milliseconds interval = 1000ms, std::chrono::milliseconds timeout = 4000ms)
+    {
+        return std::make_unique<ApiServerPodList>(server.url("/api/v1/pods"), "token", server.ca_file, interval, timeout);
+    }
+
+    // Poll and serve the request to completion, the pod list is applied to bodies
+    void request(ApiServerPodList& pods, Clock::time_point now, bool valid = true)
+    {
+        pods.poll(http_client, now, [&](const std::string& body) {
+            bodies.push_back(body);
+            return valid;
+        });
+        auto deadline = Clock::now() + 10s;
+        while (pods.in_flight(http_client) && Clock::now() < deadline) {
+            http_client.run_until(Clock::now() + 10ms);
+        }
+        ASSERT_FALSE(pods.in_flight(http_client));
+    }
+
+    FakeHttpsServer server;
+    AsyncHttpClient http_client;
+    std::vector<std::string> bodies;
+};
+
+TEST(BackoffTest, DoublesWithEqualJitterUpToTheCap)
+{
+    std::mt19937 rng(1);
+    for (int failures = 0; failures < 24; failures++) {
+        long full = std::min(500L << std::min(failures, 16), 60000L);
+        for (int i = 0; i < 100; i++) {
+            auto delay = backoff_delay(failures, rng).count();
+            EXPECT_GE(delay, full / 2) << failures;
+            EXPECT_LE(delay, full) << failures;
+        }
+    }
+}
+
+TEST_F(HttpClientTest, ListsPodsOverTls)
+{
+    server.respond(200, R"({"items":[{"metadata":{"name":"a"}}]})");
+    auto pods = pod_list();
+    auto now = Clock::now();
+    request(*pods, now);
+
+    EXPECT_EQ(bodies, (std::vector<std::string> { R"({"items":[{"metadata":{"name":"a"}}]})" }));
+    EXPECT_EQ(pods->consecutive_failures(), 0);
+    EXPECT_EQ(pods->next_request_time(), now + 1000ms);
+
+    // Not due yet
+    pods->poll(http_client, now + 999ms, [](const std::string&) { return true; });
+    EXPECT_FALSE(pods->in_flight(http_client));
+
+    // The TLS connection is reused
+    request(*pods, pods->next_request_time());
+    EXPECT_EQ(bodies.size(), 2u);
+    EXPECT_EQ(server.requests(), 2);
+}
+
+TEST_F(HttpClientTest, RejectsAnUntrustedServer)
+{
+    FakeHttpsServer other;
+    ApiServerPodList pods(server.url("/api/v1/pods"), "token", other.ca_file, 1000ms, 4000ms);
+    request(pods, Clock::now());
+    EXPECT_TRUE(bodies.empty());
+    EXPECT_EQ(pods.consecutive_failures(), 1);
+    EXPECT_EQ(server.requests(), 0);
+}
+
+TEST_F(HttpClientTest, RunUntilKeepsItsDeadlineWithNothingToDo)
+{
+    auto start = Clock::now();
+    http_client.run_until(start + 100ms);
+    auto elapsed = Clock::now() - start;
+    EXPECT_GE(elapsed, 100ms);
+    EXPECT_LT(elapsed, overrun_factor * 100ms);
+}
+
+TEST_F(HttpClientTest, RunUntilKeepsItsDeadlineWithASlowServer)
+{
+    server.set_latency(2000ms);
+    auto pods = pod_list();
+    auto start = Clock::now();
+    pods->poll(http_client, start, [&](const std::string& body) {
+        bodies.push_back(body);
+        return true;
+    });
+
+    // Each wakeup returns long before the response, which is still outstanding
+    while (Clock::now() - start < 400ms) {
+        auto wakeup = Clock::now();
+        http_client.run_until(wakeup + 20ms);
+        EXPECT_LT(Clock::now() - wakeup, overrun_factor * 20ms);
+    }
+    EXPECT_TRUE(pods->in_flight(http_client));
+    EXPECT_TRUE(bodies.empty());
+
+    while (pods->in_flight(http_client) && Clock::now() - start < 5s) {
+        http_client.run_until(Clock::now() + 20ms);
+    }
+    EXPECT_EQ(bodies.size(), 1u);
+    EXPECT_GE(Clock::now() - start, 2000ms);
+    EXPECT_EQ(pods->consecutive_failures(), 0);
+}
+
+TEST_F(HttpClientTest, TimesOutAHungServer)
+{
+    server.set_latency(FakeHttpsServer::hang);
+    auto pods = pod_list(1000ms, 1000ms);
+    auto start = Clock::now();
+    pods->poll(http_client, start, [&](const std::string& body) {
+        bodies.push_back(body);
+        return true;
+    });
+
+    // The timeout fires from inside run_until, whose wakeups never wait for it
+    while (pods->in_flight(http_client) && Clock::now() - start < 10s) {
+        auto wakeup = Clock::now();
+        http_client.run_until(wakeup + 50ms);
+        EXPECT_LT(Clock::now() - wakeup, overrun_factor * 50ms);
+    }
+    EXPECT_FALSE(pods->in_flight(http_client));
+    EXPECT_GE(Clock::now() - start, 1000ms);
+    EXPECT_TRUE(bodies.empty());
+    EXPECT_EQ(pods->consecutive_failures(), 1);
+    EXPECT_EQ(server.requests(), 1);
+}
+
+TEST_F(HttpClientTest, BacksOffAfterFailures)
+{
+    server.respond(500, "internal error");
+    const auto interval = 1000ms;
+    auto pods = pod_list(interval);
+
+    for (int failures = 0; failures < 6; failures++) {
+        request(*pods, pods->next_request_time());
+        auto done = Clock::now();
+        EXPECT_EQ(pods->consecutive_failures(), failures + 1);
+
+        // Never sooner than the regular interval, and at least half the backoff
+        auto delay = pods->next_request_time() - done;
+        auto backoff_floor = std::chrono::milliseconds((500L << failures) / 2);
+        EXPECT_GE(delay, std::max<std::chrono::milliseconds>(interval, backoff_floor) - slack) << failures;
+        EXPECT_LE(delay, std::max<std::chrono::milliseconds>(interval, std::chrono::milliseconds(500L << failures))) << failures;
+
+        // Polling before the retry is due sends nothing
+        pods->poll(http_client, pods->next_request_time() - 1ms, [](const std::string&) { return true; });
+        EXPECT_FALSE(pods->in_flight(http_client));
+    }
+    EXPECT_EQ(server.requests(), 6);
+    EXPECT_TRUE(bodies.empty());
+
+    // A success resets the backoff
+    server.respond(200, R"({"items":[]})");
+    auto now = pods->next_request_time();
+    request(*pods, now);
+    EXPECT_EQ(pods->consecutive_failures(), 0);
+    EXPECT_EQ(pods->next_request_time(), now + interval);
+}
+
+TEST_F(HttpClientTest, BacksOffOnAnInvalidPodList)
+{
+    server.respond(200, "not json");
+    auto pods = pod_list(100ms);
+    request(*pods, Clock::now(), false);
+    EXPECT_EQ(bodies.size(), 1u);
+    EXPECT_EQ(pods->consecutive_failures(), 1);
+    EXPECT_GE(pods->next_request_time() - Clock::now(), 250ms - slack);
+}
+
+} // namespace
@@ -0,0 +1,230 @@
+// MIG topologies on the fake NVML backend: enumeration, mixed strategy
+// resources and the capacity of GPU instances with and without processes.
+#include "vgpu_monitor.cpp"
+
+#include "fake_backends.h"
+#include "fake_kubelet.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+const unsigned long long GiB = 1024ull * 1024 * 1024;
+
+class MigTest : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        reset_monitor_state();
+        spdlog::set_level(spdlog::level::off);
+
+        // GPU 0 is a whole card, GPU 1 is split into a 3g.40gb and a 1g.10gb
+        // instance with MIG slot 1 left unconfigured
+        FakeGpu whole;
+        whole.uuid = "GPU-aaaa";
+        whole.memory = 80 * GiB;
+        FakeGpu split;
+        split.uuid = "GPU-bbbb";
+        split.memory = 80 * GiB;
+        split.add_mig_instance(0, "MIG-1111", 40 * GiB);
+        split.add_mig_instance(2, "MIG-2222", 10 * GiB);
+        backend.gpus = { whole, split };
+        gpu_backend = &backend;
+        gpu_ids = { "/dev/nvidia0", "/dev/nvidia1" };
+        get_gpu_uuids();
+    }
+
+    void TearDown() override
+    {
+        gpu_backend = nullptr;
+    }
+
+    FakeGpu& instance(unsigned int gpu, unsigned int index)
+    {
+        return backend.gpus[gpu].mig_instances[index];
+    }
+
+    FakeGpuBackend backend;
+};
+
+std::string pod_json(const std::string& namespace_, const std::string& name, const std::string& limits)
+{
+    return R"({"metadata":{"name":")" + name + R"(","namespace":")" + namespace_ + R"("},)"
+        + R"("spec":{"containers":[{"name":"main","resources":{"limits":{)" + limits + "}}}]},"
+        + R"("status":{"phase":"Running"}})";
+}
+
+TEST_F(MigTest, EnumeratesMigInstancesAsAliasesOfTheirGpu)
+{
+    EXPECT_EQ(gpu_uuids, (std::vector<std::string> { "GPU-aaaa", "GPU-bbbb" }));
+    EXPECT_EQ(gpu_uuid_index.at("MIG-1111"), 1u);
+    EXPECT_EQ(gpu_uuid_index.at("MIG-2222"), 1u);
+    EXPECT_EQ(gpu_uuid_index.at("1:0"), 1u);
+    EXPECT_EQ(gpu_uuid_index.at("1:2"), 1u);
+    EXPECT_EQ(gpu_uuid_index.count("1:1"), 0u);
+    EXPECT_EQ(gpu_uuid_index.at("0"), 0u);
+    EXPECT_EQ(mig_instance_memory.at("MIG-1111"), 40 * GiB);
+    EXPECT_EQ(mig_instance_memory.at("1:2"), 10 * GiB);
+    EXPECT_EQ(mig_instance_memory.count("GPU-aaaa"), 0u);
+    EXPECT_EQ(mig_instance_ids.at("MIG-2222"), std::make_pair(1u, 2u));
+    EXPECT_EQ(mig_instance_ids.at("1:0"), std::make_pair(1u, 0u));
+    EXPECT_EQ(mig_instance_ids.count("GPU-bbbb"), 0u);
+}
+
+TEST_F(MigTest, CountsMigDevicesOnTheirGpu)
+{
+    auto usage = count_gpu_usage("MIG-1111, MIG-2222,GPU-aaaa");
+    EXPECT_EQ(usage, (std::map<int, int> { { 0, 1 }, { 1, 2 } }));
+}
+
+TEST_F(MigTest, RecognizesMixedStrategyResources)
+{
+    EXPECT_TRUE(is_gpu_resource("nvidia.com/gpu"));
+    EXPECT_TRUE(is_gpu_resource("nvidia.com/mig-1g.10gb"));
+    EXPECT_FALSE(is_gpu_resource("nvidia.com/gpu.shared"));
+    EXPECT_FALSE(is_gpu_resource("example.com/fpga"));
+    EXPECT_EQ(mig_profile_memory("nvidia.com/mig-1g.10gb"), 10 * GiB);
+    EXPECT_EQ(mig_profile_memory("nvidia.com/mig-1g.5gb+me"), 5 * GiB);
+    EXPECT_EQ(mig_profile_memory("nvidia.com/mig-3g"), 0u);
+    EXPECT_EQ(mig_profile_memory("nvidia.com/gpu"), 0u);
+}
+
+TEST_F(MigTest, ApiserverListCountsMigResources)
+{
+    std::string response = R"({"items":[)"
+        + pod_json("ns1", "small", R"("nvidia.com/mig-1g.10gb":"2","cpu":"1")") + ","
+        + pod_json("ns1", "mixed", R"("nvidia.com/mig-3g.40gb":"1","nvidia.com/mig-1g.10gb":"1")") + ","
+        + pod_json("ns2", "small", R"("nvidia.com/gpu":"1")") + ","
+        + pod_json("ns2", "cpu-only", R"("cpu":"4")") + "]}";
+    std::map<std::string, std::map<unsigned int, std::pair<unsigned int, unsigned long long>>> gpu_data;
+    ondemand::parser parser;
+    ASSERT_EQ(get_pods(gpu_data, response, parser), 0);
+
+    ASSERT_EQ(gpu_data.size(), 3u);
+    EXPECT_EQ(gpu_data.at("ns1/small").size(), 2u);
+    EXPECT_EQ(gpu_data.at("ns1/mixed").size(), 2u);
+    EXPECT_EQ(gpu_data.at("ns2/small").size(), 1u);
+
+    // The nominal profile size stands in until the instances are known, but
+    // only when every slot has the same profile
+    EXPECT_EQ(pod_gpu_capacity.at("ns1/small").at(0), 10 * GiB);
+    EXPECT_EQ(pod_gpu_capacity.at("ns1/small").at(1), 10 * GiB);
+    EXPECT_EQ(pod_gpu_capacity.count("ns1/mixed"), 0u);
+    EXPECT_EQ(pod_gpu_capacity.count("ns2/small"), 0u);
+}
+
+TEST_F(MigTest, BusyInstanceReportsItsOwnCapacity)
+{
+    FakeProcfs proc;
+    std::string docker_id = docker_id_of("c0ffee000001");
+    proc.add_process(100, "11111111-2222-3333-4444-555555555555", docker_id);
+    instance(1, 0).add_process(100, 3 * GiB, 40);
+
+    cache_pod_uid("11111111-2222-3333-4444-555555555555", "ns1/train");
+    pod_id_to_docker_id["ns1/train"] = "c0ffee000001";
+    gpu_usage["c0ffee000001"] = { { 0, 1 } };
+    gpu_index["ns1/train"] = { { "/dev/nvidia1", 0 } };
+
+    CycleHarness harness(2);
+    harness.gpu_data["ns1/train"][0] = { 0, 0 };
+    harness.run_cycle();
+
+    const PodGpuSample* sample = harness.sample("ns1/train", 0);
+    ASSERT_NE(sample, nullptr);
+    EXPECT_EQ(sample->mem_used, 3u * 1024);
+    EXPECT_EQ(sample->sm_util, 40u);
+    EXPECT_EQ(sample->total_mem, 40u * 1024);
+}
+
+TEST_F(MigTest, KubeletAssignmentSetsCapacityWithoutProcesses)
+{
+    FakeKubelet kubelet;
+    kubelet.respond(list_response({
+        pod_resources("ns1", "idle", { container_resources("main", { container_devices("nvidia.com/mig-1g.10gb", { "MIG-2222" }) }) }),
+        pod_resources("ns1", "both", { container_resources("main", { container_devices("nvidia.com/mig-3g.40gb", { "MIG-1111" }), container_devices("nvidia.com/mig-1g.10gb", { "MIG-2222" }) }) }),
+        pod_resources("ns2", "whole", { container_resources("main", { container_devices("nvidia.com/gpu", { "GPU-aaaa" }) }) }),
+        pod_resources("ns2", "fpga", { container_resources("main", { container_devices("example.com/fpga", { "fpga-0" }) }) }),
+    }));
+    PodResourcesClient client(kubelet.socket_path);
+    CycleHarness harness(2);
+    ASSERT_TRUE(list_pod_resources(client, harness.gpu_data));
+    EXPECT_EQ(harness.gpu_data.count("ns2/fpga"), 0u);
+
+    // No process runs anywhere, the capacity comes from the assigned instances
+    harness.run_cycle();
+    const PodGpuSample* idle = harness.sample("ns1/idle", 0);
+    ASSERT_NE(idle, nullptr);
+    EXPECT_EQ(idle->total_mem, 10u * 1024);
+    EXPECT_EQ(idle->mem_used, 0u);
+
+    // Two instances of one GPU become two slots of their own sizes, in MIG slot order
+    ASSERT_NE(harness.sample("ns1/both", 0), nullptr);
+    ASSERT_NE(harness.sample("ns1/both", 1), nullptr);
+    EXPECT_EQ(harness.sample("ns1/both", 0)->total_mem, 40u * 1024);
+    EXPECT_EQ(harness.sample("ns1/both", 1)->total_mem, 10u * 1024);
+
+    // Whole GPUs keep the gpu_allocation.txt share
+    const PodGpuSample* whole = harness.sample("ns2/whole", 0);
+    ASSERT_NE(whole, nullptr);
+    EXPECT_EQ(whole->total_mem, 80u * 1024);
+}
+
+TEST_F(MigTest, KubeletCapacityIsNotShrunkByBusyInstances)
+{
+    FakeKubelet kubelet;
+    kubelet.respond(list_response({
+        pod_resources("ns1", "both", { container_resources("main", { container_devices("nvidia.com/mig-3g.40gb", { "MIG-1111" }), container_devices("nvidia.com/mig-1g.10gb", { "MIG-2222" }) }) }),
+    }));
+    PodResourcesClient client(kubelet.socket_path);
+    CycleHarness harness(2);
+    ASSERT_TRUE(list_pod_resources(client, harness.gpu_data));
+
+    // A process in only one of the two instances
+    FakeProcfs proc;
+    proc.add_process(200, "aaaaaaaa-2222-3333-4444-555555555555", docker_id_of("c0ffee000002"));
+    instance(1, 1).add_process(200, 2 * GiB, 10);
+    cache_pod_uid("aaaaaaaa-2222-3333-4444-555555555555", "ns1/both");
+    pod_id_to_docker_id["ns1/both"] = "c0ffee000002";
+
+    harness.run_cycle();
+    ASSERT_NE(harness.sample("ns1/both", 0), nullptr);
+    ASSERT_NE(harness.sample("ns1/both", 1), nullptr);
+    EXPECT_EQ(harness.sample("ns1/both", 0)->total_mem, 40u * 1024);
+    EXPECT_EQ(harness.sample("ns1/both", 0)->mem_used, 0u);
+    EXPECT_EQ(harness.sample("ns1/both", 1)->total_mem, 10u * 1024);
+    EXPECT_EQ(harness.sample("ns1/both", 1)->mem_used, 2u * 1024);
+    EXPECT_EQ(harness.sample("ns1/both", 1)->sm_util, 10u);
+}
+
+TEST_F(MigTest, VisibleDevicesGiveEachInstanceItsSlot)
+{
+    // Without the kubelet the instances come from NVIDIA_VISIBLE_DEVICES
+    FakeProcfs proc;
+    std::string uid = "bbbbbbbb-2222-3333-4444-555555555555";
+    proc.add_process(300, uid, docker_id_of("c0ffee000003"));
+    proc.add_process(301, uid, docker_id_of("c0ffee000003"));
+    instance(1, 0).add_process(300, 5 * GiB, 30);
+    instance(1, 1).add_process(301, 1 * GiB, 20);
+    cache_pod_uid(uid, "ns1/both");
+    pod_id_to_docker_id["ns1/both"] = "c0ffee000003";
+    gpu_index["ns1/both"] = { { "/dev/nvidia1", 0 } };
+    parse_docker_gpus("c0ffee000003", "                \"NVIDIA_VISIBLE_DEVICES=MIG-2222,MIG-1111\",\n");
+    EXPECT_EQ(gpu_usage.at("c0ffee000003"), (std::map<int, int> { { 0, 2 } }));
+
+    CycleHarness harness(2);
+    harness.gpu_data["ns1/both"][0] = { 0, 0 };
+    harness.gpu_data["ns1/both"][1] = { 0, 0 };
+    harness.run_cycle();
+    const PodGpuSample* large = harness.sample("ns1/both", 0);
+    const PodGpuSample* small = harness.sample("ns1/both", 1);
+    ASSERT_NE(large, nullptr);
+    ASSERT_NE(small, nullptr);
+    EXPECT_EQ(large->total_mem, 40u * 1024);
+    EXPECT_EQ(large->mem_used, 5u * 1024);
+    EXPECT_EQ(large->sm_util, 30u);
+    EXPECT_EQ(small->total_mem, 10u * 1024);
+    EXPECT_EQ(small->mem_used, 1u * 1024);
+    EXPECT_EQ(small->sm_util, 20u);
+}
+
+} // namespace
@@ -0,0 +1,330 @@
+// PodResourcesClient against a fake kubelet: the protobuf reader, gRPC framing
+// and trailers, and how assignments become gpu_data slots and GPU usage.
+#include "vgpu_monitor.cpp"
+
+#include "fake_backends.h"
+#include "fake_kubelet.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using GpuData = std::map<std::string, std::map<unsigned int, std::pair<unsigned int, unsigned long long>>>;
+
+class PodResourcesTest : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        reset_monitor_state();
+        spdlog::set_level(spdlog::level::off);
+
+        FakeGpu gpu0;
+        gpu0.uuid = "GPU-aaaa";
+        gpu0.memory = 16ull << 30;
+        FakeGpu gpu1;
+        gpu1.uuid = "GPU-bbbb";
+        gpu1.memory = 16ull << 30;
+        FakeGpu gpu2;
+        gpu2.uuid = "GPU-cccc";
+        gpu2.memory = 80ull << 30;
+        gpu2.add_mig_instance(0, "MIG-1111", 10ull << 30);
+        backend.gpus = { gpu0, gpu1, gpu2 };
+        gpu_backend = &backend;
+        gpu_ids = { "/dev/nvidia0", "/dev/nvidia1", "/dev/nvidia2" };
+        get_gpu_uuids();
+    }
+
+    void TearDown() override
+    {
+        gpu_backend = nullptr;
+    }
+
+    FakeGpuBackend backend;
+    FakeKubelet kubelet;
+    PodResourcesClient client { kubelet.socket_path };
+    GpuData gpu_data;
+};
+
+std::string gpu_pod(const std::string& namespace_, const std::string& name, const std::vector<std::string>& device_ids)
+{
+    return pod_resources(namespace_, name, { container_resources("main", { container_devices("nvidia.com/gpu", device_ids) }) });
+}
+
+TEST(ProtoReaderTest, ReadsMultiByteVarints)
+{
+    ProtoWriter writer;
+    writer.append_varint(300);
+    writer.append_varint(UINT64_MAX);
+    ProtoReader reader { writer.out.data(), writer.out.data() + writer.out.size() };
+    uint64_t value;
+    ASSERT_TRUE(reader.read_varint(value));
+    EXPECT_EQ(value, 300u);
+    ASSERT_TRUE(reader.read_varint(value));
+    EXPECT_EQ(value, UINT64_MAX);
+    EXPECT_TRUE(reader.done());
+}
+
+TEST(ProtoReaderTest, RejectsTruncatedInput)
+{
+    // A varint whose continuation bit runs past the end
+    std::string varint = "\x96";
+    ProtoReader varint_reader { varint.data(), varint.data() + varint.size() };
+    uint64_t value;
+    EXPECT_FALSE(varint_reader.read_varint(value));
+
+    // A length prefix longer than the remaining bytes
+    std::string bytes = "\x05" "abc";
+    ProtoReader bytes_reader { bytes.data(), bytes.data() + bytes.size() };
+    std::string_view view;
+    EXPECT_FALSE(bytes_reader.read_bytes(view));
+
+    std::string fixed = "abc";
+    ProtoReader fixed32_reader { fixed.data(), fixed.data() + fixed.size() };
+    EXPECT_FALSE(fixed32_reader.skip(5));
+    ProtoReader fixed64_reader { fixed.data(), fixed.data() + fixed.size() };
+    EXPECT_FALSE(fixed64_reader.skip(1));
+}
+
+TEST(ProtoReaderTest, SkipsEveryWireType)
+{
+    ProtoWriter writer;
+    writer.varint(9, 1ull << 40).fixed64(10, 7).bytes(11, "nested").fixed32(12, 3).bytes(1, "kept");
+    ProtoReader reader { writer.out.data(), writer.out.data() + writer.out.size() };
+    uint32_t field;
+    uint32_t wire_type;
+    for (uint32_t expected : { 0u, 1u, 2u, 5u }) {
+        ASSERT_TRUE(reader.read_tag(field, wire_type));
+        EXPECT_EQ(wire_type, expected);
+        ASSERT_TRUE(reader.skip(wire_type));
+    }
+    ASSERT_TRUE(reader.read_tag(field, wire_type));
+    std::string_view kept;
+    ASSERT_TRUE(reader.read_bytes(kept));
+    EXPECT_EQ(field, 1u);
+    EXPECT_EQ(kept, "kept");
+    EXPECT_TRUE(reader.done());
+
+    // Groups (3, 4) are not used by the PodResources API
+    EXPECT_FALSE(reader.skip(3));
+}
+
+TEST_F(PodResourcesTest, SendsAnEmptyListRequest)
+{
+    kubelet.respond(list_response({}));
+    ASSERT_TRUE(list_pod_resources(client, gpu_data));
+    EXPECT_EQ(kubelet.requests(), 1);
+    EXPECT_TRUE(client.ready());
+    EXPECT_TRUE(client.pod_devices().empty());
+}
+
+TEST_F(PodResourcesTest, GroupsContainersOfAPod)
+{
+    kubelet.respond(list_response({
+        pod_resources("ns1", "train", {
+                                          container_resources("sidecar", { container_devices("example.com/fpga", { "fpga-0" }) }),
+                                          container_resources("worker-0", { container_devices("nvidia.com/gpu", { "GPU-aaaa" }) }),
+                                          container_resources("worker-1", { container_devices("nvidia.com/gpu", { "GPU-bbbb" }) }),
+                                      }),
+    }));
+    ASSERT_TRUE(list_pod_resources(client, gpu_data));
+
+    EXPECT_EQ(client.pod_devices().at("ns1/train"), (std::vector<std::string> { "GPU-aaaa", "GPU-bbbb" }));
+    EXPECT_EQ(client.device_owners().at("GPU-aaaa").container, "worker-0");
+    EXPECT_EQ(client.device_owners().at("GPU-bbbb").container, "worker-1");
+    EXPECT_EQ(client.device_owners().count("fpga-0"), 0u);
+
+    EXPECT_EQ(gpu_data.at("ns1/train").size(), 2u);
+    EXPECT_EQ(kubelet_gpu_usage.at("ns1/train"), (std::map<int, int> { { 0, 1 }, { 1, 1 } }));
+    EXPECT_EQ(gpu_index.at("ns1/train").at("/dev/nvidia1"), 1u);
+    EXPECT_EQ(pod_containers.at("ns1/train"), "worker-0");
+}
+
+TEST_F(PodResourcesTest, CountsSharedReplicasPerGpu)
+{
+    kubelet.respond(list_response({
+        gpu_pod("ns1", "shared", { "GPU-bbbb::3", "GPU-aaaa::0", "GPU-aaaa::1" }),
+    }));
+    ASSERT_TRUE(list_pod_resources(client, gpu_data));
+
+    EXPECT_EQ(gpu_data.at("ns1/shared").size(), 3u);
+    EXPECT_EQ(kubelet_gpu_usage.at("ns1/shared"), (std::map<int, int> { { 0, 2 }, { 1, 1 } }));
+    EXPECT_EQ(gpu_index.at("ns1/shared").at("/dev/nvidia0"), 0u);
+    EXPECT_EQ(gpu_index.at("ns1/shared").at("/dev/nvidia1"), 1u);
+    EXPECT_EQ(pod_gpu_capacity.count("ns1/shared"), 0u);
+}
+
+TEST_F(PodResourcesTest, MapsMigUuidsToTheirGpu)
+{
+    kubelet.respond(list_response({
+        pod_resources("ns1", "mig", { container_resources("main", { container_devices("nvidia.com/mig-1g.10gb", { "MIG-1111" }) }) }),
+    }));
+    ASSERT_TRUE(list_pod_resources(client, gpu_data));
+
+    EXPECT_EQ(kubelet_gpu_usage.at("ns1/mig"), (std::map<int, int> { { 0, 1 } }));
+    EXPECT_EQ(gpu_index.at("ns1/mig").at("/dev/nvidia2"), 0u);
+    EXPECT_EQ(pod_gpu_capacity.at("ns1/mig").at(0), 10ull << 30);
+}
+
+TEST_F(PodResourcesTest, KeysPodsByNamespace)
+{
+    kubelet.respond(list_response({
+        gpu_pod("ns1", "train", { "GPU-aaaa" }),
+        gpu_pod("ns2", "train", { "GPU-bbbb" }),
+    }));
+    ASSERT_TRUE(list_pod_resources(client, gpu_data));
+
+    EXPECT_EQ(kubelet_gpu_usage.at("ns1/train"), (std::map<int, int> { { 0, 1 } }));
+    EXPECT_EQ(kubelet_gpu_usage.at("ns2/train"), (std::map<int, int> { { 0, 1 } }));
+    EXPECT_EQ(gpu_index.at("ns1/train").count("/dev/nvidia0"), 1u);
+    EXPECT_EQ(gpu_index.at("ns2/train").count("/dev/nvidia1"), 1u);
+}
+
+TEST_F(PodResourcesTest, IgnoresUnknownFieldsAtEveryLevel)
+{
+    // Fields of newer kubelets (topology, memory, dynamic resources) with every wire type
+    ProtoWriter device;
+    device.varint(9, 1).bytes(1, "nvidia.com/gpu").fixed64(10, 42).bytes(2, "GPU-aaaa").bytes(3, "topology");
+    ProtoWriter container;
+    container.bytes(1, "main").fixed32(9, 5).bytes(2, device.out).bytes(3, "cpu ids").varint(4, 2);
+    // The namespace follows the containers, fields may come in any order
+    ProtoWriter pod;
+    pod.bytes(1, "train").bytes(3, container.out).varint(9, 300).bytes(2, "ns1");
+    ProtoWriter list;
+    list.bytes(1, pod.out).bytes(2, "unknown").fixed32(3, 1);
+    kubelet.respond(list.out);
+
+    ASSERT_TRUE(list_pod_resources(client, gpu_data));
+    EXPECT_EQ(client.pod_devices().at("ns1/train"), (std::vector<std::string> { "GPU-aaaa" }));
+    EXPECT_EQ(client.device_owners().at("GPU-aaaa").namespace_, "ns1");
+}
+
+TEST_F(PodResourcesTest, ReportsOnlyChangedPods)
+{
+    std::set<std::string> changed;
+    kubelet.respond(list_response({
+        gpu_pod("ns1", "a", { "GPU-aaaa" }),
+        gpu_pod("ns1", "b", { "GPU-bbbb" }),
+    }));
+    ASSERT_TRUE(list_pod_resources(client, gpu_data, &changed));
+    EXPECT_EQ(changed, (std::set<std::string> { "ns1/a", "ns1/b" }));
+
+    ASSERT_TRUE(list_pod_resources(client, gpu_data, &changed));
+    EXPECT_TRUE(changed.empty());
+
+    // b moves to another GPU, a leaves
+    kubelet.respond(list_response({
+        gpu_pod("ns1", "b", { "GPU-aaaa" }),
+    }));
+    ASSERT_TRUE(list_pod_resources(client, gpu_data, &changed));
+    EXPECT_EQ(changed, (std::set<std::string> { "ns1/a", "ns1/b" }));
+    EXPECT_EQ(kubelet_gpu_usage.count("ns1/a"), 0u);
+    EXPECT_EQ(gpu_index.count("ns1/a"), 0u);
+    EXPECT_EQ(gpu_index.at("ns1/b").count("/dev/nvidia0"), 1u);
+    EXPECT_EQ(kubelet.requests(), 3);
+}
+
+TEST_F(PodResourcesTest, FailsOnNonZeroGrpcStatus)
+{
+    kubelet.respond(list_response({ gpu_pod("ns1", "a", { "GPU-aaaa" }) }));
+    ASSERT_TRUE(list_pod_resources(client, gpu_data));
+
+    // UNAVAILABLE keeps the last good assignment but marks the client not ready
+    kubelet.respond(list_response({}), 14);
+    EXPECT_FALSE(list_pod_resources(client, gpu_data));
+    EXPECT_EQ(kubelet.requests(), 2);
+    EXPECT_FALSE(client.ready());
+    EXPECT_EQ(client.pod_devices().count("ns1/a"), 1u);
+    EXPECT_EQ(kubelet_gpu_usage.count("ns1/a"), 1u);
+
+    kubelet.respond(list_response({ gpu_pod("ns1", "a", { "GPU-aaaa" }) }));
+    EXPECT_TRUE(list_pod_resources(client, gpu_data));
+    EXPECT_TRUE(client.ready());
+}
+
+TEST_F(PodResourcesTest, RejectsBadFraming)
+{
+    std::string message = list_response({ gpu_pod("ns1", "a", { "GPU-aaaa" }) });
+
+    // Shorter than the gRPC message prefix
+    kubelet.respond_raw(std::string(3, '\0'));
+    EXPECT_FALSE(list_pod_resources(client, gpu_data));
+
+    // Compressed messages are not negotiated
+    std::string compressed = grpc_frame(message);
+    compressed[0] = 1;
+    kubelet.respond_raw(compressed);
+    EXPECT_FALSE(list_pod_resources(client, gpu_data));
+
+    // Length prefix past the end of the body
+    std::string truncated = grpc_frame(message);
+    truncated.resize(truncated.size() - 4);
+    kubelet.respond_raw(truncated);
+    EXPECT_FALSE(list_pod_resources(client, gpu_data));
+
+    // A nested message whose length runs past its parent
+    ProtoWriter broken;
+    broken.bytes(1, std::string("\x0a\x7f", 2));
+    kubelet.respond(broken.out);
+    EXPECT_FALSE(list_pod_resources(client, gpu_data));
+
+    EXPECT_FALSE(client.ready());
+    EXPECT_TRUE(gpu_data.empty());
+    EXPECT_EQ(kubelet.requests(), 4);
+}
+
+TEST_F(PodResourcesTest, NamesThePodOfAProcessWithoutDocker)
+{
+    kubelet.respond(list_response({
+        gpu_pod("ns1", "train", { "GPU-aaaa" }),
+        pod_resources("ns2", "mig", { container_resources("main", { container_devices("nvidia.com/mig-1g.10gb", { "MIG-1111" }) }) }),
+    }));
+    CycleHarness harness(3);
+    ASSERT_TRUE(list_pod_resources(client, harness.gpu_data));
+
+    FakeDocker docker;
+    FakeProcfs proc;
+    proc.add_process(100, "11111111-0000-0000-0000-000000000000", docker_id_of("c0ffee000001"));
+    backend.gpus[0].add_process(100, 1ull << 30, 20);
+    proc.add_process(200, "22222222-0000-0000-0000-000000000000", docker_id_of("c0ffee000002"));
+    backend.gpus[2].mig_instances[0].add_process(200, 2ull << 30, 30);
+    harness.run_cycle();
+
+    EXPECT_EQ(pod_uid_to_id.at("11111111-0000-0000-0000-000000000000"), "ns1/train");
+    EXPECT_EQ(pod_uid_to_id.at("22222222-0000-0000-0000-000000000000"), "ns2/mig");
+    EXPECT_EQ(docker.calls(), 0u);
+    ASSERT_NE(harness.sample("ns1/train", 0), nullptr);
+    EXPECT_EQ(harness.sample("ns1/train", 0)->mem_used, 1024u);
+    ASSERT_NE(harness.sample("ns2/mig", 0), nullptr);
+    EXPECT_EQ(harness.sample("ns2/mig", 0)->mem_used, 2048u);
+}
+
+TEST_F(PodResourcesTest, AsksDockerForTheProcessesOfASharedGpu)
+{
+    // Replicas of one GPU in two pods do not tell which pod a process belongs to
+    kubelet.respond(list_response({
+        gpu_pod("ns1", "a", { "GPU-bbbb::0" }),
+        gpu_pod("ns1", "b", { "GPU-bbbb::1" }),
+    }));
+    CycleHarness harness(3);
+    ASSERT_TRUE(list_pod_resources(client, harness.gpu_data));
+
+    FakeDocker docker;
+    FakeProcfs proc;
+    const std::string uid = "bbbbbbbb-0000-0000-0000-000000000000";
+    proc.add_process(300, uid, docker_id_of("c0ffee000003"));
+    backend.gpus[1].add_process(300, 1ull << 30, 20);
+    docker.add_container("c0ffee000003", "k8s_main_b_ns1_" + uid + "_0", "GPU-bbbb", "/dev/nvidia1");
+    harness.run_cycle();
+
+    EXPECT_EQ(pod_uid_to_id.at(uid), "ns1/b");
+    EXPECT_EQ(docker.calls(), 1u);
+}
+
+TEST_F(PodResourcesTest, FailsWhenTheKubeletIsGone)
+{
+    PodResourcesClient missing("/nonexistent/kubelet.sock");
+    EXPECT_FALSE(list_pod_resources(missing, gpu_data));
+    EXPECT_FALSE(missing.ready());
+}
+
+} // namespace
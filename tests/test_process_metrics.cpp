@@ -0,0 +1,174 @@
+// Per-process series on the fake backends: their labels, removal when a process
+// exits, pid reuse, the bounded name cache and their share of the series budget.
+#include "vgpu_monitor.cpp"
+
+#include "fake_backends.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+class ProcessMetricsTest : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        spdlog::set_level(spdlog::level::off);
+        process_metrics = std::make_unique<ProcessMetrics>(sm_util, mem_used, 2);
+        add_pod("ns1/a", 0, 1ull << 30, 10);
+        add_pod("ns1/b", 1, 2ull << 30, 20);
+    }
+
+    void TearDown() override
+    {
+        process_metrics.reset();
+    }
+
+    // Start a pod whose container docker knows by name
+    void add_pod(const std::string& pod_key, unsigned int gpu, unsigned long long memory, unsigned int util)
+    {
+        node.add_pod(pod_key, gpu, memory, util);
+        const auto& pod = node.pods.at(pod_key);
+        docker.add_container(pod.docker_id, "k8s_main_" + std::string(pod_key_name(pod_key)) + "_" + std::string(pod_key_namespace(pod_key)) + "_" + pod.uid + "_0",
+            "GPU-" + std::to_string(gpu), "/dev/nvidia" + std::to_string(gpu));
+    }
+
+    unsigned int pid(const std::string& pod_key)
+    {
+        return node.pods.at(pod_key).pid;
+    }
+
+    // Labels and value of the exposed memory series by pid
+    std::map<std::string, std::pair<std::map<std::string, std::string>, double>> series()
+    {
+        std::map<std::string, std::pair<std::map<std::string, std::string>, double>> result;
+        for (const auto& metric_family : node.harness.registry->Collect()) {
+            if (metric_family.name != "pod_process_gpu_memory_used") {
+                continue;
+            }
+            for (const auto& metric : metric_family.metric) {
+                std::map<std::string, std::string> labels;
+                for (const auto& label : metric.label) {
+                    labels[label.name] = label.value;
+                }
+                result[labels["pid"]] = { labels, metric.gauge.value };
+            }
+        }
+        return result;
+    }
+
+    FakeNode node { 2 };
+    FakeDocker docker;
+    prometheus::Family<prometheus::Gauge>& sm_util = prometheus::BuildGauge().Name("pod_process_gpu_sm_util").Help("").Register(*node.harness.registry);
+    prometheus::Family<prometheus::Gauge>& mem_used = prometheus::BuildGauge().Name("pod_process_gpu_memory_used").Help("").Register(*node.harness.registry);
+};
+
+TEST_F(ProcessMetricsTest, LabelsEachProcess)
+{
+    node.harness.run_cycle();
+    auto exposed = series();
+    ASSERT_EQ(exposed.size(), 2u);
+
+    auto& [labels, value] = exposed.at(std::to_string(pid("ns1/b")));
+    EXPECT_EQ(labels["namespace"], "ns1");
+    EXPECT_EQ(labels["pod"], "b");
+    EXPECT_EQ(labels["container"], "main");
+    EXPECT_EQ(labels["container_id"], node.pods.at("ns1/b").docker_id);
+    EXPECT_EQ(labels["device"], "1");
+    EXPECT_EQ(labels["comm"], "python");
+    EXPECT_EQ(labels.count("gpu_id"), 0u);
+    EXPECT_EQ(value, 2048);
+}
+
+TEST_F(ProcessMetricsTest, RemovesTheSeriesOfAnExitedProcess)
+{
+    node.harness.run_cycle();
+    unsigned int exited = pid("ns1/b");
+    node.stop_pod("ns1/b");
+    node.harness.run_cycle();
+
+    auto exposed = series();
+    EXPECT_EQ(exposed.size(), 1u);
+    EXPECT_EQ(exposed.count(std::to_string(exited)), 0u);
+    EXPECT_EQ(process_metrics->process_count(), 1u);
+    EXPECT_EQ(process_metrics->cached_names(), 1u);
+}
+
+TEST_F(ProcessMetricsTest, ReadsTheStartTimeOfNewProcessesOnly)
+{
+    for (int i = 0; i < 10; i++) {
+        node.harness.run_cycle();
+    }
+    EXPECT_EQ(process_metrics->total_cost().stat_reads, 2u);
+    EXPECT_EQ(process_metrics->total_cost().comm_reads, 2u);
+
+    add_pod("ns1/c", 0, 1ull << 30, 10);
+    node.harness.run_cycle();
+    EXPECT_EQ(process_metrics->total_cost().stat_reads, 3u);
+}
+
+TEST_F(ProcessMetricsTest, DetectsAPidReusedByAnotherPod)
+{
+    node.harness.run_cycle();
+    unsigned int reused = pid("ns1/b");
+    node.stop_pod("ns1/b");
+
+    // A process of a new pod gets the pid
+    add_pod("ns2/c", 1, 3ull << 30, 30);
+    FakeNode::Pod pod = node.pods.at("ns2/c");
+    node.stop_pod("ns2/c");
+    node.proc.add_process(reused, pod.uid, docker_id_of(pod.docker_id), "torchrun", 2000);
+    node.backend.gpus[1].add_process(reused, 3ull << 30, 30);
+    node.harness.run_cycle();
+
+    auto exposed = series();
+    ASSERT_EQ(exposed.size(), 2u);
+    auto& [labels, value] = exposed.at(std::to_string(reused));
+    EXPECT_EQ(labels["namespace"], "ns2");
+    EXPECT_EQ(labels["pod"], "c");
+    EXPECT_EQ(labels["container_id"], pod.docker_id);
+    EXPECT_EQ(labels["comm"], "torchrun");
+    EXPECT_EQ(value, 3072);
+    EXPECT_EQ(process_metrics->total_cost().stat_reads, 3u);
+}
+
+TEST_F(ProcessMetricsTest, BoundsTheNameCache)
+{
+    add_pod("ns1/c", 0, 3ull << 30, 10);
+    add_pod("ns1/d", 1, 4ull << 30, 10);
+    node.harness.run_cycle();
+    EXPECT_EQ(series().size(), 4u);
+    EXPECT_EQ(process_metrics->cached_names(), 2u);
+    EXPECT_EQ(process_metrics->total_cost().comm_reads, 4u);
+
+    // Labels are built once, the evicted names are not read again
+    node.harness.run_cycle();
+    EXPECT_EQ(process_metrics->total_cost().comm_reads, 4u);
+}
+
+TEST_F(ProcessMetricsTest, GetsWhatThePodSeriesLeaveOfTheBudget)
+{
+    folded_series_gauge = &prometheus::BuildGauge().Name("vgpu_monitor_folded_series").Help("").Register(*node.harness.registry).Add({});
+    add_pod("ns1/c", 0, 3ull << 30, 10);
+
+    // Three pod series, the process using the most memory takes the last one
+    series_budget = 4;
+    node.harness.run_cycle();
+    auto exposed = series();
+    ASSERT_EQ(exposed.size(), 1u);
+    EXPECT_EQ(exposed.count(std::to_string(pid("ns1/c"))), 1u);
+    EXPECT_EQ(folded_series_gauge->Value(), 2);
+
+    // Two pod series and "_other" take the whole budget
+    series_budget = 2;
+    node.harness.run_cycle();
+    EXPECT_EQ(series().size(), 0u);
+    EXPECT_EQ(process_metrics->process_count(), 3u);
+    EXPECT_EQ(folded_series_gauge->Value(), 1 + 3);
+
+    series_budget = 6;
+    node.harness.run_cycle();
+    EXPECT_EQ(series().size(), 3u);
+    EXPECT_EQ(folded_series_gauge->Value(), 0);
+}
+
+} // namespace
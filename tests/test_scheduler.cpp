@@ -0,0 +1,184 @@
+// Adaptive sampling: DeviceScheduler intervals under synthetic utilization, and
+// the NVML calls it saves on a node whose GPUs are partly idle.
+#include "vgpu_monitor.cpp"
+
+#include "fake_backends.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+class DeviceSchedulerTest : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        spdlog::set_level(spdlog::level::off);
+    }
+
+    // Sample GPU 0 when it is due, as the main loop does on every tick
+    void sample(const std::pmr::set<unsigned int>& pids, unsigned int utilization)
+    {
+        while (!scheduler.due(0, now)) {
+            now += scheduler.tick();
+        }
+        scheduler.observe(0, now, pids, utilization);
+    }
+
+    DeviceScheduler::Config config;
+    DeviceScheduler scheduler { 1, config };
+    Clock::time_point now = Clock::now();
+};
+
+TEST_F(DeviceSchedulerTest, BacksOffWhenIdle)
+{
+    EXPECT_EQ(scheduler.interval(0), config.interval);
+    for (int i = 0; i < config.idle_samples - 1; i++) {
+        sample({}, 0);
+        EXPECT_EQ(scheduler.interval(0), config.interval);
+    }
+    sample({}, 0);
+    EXPECT_EQ(scheduler.interval(0), config.idle_interval);
+    EXPECT_FALSE(scheduler.due(0, now + config.idle_interval - 1s));
+    EXPECT_TRUE(scheduler.due(0, now + config.idle_interval));
+
+    // A busy GPU without processes of its own is not idle
+    DeviceScheduler busy(1, config);
+    for (int i = 0; i < 2 * config.idle_samples; i++) {
+        now += config.interval;
+        busy.observe(0, now, {}, 40);
+    }
+    EXPECT_EQ(busy.interval(0), config.interval);
+}
+
+TEST_F(DeviceSchedulerTest, SnapsBackOnABurst)
+{
+    for (int i = 0; i < config.idle_samples; i++) {
+        sample({}, 0);
+    }
+    ASSERT_EQ(scheduler.interval(0), config.idle_interval);
+
+    // A new process is sampled at the burst cadence right away
+    sample({ 100 }, 80);
+    EXPECT_EQ(scheduler.interval(0), config.burst_interval);
+    EXPECT_TRUE(scheduler.due(0, now + config.burst_interval));
+
+    // Steady load returns to the normal cadence after burst_samples
+    for (int i = 0; i < config.burst_samples - 1; i++) {
+        sample({ 100 }, 80);
+        EXPECT_EQ(scheduler.interval(0), config.burst_interval);
+    }
+    sample({ 100 }, 80);
+    EXPECT_EQ(scheduler.interval(0), config.interval);
+
+    // A utilization swing past the threshold counts as a burst too
+    sample({ 100 }, 80 - config.burst_threshold);
+    EXPECT_EQ(scheduler.interval(0), config.burst_interval);
+}
+
+TEST_F(DeviceSchedulerTest, StaysWithinTheConfiguredIntervals)
+{
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<unsigned int> utilization(0, 100);
+    for (int i = 0; i < 2000; i++) {
+        Clock::time_point previous = now;
+        // Runs of idle, steady and noisy samples
+        switch (i / 20 % 3) {
+        case 0:
+            sample({}, 0);
+            break;
+        case 1:
+            sample({ 100 }, 50);
+            break;
+        default:
+            sample({ 100, static_cast<unsigned int>(101 + i % 2) }, utilization(rng));
+        }
+
+        EXPECT_GE(scheduler.interval(0), config.burst_interval);
+        EXPECT_LE(scheduler.interval(0), config.idle_interval);
+        EXPECT_LE(now - previous, config.idle_interval);
+        EXPECT_FALSE(scheduler.due(0, now + scheduler.interval(0) - 1s));
+        EXPECT_TRUE(scheduler.due(0, now + scheduler.interval(0)));
+    }
+    EXPECT_EQ(scheduler.tick(), config.burst_interval);
+}
+
+TEST_F(DeviceSchedulerTest, ChangesGenerationOnlyWithThePublishedState)
+{
+    sample({ 100 }, 50);
+    for (int i = 0; i < config.burst_samples; i++) {
+        sample({ 100 }, 50);
+    }
+    uint64_t generation = scheduler.generation();
+    sample({ 100 }, 50);
+    EXPECT_EQ(scheduler.generation(), generation);
+    sample({ 100 }, 51);
+    EXPECT_NE(scheduler.generation(), generation);
+}
+
+// Five simulated minutes of the main loop, ticking every second, on a node
+// where half of the GPUs run nothing
+size_t nvml_calls(const DeviceScheduler::Config& config)
+{
+    FakeNode node(4);
+    node.add_pod("ns1/a", 0, 1ull << 30, 50);
+    node.add_pod("ns1/b", 1, 2ull << 30, 50);
+    node.harness.scheduler = DeviceScheduler(4, config);
+    node.backend.calls = 0;
+
+    Clock::time_point start = Clock::now();
+    for (auto elapsed = 0s; elapsed < 300s; elapsed += 1s) {
+        if (node.harness.scheduler.any_due(start + elapsed)) {
+            node.harness.run_scheduled_cycle(start + elapsed);
+        }
+    }
+    return node.backend.calls;
+}
+
+TEST(AdaptiveSamplingTest, MakesFewerNvmlCallsThanAFixedInterval)
+{
+    spdlog::set_level(spdlog::level::off);
+    DeviceScheduler::Config adaptive;
+    DeviceScheduler::Config fixed;
+    fixed.idle_interval = fixed.interval;
+    fixed.burst_interval = fixed.interval;
+
+    size_t adaptive_calls = nvml_calls(adaptive);
+    size_t fixed_calls = nvml_calls(fixed);
+    RecordProperty("adaptive_nvml_calls", std::to_string(adaptive_calls));
+    RecordProperty("fixed_nvml_calls", std::to_string(fixed_calls));
+
+    // The idle GPUs drop from every 5 to every 30 seconds, the busy ones stay at 5
+    EXPECT_LT(adaptive_calls, fixed_calls * 3 / 4);
+}
+
+// The main loop republishes the API snapshot only when a generation moved
+TEST(AdaptiveSamplingTest, KeepsTheSnapshotGenerationWhileNothingChanged)
+{
+    spdlog::set_level(spdlog::level::off);
+    FakeNode node(2);
+    node.add_pod("ns1/a", 0, 1ull << 30, 50);
+    node.add_pod("ns1/b", 1, 2ull << 30, 50);
+    node.harness.run_cycle();
+    uint64_t generation = snapshot_generation;
+
+    node.harness.run_cycle();
+    EXPECT_EQ(snapshot_generation, generation);
+
+    node.set_usage("ns1/b", 3ull << 30, 50);
+    node.harness.run_cycle();
+    EXPECT_NE(snapshot_generation, generation);
+    EXPECT_EQ(node.harness.sample("ns1/b", 0)->mem_used, 3072u);
+
+    generation = snapshot_generation;
+    node.stop_pod("ns1/a");
+    evict_pod("ns1/a", node.harness.gpu_data, node.harness.slot_expiry, node.harness.sm_util, node.harness.mem_used, node.harness.total_mem);
+    node.harness.run_cycle();
+    EXPECT_NE(snapshot_generation, generation);
+    ASSERT_EQ(latest_snapshot.size(), 1u);
+    EXPECT_EQ(latest_snapshot[0].pod, "ns1/b");
+}
+
+} // namespace
@@ -0,0 +1,136 @@
+// Cardinality budget of expose_gpu_data: which series keep their labels, the
+// "_other" sum of the folded ones and the vgpu_monitor_folded_series gauge.
+#include "vgpu_monitor.cpp"
+
+#include "fake_backends.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+class SeriesBudgetTest : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        spdlog::set_level(spdlog::level::off);
+        folded_series_gauge = &prometheus::BuildGauge().Name("vgpu_monitor_folded_series").Help("").Register(*node.harness.registry).Add({});
+        series_budget = 2;
+
+        // One series per pod, pod-<n> uses n GiB
+        for (int i = 1; i <= 4; i++) {
+            node.add_pod(make_pod_key("ns1", "pod-" + std::to_string(i)), i % 2, static_cast<unsigned long long>(i) << 30, 10 * i);
+        }
+    }
+
+    // Gauge values of the family by pod label
+    std::map<std::string, double> values(const std::string& family)
+    {
+        std::map<std::string, double> result;
+        for (const auto& metric_family : node.harness.registry->Collect()) {
+            if (metric_family.name != family) {
+                continue;
+            }
+            for (const auto& metric : metric_family.metric) {
+                for (const auto& label : metric.label) {
+                    if (label.name == "pod") {
+                        result[label.value] = metric.gauge.value;
+                    }
+                }
+            }
+        }
+        return result;
+    }
+
+    std::map<std::string, std::string> other_labels()
+    {
+        std::map<std::string, std::string> result;
+        for (const auto& metric_family : node.harness.registry->Collect()) {
+            for (const auto& metric : metric_family.metric) {
+                std::map<std::string, std::string> labels;
+                for (const auto& label : metric.label) {
+                    labels[label.name] = label.value;
+                }
+                if (metric_family.name == "pod_gpu_memory_used" && labels["pod"] == "_other") {
+                    result = labels;
+                }
+            }
+        }
+        return result;
+    }
+
+    FakeNode node { 2 };
+};
+
+TEST_F(SeriesBudgetTest, KeepsTheLabelsOfTheLargestSeries)
+{
+    node.harness.run_cycle();
+    auto memory = values("pod_gpu_memory_used");
+    EXPECT_EQ(memory.count("pod-1"), 0u);
+    EXPECT_EQ(memory.count("pod-2"), 0u);
+    EXPECT_EQ(memory.at("pod-3"), 3072);
+    EXPECT_EQ(memory.at("pod-4"), 4096);
+    EXPECT_EQ(values("pod_gpu_sm_util").count("pod-1"), 0u);
+    EXPECT_EQ(values("pod_total_gpu_memory").count("pod-2"), 0u);
+}
+
+TEST_F(SeriesBudgetTest, SumsTheFoldedSeriesIntoOther)
+{
+    node.harness.run_cycle();
+    const PodGpuSample* first = node.harness.sample(make_pod_key("ns1", "pod-1"), 0);
+    const PodGpuSample* second = node.harness.sample(make_pod_key("ns1", "pod-2"), 0);
+    ASSERT_NE(first, nullptr);
+    ASSERT_NE(second, nullptr);
+
+    EXPECT_EQ(values("pod_gpu_memory_used").at("_other"), 1024 + 2048);
+    EXPECT_EQ(values("pod_gpu_sm_util").at("_other"), first->sm_util + second->sm_util);
+    EXPECT_EQ(values("pod_total_gpu_memory").at("_other"), first->total_mem + second->total_mem);
+
+    auto labels = other_labels();
+    EXPECT_EQ(labels["namespace"], "");
+    EXPECT_EQ(labels["container"], "");
+    EXPECT_EQ(labels["gpu_id"], "");
+
+    // The snapshot for the API and the push keeps every series
+    EXPECT_EQ(latest_snapshot.size(), 4u);
+}
+
+TEST_F(SeriesBudgetTest, CountsTheFoldedSeries)
+{
+    node.harness.run_cycle();
+    EXPECT_EQ(folded_series_gauge->Value(), 2);
+
+    node.add_pod(make_pod_key("ns2", "pod-5"), 0, 5ull << 30);
+    node.harness.run_cycle();
+    EXPECT_EQ(folded_series_gauge->Value(), 3);
+
+    series_budget = 5;
+    node.harness.run_cycle();
+    EXPECT_EQ(folded_series_gauge->Value(), 0);
+    EXPECT_EQ(values("pod_gpu_memory_used").count("_other"), 0u);
+}
+
+TEST_F(SeriesBudgetTest, RebuildsTheLabelsOfAPodBackUnderTheBudget)
+{
+    node.harness.run_cycle();
+    ASSERT_EQ(values("pod_gpu_memory_used").count("pod-1"), 0u);
+
+    // pod-1 grows past pod-3, which is folded in its place
+    node.set_usage(make_pod_key("ns1", "pod-1"), 8ull << 30, 10);
+    node.harness.run_cycle();
+    auto memory = values("pod_gpu_memory_used");
+    EXPECT_EQ(memory.at("pod-1"), 8192);
+    EXPECT_EQ(memory.at("pod-4"), 4096);
+    EXPECT_EQ(memory.count("pod-3"), 0u);
+    EXPECT_EQ(memory.at("_other"), 2048 + 3072);
+
+    // Under the budget nothing is folded and every pod has its labels
+    series_budget = 4;
+    node.harness.run_cycle();
+    memory = values("pod_gpu_memory_used");
+    EXPECT_EQ(memory.size(), 4u);
+    EXPECT_EQ(memory.at("pod-2"), 2048);
+    EXPECT_EQ(memory.at("pod-3"), 3072);
+    EXPECT_EQ(folded_series_gauge->Value(), 0);
+}
+
+} // namespace
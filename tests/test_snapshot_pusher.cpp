@@ -0,0 +1,205 @@
+// SnapshotPusher against a fake collector: delta frames rebuild the snapshot,
+// and queue overflow, 409 and failed POSTs never lose or corrupt a frame.
+#include "vgpu_monitor.cpp"
+
+#include "fake_backends.h"
+#include "fake_collector.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+FakeCollector::Series series_of(const std::vector<PodGpuSample>& snapshot)
+{
+    FakeCollector::Series series;
+    for (const auto& sample : snapshot) {
+        series[sample.pod][sample.gpu_id] = { sample.sm_util, sample.mem_used, sample.total_mem };
+    }
+    return series;
+}
+
+class SnapshotPusherTest : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        spdlog::set_level(spdlog::level::off);
+    }
+
+    void TearDown() override
+    {
+        EXPECT_TRUE(collector.errors().empty()) << collector.errors().front();
+    }
+
+    // A pusher that encodes a frame on every add_snapshot call
+    std::unique_ptr<SnapshotPusher> make_pusher(size_t max_queued = 64)
+    {
+        return std::make_unique<SnapshotPusher>(collector.url(), "node-1", 0s, max_queued);
+    }
+
+    // Flush and serve I/O until done() or the timeout
+    template <typename Predicate>
+    bool drive(SnapshotPusher& pusher, Predicate done, std::chrono::milliseconds timeout = 5s)
+    {
+        auto deadline = Clock::now() + timeout;
+        while (!done()) {
+            if (Clock::now() >= deadline) {
+                return false;
+            }
+            pusher.flush(http_client);
+            http_client.run_until(Clock::now() + 5ms);
+        }
+        return true;
+    }
+
+    bool deliver(SnapshotPusher& pusher, size_t frames)
+    {
+        return drive(pusher, [&] { return collector.frames().size() >= frames && http_client.idle(); });
+    }
+
+    FakeCollector collector;
+    AsyncHttpClient http_client;
+    std::vector<PodGpuSample> snapshot = {
+        { "ns1/a", 0, 10, 100, 8192 },
+        { "ns1/a", 1, 20, 200, 8192 },
+        { "ns1/b", 0, 30, 300, 8192 },
+        { "ns2/a", 1, 40, 400, 8192 },
+    };
+};
+
+TEST_F(SnapshotPusherTest, RebuildsTheSnapshotFromDeltas)
+{
+    auto pusher = make_pusher();
+    pusher->add_snapshot(snapshot);
+    ASSERT_TRUE(deliver(*pusher, 1));
+    auto frames = collector.frames();
+    EXPECT_TRUE(frames[0].full);
+    EXPECT_EQ(frames[0].node, "node-1");
+    EXPECT_EQ(frames[0].definitions, 4u);
+    EXPECT_EQ(frames[0].updates, 4u);
+    EXPECT_EQ(collector.state(), series_of(snapshot));
+
+    // One value changes, one series leaves, one arrives
+    snapshot[0].sm_util = 11;
+    snapshot.erase(snapshot.begin() + 2);
+    snapshot.push_back({ "ns2/b", 0, 50, 500, 8192 });
+    pusher->add_snapshot(snapshot);
+    ASSERT_TRUE(deliver(*pusher, 2));
+    frames = collector.frames();
+    EXPECT_FALSE(frames[1].full);
+    EXPECT_EQ(frames[1].sequence, frames[0].sequence + 1);
+    EXPECT_EQ(frames[1].definitions, 1u);
+    EXPECT_EQ(frames[1].updates, 2u);
+    EXPECT_EQ(frames[1].removals, 1u);
+    EXPECT_EQ(collector.state(), series_of(snapshot));
+
+    // Nothing changed, nothing is sent
+    pusher->add_snapshot(snapshot);
+    drive(*pusher, [] { return false; }, 200ms);
+    EXPECT_EQ(collector.requests(), 2);
+}
+
+TEST_F(SnapshotPusherTest, OverflowLeavesTheInFlightFrameIntact)
+{
+    collector.set_latency(300ms);
+    auto pusher = make_pusher(2);
+    pusher->add_snapshot(snapshot);
+    pusher->flush(http_client);
+    ASSERT_FALSE(http_client.idle());
+
+    // Two frames fill the queue behind the one being sent, the third overflows
+    // it before curl wrote the body of the first
+    for (unsigned int i = 1; i <= 3; i++) {
+        snapshot[0].sm_util = i;
+        pusher->add_snapshot(snapshot);
+    }
+    EXPECT_EQ(pusher->dropped(), 3u);
+    http_client.run_until(Clock::now() + 50ms);
+    ASSERT_FALSE(http_client.idle());
+
+    // The frame after the overflow is a full snapshot
+    snapshot[1].mem_used = 4096;
+    pusher->add_snapshot(snapshot);
+    ASSERT_TRUE(deliver(*pusher, 2));
+    auto frames = collector.frames();
+    ASSERT_EQ(frames.size(), 2u);
+    EXPECT_TRUE(frames[0].full);
+    EXPECT_EQ(frames[0].definitions, 4u);
+    EXPECT_TRUE(frames[1].full);
+    EXPECT_EQ(collector.state(), series_of(snapshot));
+    EXPECT_EQ(collector.requests(), 2);
+}
+
+TEST_F(SnapshotPusherTest, ConflictResendsAFullSnapshot)
+{
+    auto pusher = make_pusher();
+    pusher->add_snapshot(snapshot);
+    ASSERT_TRUE(deliver(*pusher, 1));
+
+    // The collector restarts; a delta in flight gets 409 and the delta queued behind it is useless
+    collector.forget();
+    collector.set_latency(100ms);
+    snapshot[0].sm_util = 1;
+    pusher->add_snapshot(snapshot);
+    pusher->flush(http_client);
+    snapshot[0].sm_util = 2;
+    pusher->add_snapshot(snapshot);
+    ASSERT_TRUE(drive(*pusher, [&] { return collector.requests() == 2 && http_client.idle(); }));
+    EXPECT_EQ(collector.frames().size(), 1u);
+
+    collector.set_latency(0ms);
+    snapshot[0].sm_util = 3;
+    pusher->add_snapshot(snapshot);
+    ASSERT_TRUE(deliver(*pusher, 2));
+    auto frames = collector.frames();
+    EXPECT_TRUE(frames[1].full);
+    EXPECT_EQ(frames[1].definitions, 4u);
+    EXPECT_EQ(collector.state(), series_of(snapshot));
+    EXPECT_EQ(collector.requests(), 3);
+}
+
+TEST_F(SnapshotPusherTest, RetriesAFailedFrameAfterBackoff)
+{
+    auto pusher = make_pusher();
+    pusher->add_snapshot(snapshot);
+    ASSERT_TRUE(deliver(*pusher, 1));
+
+    collector.fail_next(503);
+    snapshot[0].sm_util = 1;
+    pusher->add_snapshot(snapshot);
+    auto failed_at = Clock::now();
+    ASSERT_TRUE(drive(*pusher, [&] { return collector.requests() == 2 && http_client.idle(); }));
+
+    // Queued behind the failed frame, which is sent again first
+    snapshot[1].sm_util = 2;
+    pusher->add_snapshot(snapshot);
+    ASSERT_TRUE(deliver(*pusher, 3));
+    auto retried_at = Clock::now();
+    EXPECT_GE(retried_at - failed_at, 250ms);
+
+    auto frames = collector.frames();
+    EXPECT_EQ(frames[1].sequence, frames[0].sequence + 1);
+    EXPECT_EQ(frames[1].updates, 1u);
+    EXPECT_EQ(frames[2].sequence, frames[1].sequence + 1);
+    EXPECT_EQ(collector.state(), series_of(snapshot));
+    EXPECT_EQ(collector.requests(), 4);
+    EXPECT_EQ(pusher->dropped(), 0u);
+}
+
+TEST_F(SnapshotPusherTest, SurvivesAnUnreachableCollector)
+{
+    // Nothing listens on the port of a collector that is gone
+    auto pusher = std::make_unique<SnapshotPusher>("http://127.0.0.1:1/push", "node-1", 0s, 2);
+    for (unsigned int i = 0; i < 5; i++) {
+        snapshot[0].sm_util = i;
+        pusher->add_snapshot(snapshot);
+        pusher->flush(http_client);
+        http_client.run_until(Clock::now() + 20ms);
+    }
+    EXPECT_GT(pusher->dropped(), 0u);
+    EXPECT_EQ(collector.requests(), 0);
+}
+
+} // namespace
@@ -7,6 +7,8 @@
 #include <chrono>
 #include <fstream>
 #include <map>
+#include <unordered_map>
+#include <string_view>
 #include <regex>
 #include <prometheus/exposer.h>
 #include <prometheus/registry.h>
@@ -15,6 +17,28 @@
 #include <cstdio>
 #include <cstring>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <atomic>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <zlib.h>
+#include <cstdint>
+#include <cerrno>
+#include <functional>
+#include <deque>
+#include <list>
+#include <array>
+#include <random>
+#include <future>
+#include <memory_resource>
+#include <optional>
+#include <limits>
 #include <curl/curl.h>
 
 #include "spdlog/spdlog.h"
@@ -26,17 +50,213 @@ using namespace simdjson;
 
 std::vector<std::string> gpu_ids;
 std::vector<std::string> gpu_uuids;
+// Every identifier NVIDIA_VISIBLE_DEVICES may use for a device (GPU UUID, MIG UUID,
+// device index, MIG "gpu:instance" index) mapped to the position in gpu_uuids
+std::vector<std::string> gpu_uuid_aliases;
+std::unordered_map<std::string_view, unsigned int> gpu_uuid_index;
+// Memory size of every MIG instance, by MIG UUID and "gpu:instance" index
+std::unordered_map<std::string, unsigned long long> mig_instance_memory;
+// Device index and MIG slot of every MIG instance, by MIG UUID and "gpu:instance" index
+std::unordered_map<std::string, std::pair<unsigned int, unsigned int>> mig_instance_ids;
 std::map<std::string, std::map<int, int>> gpu_usage;
 std::map<std::string, std::string> pod_id_to_docker_id;
 unsigned long long gpu_memory = 0;
 std::map<std::string, std::map<std::string, unsigned int>> gpu_index;
 std::map<std::string, std::string> pod_uid_to_id;
+// pod_uid_to_id inverted, so evicting a pod finds its UIDs without a scan
+std::map<std::string, std::set<std::string>> pod_id_to_uids;
+// Memory capacity of pod GPU slots backed by MIG instances, keyed like gpu_data
+std::map<std::string, std::map<unsigned int, unsigned long long>> pod_gpu_capacity;
+// Slot of each MIG instance a pod holds, by device index and MIG slot. Each
+// instance is a slot of its own with its own size and processes.
+std::map<std::string, std::map<std::pair<unsigned int, unsigned int>, unsigned int>> pod_mig_slots;
+// MIG instances in the NVIDIA_VISIBLE_DEVICES of a container, by docker_id
+std::map<std::string, std::vector<std::string>> docker_mig_devices;
 int GPUAllocation = 0;
+// GPU container of each pod in gpu_data, from the apiserver or the kubelet
+std::map<std::string, std::string> pod_containers;
+// Value of the node label on every series
+std::string node_name;
+// Most pod/GPU series to expose before folding the rest, 0 for no limit (VGPU_MONITOR_MAX_SERIES)
+size_t series_budget = 0;
+// Reports how many series the budget folded, registered only when a budget is set
+prometheus::Gauge* folded_series_gauge = nullptr;
+// GPU usage counts per pod from the kubelet PodResources API, preferred over docker inspect
+std::map<std::string, std::map<int, int>> kubelet_gpu_usage;
+// Pods the kubelet assigned each device to, by the device ID without the "::<replica>" suffix
+std::map<std::string, std::set<std::string>, std::less<>> kubelet_device_pods;
+
+// Bumped whenever pod_uid_to_id, pod_id_to_docker_id, gpu_usage or gpu_index
+// change, save_caches only writes the cache file when it moved
+uint64_t cache_generation = 0;
+
+void caches_changed()
+{
+    cache_generation++;
+}
+
+// Cache the pod a UID belongs to unless it is known already, returns the cached entry
+std::map<std::string, std::string>::iterator cache_pod_uid(const std::string& pod_uid, const std::string& pod_id)
+{
+    auto inserted = pod_uid_to_id.emplace(pod_uid, pod_id);
+    if (inserted.second) {
+        pod_id_to_uids[pod_id].insert(pod_uid);
+        caches_changed();
+    }
+    return inserted.first;
+}
+
+void forget_pod_uid(const std::string& pod_uid)
+{
+    auto it = pod_uid_to_id.find(pod_uid);
+    if (it == pod_uid_to_id.end()) {
+        return;
+    }
+    auto uids = pod_id_to_uids.find(it->second);
+    if (uids != pod_id_to_uids.end()) {
+        uids->second.erase(pod_uid);
+        if (uids->second.empty()) {
+            pod_id_to_uids.erase(uids);
+        }
+    }
+    pod_uid_to_id.erase(it);
+    caches_changed();
+}
+
+// Pods are keyed by "<namespace>/<name>" in every map, pod names alone repeat
+// across namespaces. Keys from the docker container name (k8s_<container>_<pod>_<namespace>_...),
+// the apiserver and the kubelet all use this form.
+std::string make_pod_key(std::string_view namespace_, std::string_view name)
+{
+    std::string key;
+    key.reserve(namespace_.size() + 1 + name.size());
+    key.append(namespace_).append(1, '/').append(name);
+    return key;
+}
+
+std::string_view pod_key_namespace(std::string_view key)
+{
+    size_t slash = key.find('/');
+    return slash == std::string_view::npos ? std::string_view() : key.substr(0, slash);
+}
+
+std::string_view pod_key_name(std::string_view key)
+{
+    size_t slash = key.find('/');
+    return slash == std::string_view::npos ? key : key.substr(slash + 1);
+}
+
+// One exported pod/GPU series, as last published by expose_gpu_data
+struct PodGpuSample {
+    std::string pod; // "<namespace>/<name>"
+    unsigned int gpu_id;
+    unsigned int sm_util;
+    unsigned long long mem_used; // MB
+    unsigned long long total_mem; // MB
+};
+std::vector<PodGpuSample> latest_snapshot;
+// Bumped by expose_gpu_data whenever latest_snapshot changes
+uint64_t snapshot_generation = 0;
+
+// Keys in the order they were last touched. All keys share one timeout, so that
+// is also the order of their deadlines: touching moves a key to the back and
+// expiring pops from the front, which costs O(expired) instead of a scan over
+// every key each cycle.
+template <typename Key>
+class DeadlineQueue {
+public:
+    explicit DeadlineQueue(std::time_t timeout)
+        : timeout(timeout)
+    {
+    }
+
+    void set_timeout(std::time_t new_timeout)
+    {
+        timeout = new_timeout;
+    }
+
+    void touch(const Key& key, std::time_t now)
+    {
+        // A clock stepped back must not break the order, treat it as standing still
+        if (!order.empty()) {
+            now = std::max(now, order.back().last_seen);
+        }
+        auto it = keys.find(key);
+        if (it == keys.end()) {
+            order.push_back({ key, now });
+            keys.emplace(key, std::prev(order.end()));
+            return;
+        }
+        it->second->last_seen = now;
+        order.splice(order.end(), order, it->second);
+    }
+
+    bool contains(const Key& key) const
+    {
+        return keys.find(key) != keys.end();
+    }
+
+    void erase(const Key& key)
+    {
+        auto it = keys.find(key);
+        if (it != keys.end()) {
+            order.erase(it->second);
+            keys.erase(it);
+        }
+    }
+
+    size_t size() const
+    {
+        return keys.size();
+    }
+
+    // Call on_expired for every key not touched within timeout, and forget it
+    template <typename Fn>
+    void expire(std::time_t now, Fn&& on_expired)
+    {
+        while (!order.empty() && order.front().last_seen + timeout < now) {
+            Key key = std::move(order.front().key);
+            keys.erase(key);
+            order.pop_front();
+            on_expired(key);
+        }
+    }
+
+private:
+    struct Entry {
+        Key key;
+        std::time_t last_seen;
+    };
+
+    std::time_t timeout;
+    std::list<Entry> order;
+    std::map<Key, typename std::list<Entry>::iterator> keys;
+};
+
+// Pods listed by the apiserver/kubelet or sampled recently, evicted after VGPU_MONITOR_TOMBSTONE_SECONDS
+DeadlineQueue<std::string> pod_tombstones(300);
+// Gauges of one exposed pod/GPU series, added to the families once when it appears
+struct GpuSeries {
+    prometheus::Gauge* sm_util;
+    prometheus::Gauge* mem_used;
+    prometheus::Gauge* total_mem;
+};
+
+// Label set of a pod, built once per pod lifetime and rebuilt only when its
+// container gets resolved after the series were first exposed
+struct PodSeries {
+    std::string container;
+    prometheus::Labels labels;
+    std::map<unsigned int, GpuSeries> gpus;
+};
+std::map<std::string, PodSeries> pod_series;
+// Sum of the series folded by the cardinality budget, exposed as pod "_other"
+std::optional<GpuSeries> folded_series;
 
 // Function to initialize the logger
 void init_logger()
 {
-    auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_st>();
+    auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
     auto logger = std::make_shared<spdlog::logger>("multi_sink", spdlog::sinks_init_list{ console_sink });
     logger->set_level(spdlog::level::debug);
     // [%Y-%m-%d %H:%M:%S.%e] Time
@@ -46,16 +266,97 @@ void init_logger()
     spdlog::set_default_logger(logger);
 }
 
+// The NVML calls the monitor makes. main() installs NvmlBackend; tests install a
+// fake that models GPU and MIG topologies without a driver.
+class GpuBackend {
+public:
+    virtual ~GpuBackend() = default;
+    virtual nvmlReturn_t init() = 0;
+    virtual nvmlReturn_t shutdown() = 0;
+    virtual const char* error_string(nvmlReturn_t result) = 0;
+    virtual nvmlReturn_t device_count(unsigned int* count) = 0;
+    virtual nvmlReturn_t device_handle(unsigned int index, nvmlDevice_t* device) = 0;
+    virtual nvmlReturn_t device_uuid(nvmlDevice_t device, char* uuid, unsigned int length) = 0;
+    virtual nvmlReturn_t memory_info(nvmlDevice_t device, nvmlMemory_t* memory) = 0;
+    virtual nvmlReturn_t mig_mode(nvmlDevice_t device, unsigned int* current_mode, unsigned int* pending_mode) = 0;
+    virtual nvmlReturn_t max_mig_device_count(nvmlDevice_t device, unsigned int* count) = 0;
+    virtual nvmlReturn_t mig_device_handle(nvmlDevice_t device, unsigned int index, nvmlDevice_t* mig_device) = 0;
+    virtual nvmlReturn_t compute_running_processes(nvmlDevice_t device, unsigned int* count, nvmlProcessInfo_t* infos) = 0;
+    virtual nvmlReturn_t process_utilization(nvmlDevice_t device, nvmlProcessUtilizationSample_t* samples, unsigned int* count, unsigned long long last_seen) = 0;
+    virtual nvmlReturn_t utilization_rates(nvmlDevice_t device, nvmlUtilization_t* utilization) = 0;
+};
+
+GpuBackend* gpu_backend = nullptr;
+// Host procfs as mounted into the monitor container
+std::string proc_root = "/workspace/proc";
+
+// MIG slot and handle of each configured instance of a GPU
+using MigDevices = std::pmr::vector<std::pair<unsigned int, nvmlDevice_t>>;
+
+// Collect the configured MIG instances of a device, returns false when MIG is disabled
+bool get_mig_devices(nvmlDevice_t device, MigDevices& mig_devices)
+{
+    unsigned int current_mode = 0;
+    unsigned int pending_mode = 0;
+    if (gpu_backend->mig_mode(device, &current_mode, &pending_mode) != NVML_SUCCESS || current_mode != NVML_DEVICE_MIG_ENABLE) {
+        return false;
+    }
+
+    unsigned int max_mig_count = 0;
+    if (gpu_backend->max_mig_device_count(device, &max_mig_count) != NVML_SUCCESS) {
+        return false;
+    }
+
+    for (unsigned int j = 0; j < max_mig_count; j++) {
+        nvmlDevice_t mig_device;
+        // Slots without a configured instance return NVML_ERROR_NOT_FOUND
+        if (gpu_backend->mig_device_handle(device, j, &mig_device) != NVML_SUCCESS) {
+            continue;
+        }
+        mig_devices.emplace_back(j, mig_device);
+    }
+    return true;
+}
+
+void get_mig_uuids(nvmlDevice_t device, unsigned int device_index, unsigned int gpu_pos,
+    std::vector<std::pair<std::string, unsigned int>>& aliases)
+{
+    MigDevices mig_devices;
+    if (!get_mig_devices(device, mig_devices)) {
+        return;
+    }
+
+    for (const auto& mig_device : mig_devices) {
+        char uuid[NVML_DEVICE_UUID_BUFFER_SIZE];
+        if (gpu_backend->device_uuid(mig_device.second, uuid, NVML_DEVICE_UUID_BUFFER_SIZE) != NVML_SUCCESS) {
+            continue;
+        }
+        std::string index = std::to_string(device_index) + ":" + std::to_string(mig_device.first);
+        aliases.emplace_back(std::string(uuid), gpu_pos);
+        aliases.emplace_back(index, gpu_pos);
+
+        mig_instance_ids[uuid] = { device_index, mig_device.first };
+        mig_instance_ids[index] = { device_index, mig_device.first };
+
+        nvmlMemory_t memory;
+        if (gpu_backend->memory_info(mig_device.second, &memory) == NVML_SUCCESS) {
+            mig_instance_memory[uuid] = memory.total;
+            mig_instance_memory[index] = memory.total;
+        }
+    }
+}
+
 void get_gpu_uuids()
 {
     unsigned int deviceCount;
     nvmlReturn_t result;
+    std::vector<std::pair<std::string, unsigned int>> aliases;
 
     // Get the number of devices
-    result = nvmlDeviceGetCount(&deviceCount);
+    result = gpu_backend->device_count(&deviceCount);
     if (NVML_SUCCESS != result) {
         throw std::runtime_error("Failed to get device count: " +
-            std::string(nvmlErrorString(result)));
+            std::string(gpu_backend->error_string(result)));
     }
 
     // Iterate through all devices
@@ -64,58 +365,140 @@ void get_gpu_uuids()
         char uuid[NVML_DEVICE_UUID_BUFFER_SIZE];
 
         // Get the device handle
-        result = nvmlDeviceGetHandleByIndex(i, &device);
+        result = gpu_backend->device_handle(i, &device);
         if (NVML_SUCCESS != result) {
-                spdlog::error("Failed to get device handle for device {}: {}", i, nvmlErrorString(result));
+                spdlog::error("Failed to get device handle for device {}: {}", i, gpu_backend->error_string(result));
             continue;
         }
 
         // Get the device UUID
-        result = nvmlDeviceGetUUID(device, uuid, NVML_DEVICE_UUID_BUFFER_SIZE);
+        result = gpu_backend->device_uuid(device, uuid, NVML_DEVICE_UUID_BUFFER_SIZE);
         if (NVML_SUCCESS != result) {
-            spdlog::error("Failed to get UUID for device {}: {}", i, nvmlErrorString(result));
+            spdlog::error("Failed to get UUID for device {}: {}", i, gpu_backend->error_string(result));
             continue;
         }
 
+        unsigned int gpu_pos = gpu_uuids.size();
         gpu_uuids.push_back(std::string(uuid));
+        aliases.emplace_back(std::string(uuid), gpu_pos);
+        aliases.emplace_back(std::to_string(i), gpu_pos);
+        get_mig_uuids(device, i, gpu_pos, aliases);
+    }
+
+    // Build the index only once the alias strings are in their final place,
+    // the string_view keys point into gpu_uuid_aliases
+    gpu_uuid_aliases.clear();
+    gpu_uuid_aliases.reserve(aliases.size());
+    for (const auto& alias : aliases) {
+        gpu_uuid_aliases.push_back(alias.first);
+    }
+    gpu_uuid_index.clear();
+    gpu_uuid_index.reserve(aliases.size());
+    for (size_t i = 0; i < aliases.size(); i++) {
+        gpu_uuid_index.emplace(gpu_uuid_aliases[i], aliases[i].second);
+    }
+}
+
+// nvidia.com/gpu, or nvidia.com/mig-<profile> with the device plugin's MIG "mixed" strategy
+bool is_gpu_resource(std::string_view resource_name)
+{
+    return resource_name == "nvidia.com/gpu" || resource_name.substr(0, 15) == "nvidia.com/mig-";
+}
+
+// Memory of a MIG profile resource such as nvidia.com/mig-1g.5gb, in bytes, 0 if not a MIG profile
+unsigned long long mig_profile_memory(std::string_view resource_name)
+{
+    if (resource_name.substr(0, 15) != "nvidia.com/mig-") {
+        return 0;
+    }
+    size_t dot = resource_name.find('.', 15);
+    if (dot == std::string_view::npos) {
+        return 0;
     }
+    unsigned long long gb = 0;
+    size_t pos = dot + 1;
+    for (; pos < resource_name.size() && resource_name[pos] >= '0' && resource_name[pos] <= '9'; pos++) {
+        gb = gb * 10 + (resource_name[pos] - '0');
+    }
+    if (resource_name.substr(pos, 2) != "gb") {
+        return 0;
+    }
+    return gb * 1024 * 1024 * 1024;
 }
 
-// Parse GPU UUIDs from Docker environment variables
-std::vector<std::string> parse_docker_gpu_uuids(const std::string& envValue)
+// Split the NVIDIA_VISIBLE_DEVICES value without copying, calling fn for each trimmed entry
+template <typename Fn>
+void for_each_docker_gpu_uuid(std::string_view envValue, Fn&& fn)
 {
-    std::vector<std::string> dockerUUIDs;
-    std::stringstream ss(envValue);
-    std::string uuid;
+    while (!envValue.empty()) {
+        size_t comma = envValue.find(',');
+        std::string_view uuid = envValue.substr(0, comma);
+        envValue = comma == std::string_view::npos ? std::string_view() : envValue.substr(comma + 1);
 
-    while (std::getline(ss, uuid, ',')) {
-        // std::cout << "Found GPU UUID: " << uuid << std::endl;
         // Remove possible spaces
-        uuid.erase(0, uuid.find_first_not_of(" "));
-        uuid.erase(uuid.find_last_not_of(" ") + 1);
-        dockerUUIDs.push_back(uuid);
+        size_t first = uuid.find_first_not_of(' ');
+        if (first == std::string_view::npos) {
+            continue;
+        }
+        uuid = uuid.substr(first, uuid.find_last_not_of(' ') - first + 1);
+        fn(uuid);
     }
-    return dockerUUIDs;
 }
 
 // Count GPU usage
-std::map<int, int> count_gpu_usage(const std::string& dockerGPUs)
+std::map<int, int> count_gpu_usage(std::string_view dockerGPUs)
 {
     std::map<int, int> gpuUsageCount; // <GPU index, count>
 
-    // Parse GPU UUIDs from Docker environment variables
-    std::vector<std::string> dockerUUIDs = parse_docker_gpu_uuids(dockerGPUs);
+    // Count the occurrences of each GPU index, vGPU splitting repeats the same UUID
+    for_each_docker_gpu_uuid(dockerGPUs, [&](std::string_view dockerUUID) {
+        auto it = gpu_uuid_index.find(dockerUUID);
+        if (it == gpu_uuid_index.end()) {
+            spdlog::warn("Unknown GPU in NVIDIA_VISIBLE_DEVICES: {}", dockerUUID);
+            return;
+        }
+        gpuUsageCount[it->second]++;
+    });
 
-    // Count the occurrences of each GPU index
-    for (const auto& dockerUUID : dockerUUIDs) {
-        for (size_t i = 0; i < gpu_uuids.size(); i++) {
-            if (gpu_uuids[i].find(dockerUUID) != std::string::npos) {
-                gpuUsageCount[i]++;
-            }
+    return gpuUsageCount;
+}
+
+// Give every MIG instance among the devices of a pod a slot of its own, sized
+// like the instance. Slots follow count_gpu_usage, the GPUs in order and the
+// instances of a GPU by MIG slot. Devices may be "<id>::<replica>".
+void assign_mig_slots(const std::string& pod_id, const std::vector<std::string>& device_ids)
+{
+    std::map<unsigned int, unsigned int> usage; // Slots by GPU position
+    std::map<unsigned int, std::set<std::pair<unsigned int, unsigned int>>> instances;
+    for (const auto& device_id : device_ids) {
+        std::string id = device_id.substr(0, device_id.find("::"));
+        auto gpu = gpu_uuid_index.find(id);
+        if (gpu == gpu_uuid_index.end()) {
+            continue;
+        }
+        usage[gpu->second]++;
+        auto instance = mig_instance_ids.find(id);
+        if (instance != mig_instance_ids.end()) {
+            instances[gpu->second].insert(instance->second);
         }
     }
 
-    return gpuUsageCount;
+    pod_mig_slots.erase(pod_id);
+    unsigned int slot = 0;
+    for (const auto& gpu : usage) {
+        auto gpu_instances = instances.find(gpu.first);
+        if (gpu_instances != instances.end()) {
+            unsigned int instance_slot = slot;
+            for (const auto& instance : gpu_instances->second) {
+                auto memory = mig_instance_memory.find(std::to_string(instance.first) + ":" + std::to_string(instance.second));
+                if (memory != mig_instance_memory.end()) {
+                    pod_gpu_capacity[pod_id][instance_slot] = memory->second;
+                }
+                pod_mig_slots[pod_id][instance] = instance_slot++;
+            }
+        }
+        slot += gpu.second;
+    }
 }
 
 std::string execute_get_docker_gpus_command(const std::string& command)
@@ -134,14 +517,14 @@ std::string execute_get_docker_gpus_command(const std::string& command)
     return result;
 }
 
-void get_docker_gpus(const std::string& containerId)
+std::string docker_gpus_command(const std::string& containerId)
 {
-    if (gpu_usage.find(containerId) != gpu_usage.end()) {
-        return;
-    }
-    std::string command = "docker inspect " + containerId + " | grep NVIDIA_VISIBLE_DEVICES";
-    std::string output = execute_get_docker_gpus_command(command);
+    return "docker inspect " + containerId + " | grep NVIDIA_VISIBLE_DEVICES";
+}
 
+// Record the GPU usage of a container from its docker inspect output
+void parse_docker_gpus(const std::string& containerId, const std::string& output)
+{
     // Extract GPU UUID
     size_t start = output.find("=") + 1;
     size_t end = output.find("\",");
@@ -149,9 +532,21 @@ void get_docker_gpus(const std::string& containerId)
         throw std::runtime_error("Failed to parse docker inspect output");
     }
 
-    auto originalGPUUsage = count_gpu_usage(output.substr(start, end - start));
+    std::string_view visible_devices = std::string_view(output).substr(start, end - start);
+    auto originalGPUUsage = count_gpu_usage(visible_devices);
     std::map<int, int> adjustedGPUUsage;
 
+    // The MIG instances are given slots once the container's pod is known
+    std::vector<std::string> mig_devices;
+    for_each_docker_gpu_uuid(visible_devices, [&](std::string_view device) {
+        if (mig_instance_ids.find(std::string(device)) != mig_instance_ids.end()) {
+            mig_devices.emplace_back(device);
+        }
+    });
+    if (!mig_devices.empty()) {
+        docker_mig_devices[containerId] = mig_devices;
+    }
+
     // Extract original keys (already sorted automatically)
     std::vector<int> sortedKeys;
     for (const auto& pair : originalGPUUsage) {
@@ -165,11 +560,142 @@ void get_docker_gpus(const std::string& containerId)
     }
 
     gpu_usage[containerId] = adjustedGPUUsage;
+    caches_changed();
+}
+
+void get_docker_gpus(const std::string& containerId)
+{
+    if (gpu_usage.find(containerId) != gpu_usage.end()) {
+        return;
+    }
+    parse_docker_gpus(containerId, execute_get_docker_gpus_command(docker_gpus_command(containerId)));
 }
 
-std::vector<unsigned long long> split_data(unsigned long long memory, int num_vgpu)
+// Forwards to the heap and counts what reaches it, so the arena's misses show up in the logs
+class CountingResource : public std::pmr::memory_resource {
+public:
+    size_t allocations = 0;
+    size_t bytes = 0;
+
+private:
+    void* do_allocate(size_t size, size_t alignment) override
+    {
+        allocations++;
+        bytes += size;
+        return std::pmr::new_delete_resource()->allocate(size, alignment);
+    }
+
+    void do_deallocate(void* p, size_t size, size_t alignment) override
+    {
+        std::pmr::new_delete_resource()->deallocate(p, size, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+// Transient data of one sampling cycle is bump-allocated from this arena and
+// dropped at once by reset(). A cycle that overflows the buffer takes chunks from
+// the heap, and reset() then grows the buffer to that cycle's high-water mark.
+// With the buffers of CycleScratch kept from cycle to cycle, sampling a steady
+// set of pods and publishing the API snapshot make no heap allocation, with
+// logging off (test_cycle_arena) and at the shipped debug level over a long run
+// (bench_cycle_soak). New pods and processes still allocate in the caches and
+// lookups, and so does rewriting the cache file after such a change.
+class CycleArena : public std::pmr::memory_resource {
+public:
+    explicit CycleArena(size_t initial_size)
+        : buffer(initial_size)
+    {
+        arena.emplace(buffer.data(), buffer.size(), &upstream);
+    }
+
+    std::pmr::memory_resource* resource()
+    {
+        return this;
+    }
+
+    // Chunks taken from the heap since startup
+    size_t upstream_allocations() const
+    {
+        return total_allocations + upstream.allocations;
+    }
+
+    size_t capacity() const
+    {
+        return buffer.size();
+    }
+
+    // Every container allocated from resource() must be destroyed before this
+    void reset()
+    {
+        arena.reset();
+        if (upstream.allocations != 0) {
+            total_allocations += upstream.allocations;
+            spdlog::info("cycle arena overflowed with {} heap allocations ({} bytes, {} since startup), growing to {} bytes",
+                upstream.allocations, upstream.bytes, total_allocations, high_water);
+            buffer.resize(std::max(buffer.size(), high_water));
+            upstream.allocations = 0;
+            upstream.bytes = 0;
+        }
+        high_water = 0;
+        arena.emplace(buffer.data(), buffer.size(), &upstream);
+    }
+
+private:
+    // Bytes the cycle asked for plus the worst-case alignment padding, which
+    // bounds what the monotonic arena consumed from its buffer and chunks
+    void* do_allocate(size_t size, size_t alignment) override
+    {
+        high_water += size + alignment - 1;
+        return arena->allocate(size, alignment);
+    }
+
+    void do_deallocate(void* p, size_t size, size_t alignment) override
+    {
+        arena->deallocate(p, size, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    CountingResource upstream;
+    std::vector<std::byte> buffer;
+    std::optional<std::pmr::monotonic_buffer_resource> arena;
+    size_t high_water = 0;
+    size_t total_allocations = 0;
+};
+
+CycleArena cycle_arena(64 * 1024);
+
+struct ApiSnapshot;
+
+// Buffers the sampling loop keeps from one cycle to the next, so steady cycles
+// refill their capacity instead of allocating. main() owns one and passes it
+// to the cycle and to publish_api_snapshot, each CycleHarness owns its own.
+struct CycleScratch {
+    std::string pod_uid; // cgroup IDs of the process get_usuage attributes
+    std::string docker_id;
+    std::pair<std::string, unsigned int> slot; // slot_expiry key being refreshed
+    std::shared_ptr<ApiSnapshot> api_spare; // Snapshot replaced by the last publish_api_snapshot
+};
+
+// Per-cycle sample maps. Keys refer to the pod name strings held by
+// pod_uid_to_id, so building them copies no strings. Those strings must outlive
+// the maps: they are only erased by forget_pod_uid, clear_caches and evict_pod,
+// and update_and_clean_gpu_data destroys its maps before it evicts pods, while
+// the other callers run between cycles.
+using PodKey = std::reference_wrapper<const std::string>;
+using CyclePodData = std::pmr::map<PodKey, std::pmr::map<unsigned int, std::pair<unsigned int, unsigned long long>>, std::less<const std::string>>;
+using CyclePodCapacity = std::pmr::map<PodKey, std::pmr::map<unsigned int, unsigned long long>, std::less<const std::string>>;
+
+std::pmr::vector<unsigned long long> split_data(unsigned long long memory, int num_vgpu)
 {
-    std::vector<unsigned long long> split_values;
+    std::pmr::vector<unsigned long long> split_values(cycle_arena.resource());
     for (int i = 0; i < num_vgpu; i++) {
         split_values.push_back(memory / num_vgpu);
     }
@@ -211,6 +737,22 @@ int read_allocation()
     return 0; // Return zero to indicate success
 }
 
+// Read an integer option from the environment, falling back to default_value
+int get_env_int(const char* name, int default_value)
+{
+    const char* value = std::getenv(name);
+    if (!value || *value == '\0') {
+        return default_value;
+    }
+    try {
+        return std::stoi(value);
+    }
+    catch (const std::exception&) {
+        spdlog::error("Invalid value for {}: {}, using {}", name, value, default_value);
+        return default_value;
+    }
+}
+
 int get_gpus_in_host(const std::string& cmd, std::vector<std::string>& output)
 {
     std::array<char, 128> buffer;
@@ -242,7 +784,24 @@ int get_pod_id(const std::string& cmd, std::string& output)
     return 0;
 }
 
-int get_gpu_id_in_pod(const std::string& cmd, std::string pod_id, std::map<std::string, std::map<unsigned int, std::pair<unsigned int, unsigned long long>>>& gpu_data)
+std::string pod_id_command(const std::string& docker_id)
+{
+    // Container names are k8s_<container>_<pod>_<namespace>_<uid>_<attempt>
+    return "docker ps -a | grep " + docker_id + " | awk '{print $NF}' | awk -F '_' '{print $4 \"/\" $3}'";
+}
+
+std::string container_name_command(const std::string& docker_id)
+{
+    return "docker ps -a | grep " + docker_id + " | awk '{print $NF}' | awk -F '_' '{print $2}'";
+}
+
+std::string gpus_in_container_command(const std::string& docker_id)
+{
+    return "docker exec -i " + docker_id + " find /dev -name 'nvidia[0-9]*' | sort -V";
+}
+
+// Run cmd and collect the GPU device files it lists, such as /dev/nvidia0
+int list_gpus_in_container(const std::string& cmd, std::vector<std::string>& devices)
 {
     std::array<char, 128> buffer;
     std::unique_ptr<FILE, decltype(&pclose)> pipe(popen(cmd.c_str(), "r"), pclose);
@@ -259,346 +818,3059 @@ int get_gpu_id_in_pod(const std::string& cmd, std::string pod_id, std::map<std::
             continue;
         }
         spdlog::info("gpu_id: {}", gpu_id);
-        if (gpu_index[pod_id].find(gpu_id) == gpu_index[pod_id].end()) {
-            spdlog::info("gpu_index[pod_id].size(): {}", gpu_index[pod_id].size());
-            gpu_index[pod_id][gpu_id] = gpu_index[pod_id].size();
+        devices.push_back(gpu_id);
+    }
+    return 0;
+}
+
+// Give a GPU device file seen in the pod the pod's next GPU index, returns false if it already has one
+bool add_gpu_in_pod(const std::string& pod_id, const std::string& gpu_id)
+{
+    if (gpu_index[pod_id].find(gpu_id) != gpu_index[pod_id].end()) {
+        return false;
+    }
+    spdlog::info("gpu_index[pod_id].size(): {}", gpu_index[pod_id].size());
+    gpu_index[pod_id][gpu_id] = gpu_index[pod_id].size();
+    spdlog::info("gpu_index[pod_id][gpu_id]: {}", gpu_index[pod_id][gpu_id]);
+    caches_changed();
+    return true;
+}
+
+int get_gpu_id_in_pod(const std::string& cmd, const std::string& pod_id, CyclePodData& gpu_data)
+{
+    std::vector<std::string> devices;
+    if (list_gpus_in_container(cmd, devices) != 0) {
+        return -1;
+    }
+    for (const auto& gpu_id : devices) {
+        if (add_gpu_in_pod(pod_id, gpu_id)) {
             gpu_data[pod_id][gpu_index[pod_id][gpu_id]] = std::make_pair(0, 0);
-            spdlog::info("gpu_index[pod_id][gpu_id]: {}", gpu_index[pod_id][gpu_id]);
         }
     }
     return 0;
 }
 
-std::string extract_pod_id(const std::string& input_string)
+bool is_hex(char c)
 {
-    std::regex regex(R"(/pod([a-f0-9]{8}-[a-f0-9]{4}-[a-f0-9]{4}-[a-f0-9]{4}-[a-f0-9]{12}))");
-    std::smatch match;
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+}
 
-    if (std::regex_search(input_string, match, regex)) {
-        return match[1].str(); // Return the content of the first capture group
+// A pod UID with the given separator, "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx"
+bool is_pod_uid(std::string_view uid, char separator)
+{
+    if (uid.size() != 36) {
+        return false;
     }
-    else {
-        std::regex regex2(R"(-pod([a-f0-9]{8}_[a-f0-9]{4}_[a-f0-9]{4}_[a-f0-9]{4}_[a-f0-9]{12}))");
-        std::smatch match2;
-        if (std::regex_search(input_string, match2, regex2)) {
-            return match2[1].str(); // Return the content of the first capture group
+    for (size_t i = 0; i < uid.size(); i++) {
+        bool at_separator = i == 8 || i == 13 || i == 18 || i == 23;
+        if (at_separator ? uid[i] != separator : !is_hex(uid[i])) {
+            return false;
         }
-        return ""; // No match found
     }
+    return true;
 }
 
-std::string extract_docker_id(const std::string& input_string)
+// Pod UID in a cgroup path, "/pod<uid>" (cgroupfs) or "-pod<uid>" with '_' for
+// '-' (systemd). The view points into input_string, empty when there is none.
+std::string_view extract_pod_id(std::string_view input_string)
 {
-    std::regex regex("/([a-f0-9]{64})"); // Match the 64-bit hexadecimal string after "/"
-    std::smatch match;
+    const std::pair<std::string_view, char> patterns[] = { { "/pod", '-' }, { "-pod", '_' } };
+    for (const auto& pattern : patterns) {
+        for (size_t pos = input_string.find(pattern.first); pos != std::string_view::npos; pos = input_string.find(pattern.first, pos + 1)) {
+            std::string_view uid = input_string.substr(pos + pattern.first.size(), 36);
+            if (is_pod_uid(uid, pattern.second)) {
+                return uid;
+            }
+        }
+    }
+    return {};
+}
 
-    if (std::regex_search(input_string, match, regex)) {
-        spdlog::info("match 1");
-        return match[1].str(); // Return the content of the first capture group
+// Container ID in a cgroup path, 64 hex digits after a '/' or the hex digits
+// after "docker-". The view points into input_string, empty when there is none.
+std::string_view extract_docker_id(std::string_view input_string)
+{
+    for (size_t pos = input_string.find('/'); pos != std::string_view::npos; pos = input_string.find('/', pos + 1)) {
+        std::string_view id = input_string.substr(pos + 1, 64);
+        if (id.size() == 64 && std::all_of(id.begin(), id.end(), is_hex)) {
+            spdlog::info("match 1");
+            return id;
+        }
     }
-    else {
-        std::regex regex2("docker-([a-f0-9]+)"); // Match the hexadecimal string after "docker-"
-        std::smatch match2;
-        if (std::regex_search(input_string, match2, regex2)) {
+
+    size_t pos = input_string.find("docker-");
+    if (pos != std::string_view::npos) {
+        size_t begin = pos + strlen("docker-");
+        size_t end = begin;
+        while (end < input_string.size() && is_hex(input_string[end])) {
+            end++;
+        }
+        if (end != begin) {
             spdlog::info("match 2");
-            return match2[1].str(); // Return the content of the first capture group
+            return input_string.substr(begin, end - begin);
         }
-        spdlog::error("not match");
-        return ""; // No match found
     }
+    spdlog::error("not match");
+    return {};
 }
 
+// Pod UID and container ID of a process from the first line of its cgroup file.
+// Runs for every GPU process each cycle, so it reads into a stack buffer and
+// only copies into the caller's strings.
 int read_proc_cgroup(int pid, std::string& pod_uid, std::string& docker_id)
 {
     char filename[256];
     char line[1024];
 
-    FILE* fp;
-
     // Build the file path
-    snprintf(filename, sizeof(filename), "/workspace/proc/%d/cgroup", pid);
+    snprintf(filename, sizeof(filename), "%s/%d/cgroup", proc_root.c_str(), pid);
 
     // Open the file
-    fp = fopen(filename, "r");
-    if (fp == NULL) {
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         spdlog::error("can't open file");
         return -1;
     }
+    ssize_t size = read(fd, line, sizeof(line));
+    close(fd);
 
-    fgets(line, sizeof(line), fp);
-    std::string firstLine(line);
-    spdlog::info("firstLine: {}", firstLine);
+    std::string_view first_line(line, std::max<ssize_t>(size, 0));
+    first_line = first_line.substr(0, first_line.find('\n'));
+    spdlog::info("firstLine: {}", first_line);
 
-    docker_id = extract_docker_id(firstLine);
-    if (docker_id == "") {
+    std::string_view docker_id_view = extract_docker_id(first_line);
+    if (docker_id_view.empty()) {
         spdlog::error("can't find docker id");
-        fclose(fp);
         return -1;
     }
 
-    pod_uid = extract_pod_id(firstLine);
-    if (pod_uid == "") {
+    std::string_view pod_uid_view = extract_pod_id(first_line);
+    if (pod_uid_view.empty()) {
         spdlog::error("can't find pod id");
-        fclose(fp);
         return -1;
     }
+    docker_id.assign(docker_id_view);
+    pod_uid.assign(pod_uid_view);
     std::replace(pod_uid.begin(), pod_uid.end(), '_', '-');
 
-    fclose(fp);
+    return 0;
+}
 
+// Host GPU device nodes, in NVML index order
+int load_gpu_ids()
+{
+    std::string get_gpus_in_host_cmd = "find /dev -name 'nvidia[0-9]*' | sort -V";
+    if (get_gpus_in_host(get_gpus_in_host_cmd, gpu_ids) != 0) {
+        spdlog::error("exec {} failed", get_gpus_in_host_cmd);
+        return -1;
+    }
     return 0;
 }
 
-void get_time(std::chrono::time_point<std::chrono::high_resolution_clock> start)
+// Resolution caches are snapshotted to disk so a restarted monitor does not
+// have to run docker commands again for every container it already knew.
+//
+// File layout: CacheFileHeader, then the payload with four sections
+// (pod_uid_to_id, pod_id_to_docker_id, gpu_usage, gpu_index). Strings are
+// stored as u32 length + bytes, counts as u32.
+const char cache_file_magic[8] = { 'V', 'G', 'P', 'U', 'C', 'A', 'C', 'H' };
+const uint32_t cache_file_version = 2; // 2: pods keyed by "<namespace>/<name>"
+
+struct CacheFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t gpu_fingerprint; // crc32 of gpu_uuids, gpu_usage indexes into them
+    uint64_t payload_size;
+    uint32_t payload_crc;
+    uint32_t reserved;
+};
+
+// Entries restored from disk that no live process has confirmed yet
+std::set<std::string> unverified_pod_uids;
+std::set<std::string> unverified_docker_ids;
+// cache_generation as of the last load or save of the cache file
+uint64_t saved_cache_generation = 0;
+
+uint32_t get_gpu_fingerprint()
 {
-    // Record the end time
-    auto end = std::chrono::high_resolution_clock::now();
+    uLong crc = crc32(0L, Z_NULL, 0);
+    for (const auto& uuid : gpu_uuids) {
+        crc = crc32(crc, reinterpret_cast<const Bytef*>(uuid.data()), uuid.size());
+    }
+    return static_cast<uint32_t>(crc);
+}
 
-    // Calculate the execution time
-    std::chrono::duration<double> duration = end - start;
+void append_u32(std::string& out, uint32_t value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
 
-    // Output the execution time (in seconds)
-    spdlog::info("Execution time: {} seconds", duration.count());
+void append_string(std::string& out, const std::string& value)
+{
+    append_u32(out, value.size());
+    out.append(value);
+}
+
+struct CacheReader {
+    const char* pos;
+    const char* end;
+
+    bool read_u32(uint32_t& value)
+    {
+        if (end - pos < static_cast<ptrdiff_t>(sizeof(value))) {
+            return false;
+        }
+        memcpy(&value, pos, sizeof(value));
+        pos += sizeof(value);
+        return true;
+    }
+
+    bool read_string(std::string& value)
+    {
+        uint32_t size;
+        if (!read_u32(size) || end - pos < static_cast<ptrdiff_t>(size)) {
+            return false;
+        }
+        value.assign(pos, size);
+        pos += size;
+        return true;
+    }
+};
+
+std::string serialize_caches()
+{
+    std::string payload;
+
+    append_u32(payload, pod_uid_to_id.size());
+    for (const auto& item : pod_uid_to_id) {
+        append_string(payload, item.first);
+        append_string(payload, item.second);
+    }
+
+    append_u32(payload, pod_id_to_docker_id.size());
+    for (const auto& item : pod_id_to_docker_id) {
+        append_string(payload, item.first);
+        append_string(payload, item.second);
+    }
+
+    append_u32(payload, gpu_usage.size());
+    for (const auto& container : gpu_usage) {
+        append_string(payload, container.first);
+        append_u32(payload, container.second.size());
+        for (const auto& usage : container.second) {
+            append_u32(payload, usage.first);
+            append_u32(payload, usage.second);
+        }
+    }
+
+    append_u32(payload, gpu_index.size());
+    for (const auto& pod : gpu_index) {
+        append_string(payload, pod.first);
+        append_u32(payload, pod.second.size());
+        for (const auto& index : pod.second) {
+            append_string(payload, index.first);
+            append_u32(payload, index.second);
+        }
+    }
+
+    return payload;
 }
 
-void get_usuage(std::map<std::string, std::map<unsigned int, std::pair<unsigned int, unsigned long long>>>& orginal_gpu_data, std::map<std::string, std::map<unsigned int, std::pair<unsigned int, unsigned long long>>>& gpu_data, nvmlDevice_t nvml_dev, unsigned int device_count, std::chrono::time_point<std::chrono::high_resolution_clock> start)
+bool parse_caches(CacheReader& reader)
 {
-    nvmlReturn_t nvml_ret;
+    uint32_t count;
+    std::string key;
+    std::string value;
 
-    std::map<int, unsigned long long> mem_record;
+    if (!reader.read_u32(count)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (!reader.read_string(key) || !reader.read_string(value)) {
+            return false;
+        }
+        cache_pod_uid(key, value);
+    }
 
-    if (gpu_ids.size() == 0) {
-        std::string get_gpus_in_host_cmd = "find /dev -name 'nvidia[0-9]*' | sort -V";
-        if (get_gpus_in_host(get_gpus_in_host_cmd, gpu_ids) != 0) {
-            spdlog::error("exec {} failed", get_gpus_in_host_cmd);
-            return;
+    if (!reader.read_u32(count)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (!reader.read_string(key) || !reader.read_string(value)) {
+            return false;
         }
+        pod_id_to_docker_id[key] = value;
     }
 
-    for (int i = 0; i < device_count; i++) {
-        spdlog::info("");
-        spdlog::info("current gpu is: {}", i);
-        nvml_ret = nvmlDeviceGetHandleByIndex(i, &nvml_dev);
-        int error_utilization = 0;
-        std::map<std::string, unsigned int> total_gpu_util;
-        std::map<std::string, unsigned long long> total_mem_used;
-
-        // unsigned int infoCount = 0;
-        // nvmlProcessInfo_t *infos = nullptr;
-        unsigned int infoCount = 1024;
-        nvmlProcessInfo_t* infos = new nvmlProcessInfo_t[infoCount]();
-        std::vector<unsigned int> pids;
-        if (nvml_ret != NVML_SUCCESS) {
-            spdlog::error("nvmlDeviceGetHandleByIndex returned {}", nvmlErrorString(nvml_ret));
+    if (!reader.read_u32(count)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t entries;
+        if (!reader.read_string(key) || !reader.read_u32(entries)) {
+            return false;
         }
+        auto& usage = gpu_usage[key];
+        for (uint32_t j = 0; j < entries; j++) {
+            uint32_t gpu;
+            uint32_t num;
+            if (!reader.read_u32(gpu) || !reader.read_u32(num)) {
+                return false;
+            }
+            usage[gpu] = num;
+        }
+    }
 
-        nvmlMemory_t memoryInfo;
-        nvml_ret = nvmlDeviceGetMemoryInfo(nvml_dev, &memoryInfo);
-        if (nvml_ret != NVML_SUCCESS) {
-            spdlog::error("Failed to get memory info: {}", nvmlErrorString(nvml_ret));
-            return;
+    if (!reader.read_u32(count)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t entries;
+        if (!reader.read_string(key) || !reader.read_u32(entries)) {
+            return false;
+        }
+        auto& index = gpu_index[key];
+        for (uint32_t j = 0; j < entries; j++) {
+            uint32_t gpu;
+            if (!reader.read_string(value) || !reader.read_u32(gpu)) {
+                return false;
+            }
+            index[value] = gpu;
+        }
+    }
+
+    return reader.pos == reader.end;
+}
+
+void clear_caches()
+{
+    pod_uid_to_id.clear();
+    pod_id_to_uids.clear();
+    pod_id_to_docker_id.clear();
+    gpu_usage.clear();
+    gpu_index.clear();
+    caches_changed();
+}
+
+int load_caches(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        spdlog::info("No cache file at {}: {}", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(CacheFileHeader))) {
+        spdlog::warn("Ignoring truncated cache file {}", path);
+        close(fd);
+        return -1;
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        spdlog::error("mmap of {} failed: {}", path, strerror(errno));
+        return -1;
+    }
+
+    CacheFileHeader header;
+    memcpy(&header, data, sizeof(header));
+    const char* payload = static_cast<const char*>(data) + sizeof(header);
+    int ret = -1;
+
+    if (memcmp(header.magic, cache_file_magic, sizeof(cache_file_magic)) != 0 || header.version != cache_file_version) {
+        spdlog::warn("Ignoring cache file {} with unknown format", path);
+    }
+    else if (header.payload_size != static_cast<uint64_t>(st.st_size) - sizeof(header)) {
+        spdlog::warn("Ignoring truncated cache file {}", path);
+    }
+    else if (crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(payload), header.payload_size) != header.payload_crc) {
+        spdlog::warn("Ignoring cache file {} with bad checksum", path);
+    }
+    else {
+        CacheReader reader { payload, payload + header.payload_size };
+        if (parse_caches(reader)) {
+            saved_cache_generation = cache_generation;
+            ret = 0;
         }
+        else {
+            spdlog::warn("Ignoring malformed cache file {}", path);
+            clear_caches();
+        }
+    }
+    munmap(data, st.st_size);
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    // GPU positions are only meaningful on the same set of devices
+    if (header.gpu_fingerprint != get_gpu_fingerprint()) {
+        spdlog::warn("GPUs changed since the cache was written, dropping GPU usage cache");
+        gpu_usage.clear();
+        caches_changed();
+    }
+
+    for (const auto& item : pod_uid_to_id) {
+        unverified_pod_uids.insert(item.first);
+    }
+    for (const auto& item : pod_id_to_docker_id) {
+        unverified_docker_ids.insert(item.second);
+    }
+    for (const auto& item : gpu_usage) {
+        unverified_docker_ids.insert(item.first);
+    }
+    spdlog::info("Restored {} pods and {} containers from {}", pod_uid_to_id.size(), gpu_usage.size(), path);
+    return 0;
+}
+
+int save_caches(const std::string& path)
+{
+    if (cache_generation == saved_cache_generation) {
+        return 0;
+    }
+    std::string payload = serialize_caches();
+
+    CacheFileHeader header = {};
+    memcpy(header.magic, cache_file_magic, sizeof(cache_file_magic));
+    header.version = cache_file_version;
+    header.gpu_fingerprint = get_gpu_fingerprint();
+    header.payload_size = payload.size();
+    header.payload_crc = crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(payload.data()), payload.size());
+
+    // Write a temporary file and rename it so a crash never leaves a torn cache
+    std::string tmp_path = path + ".tmp";
+    std::ofstream outfile(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!outfile.is_open()) {
+        spdlog::error("Unable to open file: {}", tmp_path);
+        return -1;
+    }
+    outfile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    outfile.write(payload.data(), payload.size());
+    outfile.close();
+    if (outfile.fail() || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        spdlog::error("Failed to write cache file: {}", path);
+        return -1;
+    }
+
+    saved_cache_generation = cache_generation;
+    return 0;
+}
+
+// A live process resolved to this pod and container, keep their restored entries
+void mark_cache_verified(const std::string& pod_uid, const std::string& docker_id)
+{
+    if (!unverified_pod_uids.empty()) {
+        unverified_pod_uids.erase(pod_uid);
+    }
+    if (!unverified_docker_ids.empty()) {
+        unverified_docker_ids.erase(docker_id);
+    }
+}
+
+// Drop restored entries no live process confirmed during the first cycle
+void drop_unverified_caches()
+{
+    for (const auto& pod_uid : unverified_pod_uids) {
+        forget_pod_uid(pod_uid);
+    }
+    for (const auto& docker_id : unverified_docker_ids) {
+        gpu_usage.erase(docker_id);
+    }
+    for (auto it = pod_id_to_docker_id.begin(); it != pod_id_to_docker_id.end();) {
+        if (unverified_docker_ids.find(it->second) != unverified_docker_ids.end()) {
+            gpu_index.erase(it->first);
+            it = pod_id_to_docker_id.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    if (!unverified_pod_uids.empty() || !unverified_docker_ids.empty()) {
+        spdlog::info("Dropped {} pods and {} containers restored from cache", unverified_pod_uids.size(), unverified_docker_ids.size());
+        caches_changed();
+    }
+    unverified_pod_uids.clear();
+    unverified_docker_ids.clear();
+}
+
+void get_time(std::chrono::time_point<std::chrono::high_resolution_clock> start)
+{
+    // Record the end time
+    auto end = std::chrono::high_resolution_clock::now();
+
+    // Calculate the execution time
+    std::chrono::duration<double> duration = end - start;
+
+    // Output the execution time (in seconds)
+    spdlog::info("Execution time: {} seconds", duration.count());
+}
+
+// Per-device sampling cadence. GPUs without compute processes and with zero
+// utilization for idle_samples samples back off to idle_interval; GPUs whose
+// process set changes or whose utilization jumps by burst_threshold points are
+// sampled every burst_interval for the next burst_samples samples.
+class DeviceScheduler {
+public:
+    struct Config {
+        std::chrono::seconds interval { 5 };
+        std::chrono::seconds idle_interval { 30 };
+        std::chrono::seconds burst_interval { 1 };
+        int idle_samples = 3;
+        int burst_samples = 10;
+        unsigned int burst_threshold = 30;
+    };
+
+    DeviceScheduler(unsigned int device_count, const Config& config)
+        : config(config), devices(device_count)
+    {
+        for (auto& device : devices) {
+            device.interval = config.interval;
+        }
+    }
+
+    bool due(unsigned int device, std::chrono::steady_clock::time_point now) const
+    {
+        return device >= devices.size() || now >= devices[device].next_sample;
+    }
+
+    bool any_due(std::chrono::steady_clock::time_point now) const
+    {
+        for (unsigned int i = 0; i < devices.size(); i++) {
+            if (due(i, now)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void observe(unsigned int device, std::chrono::steady_clock::time_point now, const std::pmr::set<unsigned int>& pids, unsigned int utilization)
+    {
+        if (device >= devices.size()) {
+            return;
+        }
+        DeviceState& state = devices[device];
+
+        unsigned int delta = utilization > state.utilization ? utilization - state.utilization : state.utilization - utilization;
+        bool same_pids = std::equal(pids.begin(), pids.end(), state.pids.begin(), state.pids.end());
+        if (state.sampled && (!same_pids || delta >= config.burst_threshold)) {
+            state.burst_left = config.burst_samples;
+        }
+        else if (state.burst_left > 0) {
+            state.burst_left--;
+        }
+
+        if (pids.empty() && utilization == 0) {
+            state.idle_samples++;
+        }
+        else {
+            state.idle_samples = 0;
+        }
+
+        std::chrono::seconds interval = config.interval;
+        if (state.burst_left > 0) {
+            interval = config.burst_interval;
+        }
+        else if (state.idle_samples >= config.idle_samples) {
+            interval = config.idle_interval;
+        }
+        if (interval != state.interval) {
+            spdlog::info("gpu {} sampling interval is now {} seconds", device, interval.count());
+        }
+
+        if (!state.sampled || interval != state.interval || utilization != state.utilization || pids.size() != state.pids.size()) {
+            state_generation++;
+        }
+        state.interval = interval;
+        state.next_sample = now + interval;
+        if (!same_pids) {
+            state.pids.assign(pids.begin(), pids.end());
+        }
+        state.utilization = utilization;
+        state.sampled = true;
+    }
+
+    std::chrono::seconds interval(unsigned int device) const
+    {
+        return device < devices.size() ? devices[device].interval : config.interval;
+    }
+
+    unsigned int utilization(unsigned int device) const
+    {
+        return device < devices.size() ? devices[device].utilization : 0;
+    }
+
+    size_t process_count(unsigned int device) const
+    {
+        return device < devices.size() ? devices[device].pids.size() : 0;
+    }
+
+    // Bumped whenever the per-GPU state published to the API changes
+    uint64_t generation() const
+    {
+        return state_generation;
+    }
+
+    // The main loop wakes up at the fastest cadence a device can have
+    std::chrono::seconds tick() const
+    {
+        return std::min({ config.interval, config.idle_interval, config.burst_interval });
+    }
+
+private:
+    struct DeviceState {
+        std::chrono::seconds interval;
+        std::chrono::steady_clock::time_point next_sample;
+        int idle_samples = 0;
+        int burst_left = 0;
+        std::vector<unsigned int> pids; // sorted
+        unsigned int utilization = 0;
+        bool sampled = false;
+    };
+
+    Config config;
+    std::vector<DeviceState> devices;
+    uint64_t state_generation = 0;
+};
+
+// One GPU process seen by get_usuage, pod_id points into pod_uid_to_id
+struct ProcessSample {
+    unsigned int pid;
+    const std::string* pod_id;
+    std::string docker_id;
+    unsigned int sm_util;
+    unsigned long long mem_used; // bytes
+};
+
+// Start time of a process in clock ticks after boot, field 22 of /proc/<pid>/stat, 0 if unknown
+unsigned long long process_start_time(unsigned int pid)
+{
+    char filename[256];
+    snprintf(filename, sizeof(filename), "%s/%u/stat", proc_root.c_str(), pid);
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    char line[1024];
+    ssize_t size = read(fd, line, sizeof(line) - 1);
+    close(fd);
+    line[std::max<ssize_t>(size, 0)] = '\0';
+
+    // comm (field 2) may contain spaces and parentheses, fields after it are plain numbers
+    const char* pos = strrchr(line, ')');
+    if (pos == NULL) {
+        return 0;
+    }
+    for (int field = 2; field < 22 && pos != NULL; field++) {
+        pos = strchr(pos + 1, ' ');
+    }
+    return pos != NULL ? strtoull(pos + 1, nullptr, 10) : 0;
+}
+
+// Opt-in per-process series (VGPU_MONITOR_PROCESS_METRICS). A process is
+// identified by pid, pod and container, and its start time is read once, when
+// the pid first appears on a GPU or shows up in another pod or container. A pid
+// reused by another process of the same container between two samples of its
+// GPU keeps the series. Series are removed as soon as a sample of their GPU no
+// longer lists the process. Under a series budget, processes get what the pod
+// series leave, those using the most memory first; labels are built when a
+// process is first exposed. Process names come from a bounded LRU of
+// /proc/<pid>/comm that forgets a pid together with its series; container names
+// come from the docker name of the process's own container and are dropped with
+// its last series.
+class ProcessMetrics {
+public:
+    // Work done since startup
+    struct Cost {
+        size_t comm_reads = 0;
+        size_t stat_reads = 0;
+        size_t container_lookups = 0;
+        std::chrono::steady_clock::duration time = std::chrono::steady_clock::duration::zero();
+    };
+
+    ProcessMetrics(prometheus::Family<prometheus::Gauge>& sm_util_family, prometheus::Family<prometheus::Gauge>& mem_used_family, size_t comm_cache_size)
+        : sm_util_family(sm_util_family)
+        , mem_used_family(mem_used_family)
+        , comm_cache_size(std::max<size_t>(1, comm_cache_size))
+    {
+    }
+
+    // Replace the processes of a GPU with the ones it reported this cycle
+    void update(unsigned int device, const std::pmr::vector<ProcessSample>& samples)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        auto& device_series = series[device];
+        std::pmr::set<unsigned int> seen(cycle_arena.resource());
+        bool removed = false;
+        for (const auto& sample : samples) {
+            seen.insert(sample.pid);
+            auto it = device_series.find(sample.pid);
+            if (it != device_series.end() && (it->second.pod != *sample.pod_id || it->second.docker_id != sample.docker_id)) {
+                // Either the pid was reused by a process of another pod or container,
+                // or the process was attributed to another pod; both get new labels
+                unsigned long long start_time = process_start_time(sample.pid);
+                cost.stat_reads++;
+                if (start_time != it->second.start_time) {
+                    spdlog::info("pid {} on GPU {} was reused by a process of pod {}", sample.pid, device, *sample.pod_id);
+                }
+                else {
+                    spdlog::info("process {} on GPU {} moved from pod {} to pod {}", sample.pid, device, it->second.pod, *sample.pod_id);
+                }
+                hide(it->second);
+                forget_comm(sample.pid);
+                device_series.erase(it);
+                it = device_series.emplace(sample.pid, Series { *sample.pod_id, sample.docker_id, start_time }).first;
+                removed = true;
+            }
+            else if (it == device_series.end()) {
+                cost.stat_reads++;
+                it = device_series.emplace(sample.pid, Series { *sample.pod_id, sample.docker_id, process_start_time(sample.pid) }).first;
+            }
+            it->second.sm_util = sample.sm_util * GPUAllocation;
+            it->second.mem_used = sample.mem_used / 1024 / 1024;
+        }
+
+        for (auto it = device_series.begin(); it != device_series.end();) {
+            if (seen.find(it->first) != seen.end()) {
+                ++it;
+                continue;
+            }
+            spdlog::info("process {} of pod {} left GPU {}", it->first, it->second.pod, device);
+            hide(it->second);
+            forget_comm(it->first);
+            it = device_series.erase(it);
+            removed = true;
+        }
+        if (removed) {
+            forget_unused_containers();
+        }
+        cost.time += std::chrono::steady_clock::now() - begin;
+    }
+
+    // Expose at most budget processes, those using the most memory first, and
+    // return how many were left out
+    size_t expose(size_t budget)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        struct Process {
+            unsigned int device;
+            unsigned int pid;
+            Series* series;
+        };
+        std::pmr::vector<Process> processes(cycle_arena.resource());
+        for (auto& device_series : series) {
+            for (auto& process : device_series.second) {
+                processes.push_back({ device_series.first, process.first, &process.second });
+            }
+        }
+        if (processes.size() > budget) {
+            std::nth_element(processes.begin(), processes.begin() + budget, processes.end(), [](const Process& a, const Process& b) {
+                return std::tie(a.series->mem_used, a.series->sm_util) > std::tie(b.series->mem_used, b.series->sm_util);
+            });
+        }
+
+        for (size_t i = 0; i < processes.size(); i++) {
+            Series& process = *processes[i].series;
+            if (i >= budget) {
+                hide(process);
+                continue;
+            }
+            if (!process.sm_util_gauge) {
+                show(processes[i].device, processes[i].pid, process);
+            }
+            process.sm_util_gauge->Set(process.sm_util);
+            process.mem_used_gauge->Set(process.mem_used);
+        }
+        cost.time += std::chrono::steady_clock::now() - begin;
+        return processes.size() > budget ? processes.size() - budget : 0;
+    }
+
+    // Processes on the GPUs as of their last samples, exposed or not
+    size_t process_count() const
+    {
+        size_t total = 0;
+        for (const auto& device_series : series) {
+            total += device_series.second.size();
+        }
+        return total;
+    }
+
+    size_t cached_names() const
+    {
+        return comm_order.size();
+    }
+
+    const Cost& total_cost() const
+    {
+        return cost;
+    }
+
+    // Report what the per-process series cost since the last report
+    void log_cost()
+    {
+        spdlog::info("per-process metrics: {} processes, {} comm reads, {} stat reads, {} container lookups, {} cached names, {} us",
+            process_count(), cost.comm_reads - logged_cost.comm_reads, cost.stat_reads - logged_cost.stat_reads,
+            cost.container_lookups - logged_cost.container_lookups, comm_order.size(),
+            std::chrono::duration_cast<std::chrono::microseconds>(cost.time - logged_cost.time).count());
+        logged_cost = cost;
+    }
+
+private:
+    struct Series {
+        std::string pod;
+        std::string docker_id;
+        unsigned long long start_time;
+        unsigned int sm_util = 0;
+        unsigned long long mem_used = 0; // MB
+        prometheus::Gauge* sm_util_gauge = nullptr; // nullptr while not exposed
+        prometheus::Gauge* mem_used_gauge = nullptr;
+    };
+
+    void show(unsigned int device, unsigned int pid, Series& process)
+    {
+        prometheus::Labels labels = {
+            {"namespace", std::string(pod_key_namespace(process.pod))},
+            {"pod", std::string(pod_key_name(process.pod))},
+            {"container", container(process.docker_id)},
+            {"container_id", process.docker_id},
+            {"node", node_name},
+            {"device", std::to_string(device)},
+            {"pid", std::to_string(pid)},
+            {"comm", comm(pid)},
+        };
+        process.sm_util_gauge = &sm_util_family.Add(labels);
+        process.mem_used_gauge = &mem_used_family.Add(labels);
+    }
+
+    void hide(Series& process)
+    {
+        if (process.sm_util_gauge) {
+            sm_util_family.Remove(process.sm_util_gauge);
+            mem_used_family.Remove(process.mem_used_gauge);
+            process.sm_util_gauge = nullptr;
+            process.mem_used_gauge = nullptr;
+        }
+    }
+
+    const std::string& comm(unsigned int pid)
+    {
+        auto cached = comm_index.find(pid);
+        if (cached != comm_index.end()) {
+            comm_order.splice(comm_order.begin(), comm_order, cached->second);
+            return cached->second->second;
+        }
+
+        char filename[256];
+        snprintf(filename, sizeof(filename), "%s/%u/comm", proc_root.c_str(), pid);
+        std::string name;
+        std::ifstream file(filename);
+        std::getline(file, name);
+        cost.comm_reads++;
+
+        if (comm_order.size() >= comm_cache_size) {
+            comm_index.erase(comm_order.back().first);
+            comm_order.pop_back();
+        }
+        comm_order.emplace_front(pid, std::move(name));
+        comm_index[pid] = comm_order.begin();
+        return comm_order.front().second;
+    }
+
+    void forget_comm(unsigned int pid)
+    {
+        auto cached = comm_index.find(pid);
+        if (cached != comm_index.end()) {
+            comm_order.erase(cached->second);
+            comm_index.erase(cached);
+        }
+    }
+
+    // Name of the container the process runs in, a pod may run GPU processes in several
+    const std::string& container(const std::string& docker_id)
+    {
+        auto cached = containers.find(docker_id);
+        if (cached != containers.end()) {
+            return cached->second;
+        }
+        std::string name;
+        std::string cmd = container_name_command(docker_id);
+        if (get_pod_id(cmd, name) != 0) {
+            spdlog::error("exec {} failed", cmd);
+            name.clear();
+        }
+        cost.container_lookups++;
+        return containers.emplace(docker_id, std::move(name)).first->second;
+    }
+
+    void forget_unused_containers()
+    {
+        std::set<std::string_view> used;
+        for (const auto& device_series : series) {
+            for (const auto& process : device_series.second) {
+                used.insert(process.second.docker_id);
+            }
+        }
+        for (auto it = containers.begin(); it != containers.end();) {
+            if (used.find(it->first) == used.end()) {
+                it = containers.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+    prometheus::Family<prometheus::Gauge>& sm_util_family;
+    prometheus::Family<prometheus::Gauge>& mem_used_family;
+    std::map<unsigned int, std::map<unsigned int, Series>> series; // By GPU, then pid
+    size_t comm_cache_size;
+    std::list<std::pair<unsigned int, std::string>> comm_order; // Most recently used first
+    std::unordered_map<unsigned int, std::list<std::pair<unsigned int, std::string>>::iterator> comm_index;
+    std::unordered_map<std::string, std::string> containers; // By docker_id
+    Cost cost;
+    Cost logged_cost;
+};
+
+std::unique_ptr<ProcessMetrics> process_metrics;
+
+// The pod the kubelet assigned a GPU or MIG instance to, nullptr when no pod or
+// several pods (shared replicas) hold it. The device plugin advertises devices by
+// UUID or by index, "<gpu>" or "<gpu>:<mig slot>".
+const std::string* kubelet_device_owner(unsigned int gpu, nvmlDevice_t instance, const MigDevices& mig_devices)
+{
+    if (kubelet_device_pods.empty() || gpu >= gpu_uuids.size()) {
+        return nullptr;
+    }
+    std::vector<std::string> device_ids;
+    auto mig_device = std::find_if(mig_devices.begin(), mig_devices.end(), [&](const auto& mig) { return mig.second == instance; });
+    if (mig_device == mig_devices.end()) {
+        device_ids = { gpu_uuids[gpu], std::to_string(gpu) };
+    }
+    else {
+        char uuid[NVML_DEVICE_UUID_BUFFER_SIZE];
+        if (gpu_backend->device_uuid(instance, uuid, NVML_DEVICE_UUID_BUFFER_SIZE) == NVML_SUCCESS) {
+            device_ids.push_back(uuid);
+        }
+        device_ids.push_back(std::to_string(gpu) + ":" + std::to_string(mig_device->first));
+    }
+
+    for (const auto& device_id : device_ids) {
+        auto pods = kubelet_device_pods.find(device_id);
+        if (pods != kubelet_device_pods.end()) {
+            return pods->second.size() == 1 ? &*pods->second.begin() : nullptr;
+        }
+    }
+    return nullptr;
+}
+
+// Sample the due GPUs into gpu_data by pod and GPU rank, except MIG instances
+// with a slot of their own (pod_mig_slots), which go to mig_gpu_data by slot
+void get_usuage(std::map<std::string, std::map<unsigned int, std::pair<unsigned int, unsigned long long>>>& orginal_gpu_data, CyclePodData& gpu_data, CyclePodData& mig_gpu_data, CyclePodCapacity& instance_memory_data, CycleScratch& scratch, DeviceScheduler& scheduler, std::chrono::steady_clock::time_point now, nvmlDevice_t nvml_dev, unsigned int device_count, std::chrono::time_point<std::chrono::high_resolution_clock> start)
+{
+    nvmlReturn_t nvml_ret;
+
+    std::pmr::map<int, unsigned long long> mem_record(cycle_arena.resource());
+
+    if (gpu_ids.size() == 0 && load_gpu_ids() != 0) {
+        return;
+    }
+
+    for (int i = 0; i < device_count; i++) {
+        if (!scheduler.due(i, now)) {
+            continue;
+        }
+        spdlog::info("");
+        spdlog::info("current gpu is: {}", i);
+        nvml_ret = gpu_backend->device_handle(i, &nvml_dev);
+        std::pmr::map<PodKey, unsigned int, std::less<const std::string>> total_gpu_util(cycle_arena.resource());
+        std::pmr::map<PodKey, unsigned long long, std::less<const std::string>> total_mem_used(cycle_arena.resource());
+
+        if (nvml_ret != NVML_SUCCESS) {
+            spdlog::error("nvmlDeviceGetHandleByIndex returned {}", gpu_backend->error_string(nvml_ret));
+        }
+
+        nvmlMemory_t memoryInfo;
+        nvml_ret = gpu_backend->memory_info(nvml_dev, &memoryInfo);
+        if (nvml_ret != NVML_SUCCESS) {
+            spdlog::error("Failed to get memory info: {}", gpu_backend->error_string(nvml_ret));
+            return;
+        }
+
+        if (i == 0 || gpu_memory == 0) {
+            gpu_memory = memoryInfo.total;
+        }
+
+        // On MIG-partitioned GPUs processes and memory are reported by the GPU instances,
+        // so sample every instance instead of the physical device
+        MigDevices mig_devices(cycle_arena.resource());
+        MigDevices instances(cycle_arena.resource());
+        bool mig_enabled = get_mig_devices(nvml_dev, mig_devices);
+        if (mig_enabled) {
+            instances.assign(mig_devices.begin(), mig_devices.end());
+        }
+        else {
+            instances.emplace_back(0, nvml_dev);
+        }
+        // GPU instances already counted into a pod's memory capacity on this GPU
+        std::pmr::map<PodKey, std::pmr::set<nvmlDevice_t>, std::less<const std::string>> pod_instances(cycle_arena.resource());
+        std::pmr::set<unsigned int> device_pids(cycle_arena.resource());
+        std::pmr::vector<ProcessSample> device_processes(cycle_arena.resource());
+
+        for (const auto& instance : instances) {
+            unsigned int mig_slot = instance.first;
+            nvmlDevice_t instance_dev = instance.second;
+            int error_utilization = 0;
+            unsigned long long instance_memory = memoryInfo.total;
+            if (mig_enabled) {
+                nvmlMemory_t instanceMemoryInfo;
+                nvml_ret = gpu_backend->memory_info(instance_dev, &instanceMemoryInfo);
+                if (nvml_ret != NVML_SUCCESS) {
+                    spdlog::error("Failed to get MIG instance memory info: {}", gpu_backend->error_string(nvml_ret));
+                    continue;
+                }
+                instance_memory = instanceMemoryInfo.total;
+            }
+
+            // unsigned int infoCount = 0;
+            // nvmlProcessInfo_t *infos = nullptr;
+            unsigned int infoCount = 1024;
+            std::pmr::vector<nvmlProcessInfo_t> infos(infoCount, cycle_arena.resource());
+
+            nvml_ret = gpu_backend->compute_running_processes(instance_dev, &infoCount, infos.data());
+            if (nvml_ret != NVML_SUCCESS && nvml_ret != NVML_ERROR_INSUFFICIENT_SIZE) {
+                spdlog::error("nvmlDeviceGetComputeRunningProcesses_v3 failed with {}", gpu_backend->error_string(nvml_ret));
+                spdlog::error("infoCount: {}", infoCount);
+                return;
+            }
+            else if (nvml_ret == NVML_ERROR_INSUFFICIENT_SIZE) {
+                spdlog::info("nvmlDeviceGetComputeRunningProcesses_v3 failed with {}. try again!", gpu_backend->error_string(nvml_ret));
+                spdlog::info("infoCount: {}", infoCount);
+                infoCount = 1024 * 10;
+                // Allocate enough memory
+                infos.assign(infoCount, nvmlProcessInfo_t {});
+
+                // Second call to nvmlDeviceGetComputeRunningProcesses_v3 to get process info
+                nvml_ret = gpu_backend->compute_running_processes(instance_dev, &infoCount, infos.data());
+                if (nvml_ret != NVML_SUCCESS) {
+                    spdlog::error("nvmlDeviceGetComputeRunningProcesses_v3 failed with {}", gpu_backend->error_string(nvml_ret));
+                    return;
+                }
+
+            }
+
+            spdlog::info("nvmlDeviceGetComputeRunningProcesses_v3:");
+            for (int j = 0; infos[j].pid != 0; j++) {
+                mem_record[infos[j].pid] = infos[j].usedGpuMemory;
+                device_pids.insert(infos[j].pid);
+                spdlog::info("pid is: {}, usedGpuMemory is: {}", infos[j].pid, infos[j].usedGpuMemory);
+            }
+
+            unsigned int processSamplesCount = 1024;
+
+            // Allocate buffer
+            std::pmr::vector<nvmlProcessUtilizationSample_t> utilization(processSamplesCount, cycle_arena.resource());
+
+            // Get utilization information
+            nvml_ret = gpu_backend->process_utilization(instance_dev, utilization.data(), &processSamplesCount, 0);
+            if (nvml_ret != NVML_SUCCESS) {
+                spdlog::error("Failed to get process utilization: {}", gpu_backend->error_string(nvml_ret));
+                // nvmlShutdown();
+                error_utilization = 1;
+            }
+
+            spdlog::info("");
+
+            // Process utilization information. The cgroup IDs are read into the
+            // scratch buffers kept from cycle to cycle.
+            std::string& pod_uid = scratch.pod_uid;
+            std::string& docker_id = scratch.docker_id;
+            for (int k = 0; infos[k].pid != 0; k++) {
+                spdlog::info("");
+                spdlog::info("pid is: {}", infos[k].pid);
+                if (read_proc_cgroup(infos[k].pid, pod_uid, docker_id) != -1) {
+                    docker_id.resize(std::min<size_t>(docker_id.size(), 12));
+                    mark_cache_verified(pod_uid, docker_id);
+
+                    // Get pod_id, the cycle's sample maps refer to the cached string. A device
+                    // the kubelet assigned to one pod names it, docker ps is only needed for
+                    // shared devices or without the PodResources API.
+                    auto cached_pod_id = pod_uid_to_id.find(pod_uid);
+                    if (cached_pod_id == pod_uid_to_id.end()) {
+                        const std::string* owner = kubelet_device_owner(i, instance_dev, mig_devices);
+                        if (owner) {
+                            cached_pod_id = cache_pod_uid(pod_uid, *owner);
+                        }
+                        else {
+                            std::string resolved_pod_id;
+                            std::string get_pod_id_cmd = pod_id_command(docker_id);
+                            if (get_pod_id(get_pod_id_cmd, resolved_pod_id) != 0) {
+                                spdlog::error("exec {} failed", get_pod_id_cmd);
+                                continue;
+                            }
+                            cached_pod_id = cache_pod_uid(pod_uid, resolved_pod_id);
+                        }
+                    }
+                    const std::string& pod_id = cached_pod_id->second;
+
+                    if (pod_id_to_docker_id.try_emplace(pod_id, docker_id).second) {
+                        caches_changed();
+                    }
+
+                    auto kubelet_usage = kubelet_gpu_usage.find(pod_id);
+                    if (kubelet_usage != kubelet_gpu_usage.end()) {
+                        auto& usage = gpu_usage[docker_id];
+                        if (usage != kubelet_usage->second) {
+                            usage = kubelet_usage->second;
+                            caches_changed();
+                        }
+                    }
+                    else {
+                        get_docker_gpus(docker_id);
+                        auto container_mig_devices = docker_mig_devices.find(docker_id);
+                        if (container_mig_devices != docker_mig_devices.end() && pod_mig_slots.find(pod_id) == pod_mig_slots.end()) {
+                            assign_mig_slots(pod_id, container_mig_devices->second);
+                        }
+                    }
+
+                    if (orginal_gpu_data.find(pod_id) == orginal_gpu_data.end()) {
+                        spdlog::warn("pod_id is not in orginal_gpu_data: {}", pod_id);
+                        continue;
+                    }
+
+                    spdlog::info("gpu_index[pod_id].size(): {}", gpu_index[pod_id].size());
+                    if (gpu_index[pod_id].size() == 0 || gpu_index.find(pod_id) == gpu_index.end()) {
+                        std::string get_gpus_in_container_cmd = gpus_in_container_command(docker_id);
+                        if (get_gpu_id_in_pod(get_gpus_in_container_cmd, pod_id, gpu_data) != 0) {
+                            spdlog::error("exec {} failed", get_gpus_in_container_cmd);
+                            continue;
+                        }
+                    }
+                    spdlog::info("gpu_index[pod_id].size(): {}", gpu_index[pod_id].size());
+                    if (gpu_index[pod_id].size() == 0) {
+                        continue;
+                    }
+
+                    unsigned int process_util = 0;
+                    if (error_utilization != 1) {
+                        for (int j = 0; utilization[j].pid != 0; j++) {
+                            if (utilization[j].pid == infos[k].pid) {
+                                process_util += utilization[j].smUtil;
+                                spdlog::info("pid is: {}, smUtil is: {}", infos[k].pid, utilization[j].smUtil);
+                            }
+                        }
+                    }
+                    if (process_metrics) {
+                        device_processes.push_back({ infos[k].pid, &pod_id, docker_id, process_util, infos[k].usedGpuMemory });
+                    }
+
+                    // A MIG instance the pod holds is a slot of its own
+                    auto slots = mig_enabled ? pod_mig_slots.find(pod_id) : pod_mig_slots.end();
+                    if (slots != pod_mig_slots.end()) {
+                        auto slot = slots->second.find(std::make_pair(static_cast<unsigned int>(i), mig_slot));
+                        if (slot != slots->second.end()) {
+                            auto& sample = mig_gpu_data[pod_id][slot->second];
+                            sample.first += process_util;
+                            sample.second += infos[k].usedGpuMemory;
+                            spdlog::info("pod id is: {}, MIG slot {} of gpu {} is slot {}, util is: {}, mem_used is: {}", pod_id, mig_slot, i, slot->second, sample.first, sample.second);
+                            continue;
+                        }
+                    }
+
+                    // Accumulate previous statistics
+                    if (gpu_data.find(pod_id) == gpu_data.end()) {
+                        // Initialize if pod_id does not exist
+                        gpu_data[pod_id][gpu_index[pod_id][gpu_ids[i]]] = std::make_pair(0, 0);
+                    }
+                    if (total_gpu_util.find(pod_id) == total_gpu_util.end()) {
+                        total_gpu_util[pod_id] = 0;
+                    }
+                    if (total_mem_used.find(pod_id) == total_mem_used.end()) {
+                        total_mem_used[pod_id] = 0;
+                    }
+                    // Accumulate smUtil and mem_used
+                    total_mem_used[pod_id] += infos[k].usedGpuMemory;
+                    spdlog::info("pid is: {}, usedGpuMemory is: {}", infos[k].pid, infos[k].usedGpuMemory);
+                    total_gpu_util[pod_id] += process_util;
+
+                    spdlog::info("pod id is: {}, total_gpu_util is: {}, total_mem_used is: {}", pod_id, total_gpu_util[pod_id], total_mem_used[pod_id]);
+
+                    spdlog::info("gpu_ids[i] id is: {}, gpu id is: {}, gpu id in pod is: {}", gpu_ids[i], i, gpu_index[pod_id][gpu_ids[i]]);
+
+                    // A pod owns the whole capacity of each GPU instance its processes run in
+                    if (mig_enabled && pod_instances[pod_id].insert(instance_dev).second) {
+                        instance_memory_data[pod_id][gpu_index[pod_id][gpu_ids[i]]] += instance_memory;
+                    }
+
+                    gpu_data[pod_id][gpu_index[pod_id][gpu_ids[i]]].first = total_gpu_util[pod_id];
+                    gpu_data[pod_id][gpu_index[pod_id][gpu_ids[i]]].second = total_mem_used[pod_id];
+                    spdlog::info("gpu_data[pod_id][gpu_index[pod_id][gpu_ids[i]]].first is: {}, gpu_data[pod_id][gpu_index[pod_id][gpu_ids[i]]].second is: {}", gpu_data[pod_id][gpu_index[pod_id][gpu_ids[i]]].first, gpu_data[pod_id][gpu_index[pod_id][gpu_ids[i]]].second);
+                }
+            }
+        }
+
+        nvmlUtilization_t device_utilization = {};
+        nvml_ret = gpu_backend->utilization_rates(nvml_dev, &device_utilization);
+        if (nvml_ret != NVML_SUCCESS) {
+            spdlog::debug("Failed to get utilization rates: {}", gpu_backend->error_string(nvml_ret));
+        }
+        scheduler.observe(i, now, device_pids, device_utilization.gpu);
+        if (process_metrics) {
+            process_metrics->update(i, device_processes);
+        }
+    }
+}
+
+// Initialize NVML and enumerate the GPUs, runs while the initial pod list is in flight
+int init_devices(unsigned int& device_count)
+{
+    nvmlReturn_t result = gpu_backend->init();
+    if (result != NVML_SUCCESS) {
+        spdlog::error("nvmlInit failed with {}", gpu_backend->error_string(result));
+        return -1;
+    }
+
+    result = gpu_backend->device_count(&device_count);
+    if (NVML_SUCCESS != result) {
+        spdlog::error("Failed to query device count: {}", gpu_backend->error_string(result));
+        return -1;
+    }
+    spdlog::info("Current device count is: {}", device_count);
+
+    get_gpu_uuids();
+    return 0;
+}
+
+// Docker lookups for one container of a running GPU process. Startup runs
+// them in parallel instead of one after another in the first get_usuage.
+struct ContainerLookup {
+    std::string pod_uid;
+    std::string docker_id;
+    std::string pod_id; // Cached, or resolved by the lookup
+    bool resolve_pod_id = false;
+    bool inspect_gpus = false;
+    bool list_gpus = false;
+
+    bool ok = true;
+    std::string inspect_output;
+    std::vector<std::string> gpus_in_container;
+};
+
+// Collect the containers of all running GPU processes that miss a cached resolution
+std::vector<ContainerLookup> collect_container_lookups(unsigned int device_count)
+{
+    std::vector<ContainerLookup> lookups;
+    std::set<std::string> seen;
+    std::vector<nvmlProcessInfo_t> infos;
+    for (unsigned int i = 0; i < device_count; i++) {
+        nvmlDevice_t device;
+        if (gpu_backend->device_handle(i, &device) != NVML_SUCCESS) {
+            continue;
+        }
+        MigDevices mig_devices;
+        std::vector<nvmlDevice_t> instances;
+        if (get_mig_devices(device, mig_devices)) {
+            for (const auto& mig_device : mig_devices) {
+                instances.push_back(mig_device.second);
+            }
+        }
+        else {
+            instances.push_back(device);
+        }
+
+        for (nvmlDevice_t instance : instances) {
+            unsigned int info_count = 0;
+            infos.clear();
+            if (gpu_backend->compute_running_processes(instance, &info_count, nullptr) == NVML_ERROR_INSUFFICIENT_SIZE) {
+                infos.resize(info_count);
+                if (gpu_backend->compute_running_processes(instance, &info_count, infos.data()) != NVML_SUCCESS) {
+                    continue;
+                }
+                infos.resize(info_count);
+            }
+
+            for (const auto& info : infos) {
+                ContainerLookup lookup;
+                if (read_proc_cgroup(info.pid, lookup.pod_uid, lookup.docker_id) == -1) {
+                    continue;
+                }
+                lookup.docker_id = lookup.docker_id.substr(0, 12);
+                if (!seen.insert(lookup.docker_id).second) {
+                    continue;
+                }
+
+                auto cached_pod_id = pod_uid_to_id.find(lookup.pod_uid);
+                lookup.resolve_pod_id = cached_pod_id == pod_uid_to_id.end();
+                if (!lookup.resolve_pod_id) {
+                    lookup.pod_id = cached_pod_id->second;
+                }
+                lookup.inspect_gpus = gpu_usage.find(lookup.docker_id) == gpu_usage.end();
+                auto cached_gpus = gpu_index.find(lookup.pod_id);
+                lookup.list_gpus = cached_gpus == gpu_index.end() || cached_gpus->second.empty();
+                if (lookup.resolve_pod_id || lookup.inspect_gpus || lookup.list_gpus) {
+                    lookups.push_back(std::move(lookup));
+                }
+            }
+        }
+    }
+    return lookups;
+}
+
+// Run the docker commands of the lookups on up to `parallelism` threads. Only
+// touches the lookups themselves, so the caller may keep serving I/O meanwhile.
+void run_container_lookups(std::vector<ContainerLookup>& lookups, unsigned int parallelism)
+{
+    std::atomic<size_t> next { 0 };
+    auto worker = [&]() {
+        for (size_t i = next++; i < lookups.size(); i = next++) {
+            ContainerLookup& lookup = lookups[i];
+            try {
+                if (lookup.resolve_pod_id && get_pod_id(pod_id_command(lookup.docker_id), lookup.pod_id) != 0) {
+                    lookup.ok = false;
+                    continue;
+                }
+                if (lookup.inspect_gpus) {
+                    lookup.inspect_output = execute_get_docker_gpus_command(docker_gpus_command(lookup.docker_id));
+                }
+                if (lookup.list_gpus) {
+                    list_gpus_in_container(gpus_in_container_command(lookup.docker_id), lookup.gpus_in_container);
+                }
+            }
+            catch (const std::exception& e) {
+                spdlog::error("Failed to resolve container {}: {}", lookup.docker_id, e.what());
+                lookup.ok = false;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 1; i < std::min<size_t>(parallelism, lookups.size()); i++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers) {
+        thread.join();
+    }
+}
+
+// Store the results in the caches get_usuage consults before running docker itself
+void apply_container_lookups(const std::vector<ContainerLookup>& lookups)
+{
+    for (const auto& lookup : lookups) {
+        if (!lookup.ok || lookup.pod_id.empty()) {
+            continue;
+        }
+        cache_pod_uid(lookup.pod_uid, lookup.pod_id);
+        if (pod_id_to_docker_id.emplace(lookup.pod_id, lookup.docker_id).second) {
+            caches_changed();
+        }
+        if (lookup.inspect_gpus && gpu_usage.find(lookup.docker_id) == gpu_usage.end()) {
+            try {
+                parse_docker_gpus(lookup.docker_id, lookup.inspect_output);
+            }
+            catch (const std::exception& e) {
+                spdlog::error("Failed to get GPUs of container {}: {}", lookup.docker_id, e.what());
+            }
+        }
+        if (lookup.list_gpus) {
+            for (const auto& gpu_id : lookup.gpus_in_container) {
+                add_gpu_in_pod(lookup.pod_id, gpu_id);
+            }
+        }
+    }
+}
+
+void remove_gpu_series(const GpuSeries& series,
+    prometheus::Family<prometheus::Gauge>& gauge_family_first,
+    prometheus::Family<prometheus::Gauge>& gauge_family_second,
+    prometheus::Family<prometheus::Gauge>& gauge_family_third)
+{
+    gauge_family_first.Remove(series.sm_util);
+    gauge_family_second.Remove(series.mem_used);
+    gauge_family_third.Remove(series.total_mem);
+}
+
+void remove_pod_series(PodSeries& pod,
+    prometheus::Family<prometheus::Gauge>& gauge_family_first,
+    prometheus::Family<prometheus::Gauge>& gauge_family_second,
+    prometheus::Family<prometheus::Gauge>& gauge_family_third)
+{
+    for (const auto& gpu : pod.gpus) {
+        remove_gpu_series(gpu.second, gauge_family_first, gauge_family_second, gauge_family_third);
+    }
+    pod.gpus.clear();
+}
+
+// Find the gauges of a pod/GPU series, adding them under the pod's interned labels if needed
+GpuSeries& get_gpu_series(const std::string& pod_id, unsigned int gpu_id,
+    prometheus::Family<prometheus::Gauge>& gauge_family_first,
+    prometheus::Family<prometheus::Gauge>& gauge_family_second,
+    prometheus::Family<prometheus::Gauge>& gauge_family_third)
+{
+    static const std::string unknown;
+    auto container_it = pod_containers.find(pod_id);
+    const std::string& container = container_it != pod_containers.end() ? container_it->second : unknown;
+
+    PodSeries& pod = pod_series[pod_id];
+    if (pod.labels.empty() || pod.container != container) {
+        remove_pod_series(pod, gauge_family_first, gauge_family_second, gauge_family_third);
+        pod.container = container;
+        pod.labels = {
+            {"namespace", std::string(pod_key_namespace(pod_id))},
+            {"pod", std::string(pod_key_name(pod_id))},
+            {"container", container},
+            {"node", node_name},
+        };
+    }
+
+    auto gpu = pod.gpus.find(gpu_id);
+    if (gpu == pod.gpus.end()) {
+        prometheus::Labels labels = pod.labels;
+        labels["gpu_id"] = std::to_string(gpu_id);
+        GpuSeries series = { &gauge_family_first.Add(labels), &gauge_family_second.Add(labels), &gauge_family_third.Add(labels) };
+        gpu = pod.gpus.emplace(gpu_id, series).first;
+    }
+    return gpu->second;
+}
+
+// Function to expose gpu_data to Prometheus
+void expose_gpu_data(std::shared_ptr<prometheus::Registry> registry,
+    std::map<std::string, std::map<unsigned int, std::pair<unsigned int, unsigned long long>>>& gpu_data,
+    prometheus::Family<prometheus::Gauge>& gauge_family_first,
+    prometheus::Family<prometheus::Gauge>& gauge_family_second,
+    prometheus::Family<prometheus::Gauge>& gauge_family_third)
+{
+    // Samples are overwritten in place, so an unchanged pod costs no allocation
+    size_t sample_count = 0;
+
+    // Iterate through gpu_data and collect each Pod's GPU utilization and memory usage
+    for (const auto& pod : gpu_data) {
+        const auto& pod_id = pod.first;
+        int gpu_num = 0;
+        for (const auto& gpu : pod.second) {
+            unsigned int gpu_id = 1024;
+            for (auto& index : gpu_index[pod_id]) {
+                if (index.second == gpu.first) {
+                    gpu_id = gpu.first;
+                    gpu_num++;
+                    break;
+                }
+            }
+
+            if (gpu_id == 1024) {
+                gpu_id = gpu_num;
+                gpu_num++;
+            }
+
+            unsigned int sm_util = gpu.second.first * GPUAllocation;
+            unsigned long long mem_used = gpu.second.second / 1024 / 1024;
+            unsigned long long total_mem = gpu_memory / 1024 / 1024 / GPUAllocation;
+            if (pod_gpu_capacity.find(pod_id) != pod_gpu_capacity.end() && pod_gpu_capacity.at(pod_id).find(gpu.first) != pod_gpu_capacity.at(pod_id).end()) {
+                total_mem = pod_gpu_capacity.at(pod_id).at(gpu.first) / 1024 / 1024;
+            }
+
+            // Output metrics
+            spdlog::info("Pod ID: {}, GPU ID: {}, SM Utilization: {}, Memory Used: {}, Total Memory: {}", pod_id, gpu_id, sm_util, mem_used, total_mem);
+            if (sample_count == latest_snapshot.size()) {
+                latest_snapshot.push_back({ pod_id, gpu_id, sm_util, mem_used, total_mem });
+                snapshot_generation++;
+            }
+            else {
+                PodGpuSample& sample = latest_snapshot[sample_count];
+                if (sample.pod != pod_id || std::tie(sample.gpu_id, sample.sm_util, sample.mem_used, sample.total_mem) != std::tie(gpu_id, sm_util, mem_used, total_mem)) {
+                    sample.pod = pod_id;
+                    sample.gpu_id = gpu_id;
+                    sample.sm_util = sm_util;
+                    sample.mem_used = mem_used;
+                    sample.total_mem = total_mem;
+                    snapshot_generation++;
+                }
+            }
+            sample_count++;
+        }
+    }
+    if (sample_count != latest_snapshot.size()) {
+        latest_snapshot.erase(latest_snapshot.begin() + sample_count, latest_snapshot.end());
+        snapshot_generation++;
+    }
+
+    // Over the cardinality budget, keep the series using the most memory and fold the rest
+    std::pmr::vector<bool> folded(latest_snapshot.size(), false, cycle_arena.resource());
+    if (series_budget != 0 && latest_snapshot.size() > series_budget) {
+        std::pmr::vector<size_t> order(latest_snapshot.size(), cycle_arena.resource());
+        for (size_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        std::nth_element(order.begin(), order.begin() + series_budget, order.end(), [](size_t a, size_t b) {
+            const PodGpuSample& x = latest_snapshot[a];
+            const PodGpuSample& y = latest_snapshot[b];
+            return std::tie(x.mem_used, x.sm_util) > std::tie(y.mem_used, y.sm_util);
+        });
+        for (auto it = order.begin() + series_budget; it != order.end(); ++it) {
+            folded[*it] = true;
+        }
+    }
+
+    PodGpuSample other = { "_other", 0, 0, 0, 0 };
+    size_t folded_count = 0;
+    for (size_t i = 0; i < latest_snapshot.size(); i++) {
+        const PodGpuSample& sample = latest_snapshot[i];
+        if (folded[i]) {
+            auto pod = pod_series.find(sample.pod);
+            if (pod != pod_series.end()) {
+                auto gpu = pod->second.gpus.find(sample.gpu_id);
+                if (gpu != pod->second.gpus.end()) {
+                    remove_gpu_series(gpu->second, gauge_family_first, gauge_family_second, gauge_family_third);
+                    pod->second.gpus.erase(gpu);
+                }
+            }
+            other.sm_util += sample.sm_util;
+            other.mem_used += sample.mem_used;
+            other.total_mem += sample.total_mem;
+            folded_count++;
+            continue;
+        }
+
+        GpuSeries& series = get_gpu_series(sample.pod, sample.gpu_id, gauge_family_first, gauge_family_second, gauge_family_third);
+        series.sm_util->Set(sample.sm_util);
+        series.mem_used->Set(sample.mem_used);
+        series.total_mem->Set(sample.total_mem);
+    }
+
+    // Folded series are summed into one series without namespace, container and gpu_id
+    if (folded_count != 0 && !folded_series) {
+        prometheus::Labels labels = { {"namespace", ""}, {"pod", other.pod}, {"container", ""}, {"node", node_name}, {"gpu_id", ""} };
+        folded_series = GpuSeries { &gauge_family_first.Add(labels), &gauge_family_second.Add(labels), &gauge_family_third.Add(labels) };
+    }
+    else if (folded_count == 0 && folded_series) {
+        remove_gpu_series(*folded_series, gauge_family_first, gauge_family_second, gauge_family_third);
+        folded_series.reset();
+    }
+    if (folded_series) {
+        folded_series->sm_util->Set(other.sm_util);
+        folded_series->mem_used->Set(other.mem_used);
+        folded_series->total_mem->Set(other.total_mem);
+    }
+
+    // Per-process series get what the pod series leave of the budget
+    size_t hidden_processes = 0;
+    if (process_metrics) {
+        size_t process_budget = std::numeric_limits<size_t>::max();
+        if (series_budget != 0) {
+            size_t pod_series_count = latest_snapshot.size() - folded_count + (folded_series ? 1 : 0);
+            process_budget = series_budget > pod_series_count ? series_budget - pod_series_count : 0;
+        }
+        hidden_processes = process_metrics->expose(process_budget);
+    }
+
+    if (folded_series_gauge) {
+        if (folded_series_gauge->Value() != folded_count + hidden_processes) {
+            spdlog::warn("{} pod and {} process series over the budget of {}, folded {} into pod {} and left out {} processes",
+                latest_snapshot.size(), process_metrics ? process_metrics->process_count() : 0, series_budget, folded_count, other.pod, hidden_processes);
+        }
+        folded_series_gauge->Set(folded_count + hidden_processes);
+    }
+}
+
+size_t writeCallback(void* contents, size_t size, size_t nmemb, std::string* output)
+{
+    size_t totalSize = size * nmemb;
+    output->append((char*)contents, totalSize);
+    return totalSize;
+}
+
+// Non-blocking HTTP client driving libcurl's multi interface from an epoll loop.
+// Connections (and their TLS sessions) stay in the multi handle's pool between
+// requests, and HTTP/2 streams are multiplexed over them when the server supports it.
+class AsyncHttpClient {
+public:
+    AsyncHttpClient()
+    {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            throw std::runtime_error("epoll_create1() failed: " + std::string(strerror(errno)));
+        }
+        multi = curl_multi_init();
+        if (!multi) {
+            close(epoll_fd);
+            throw std::runtime_error("curl_multi_init() failed");
+        }
+        curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, socket_callback);
+        curl_multi_setopt(multi, CURLMOPT_SOCKETDATA, this);
+        curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, timer_callback);
+        curl_multi_setopt(multi, CURLMOPT_TIMERDATA, this);
+        curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    }
+
+    ~AsyncHttpClient()
+    {
+        for (auto& request : pending) {
+            curl_multi_remove_handle(multi, request.first);
+        }
+        curl_multi_cleanup(multi);
+        close(epoll_fd);
+    }
+
+    AsyncHttpClient(const AsyncHttpClient&) = delete;
+    AsyncHttpClient& operator=(const AsyncHttpClient&) = delete;
+
+    // Queue a configured easy handle, done is called from run_until once it finishes
+    bool start(CURL* easy, std::function<void(CURLcode)> done)
+    {
+        if (pending.find(easy) != pending.end()) {
+            return false;
+        }
+        CURLMcode mres = curl_multi_add_handle(multi, easy);
+        if (mres != CURLM_OK) {
+            spdlog::error("curl_multi_add_handle() failed: {}", curl_multi_strerror(mres));
+            return false;
+        }
+        pending[easy] = std::move(done);
+        return true;
+    }
+
+    bool in_flight(CURL* easy) const
+    {
+        return pending.find(easy) != pending.end();
+    }
+
+    bool idle() const
+    {
+        return pending.empty();
+    }
+
+    // Drive transfers until deadline, this doubles as the sleep between sampling cycles
+    void run_until(std::chrono::steady_clock::time_point deadline)
+    {
+        std::array<struct epoll_event, 16> events;
+
+        while (true) {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline) {
+                break;
+            }
+            auto wait = std::chrono::ceil<std::chrono::milliseconds>(deadline - now);
+            if (timer_active) {
+                auto timer_wait = std::chrono::ceil<std::chrono::milliseconds>(timer_deadline - now);
+                wait = std::max(std::chrono::milliseconds(0), std::min(wait, timer_wait));
+            }
+
+            int n = epoll_wait(epoll_fd, events.data(), events.size(), static_cast<int>(wait.count()));
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                spdlog::error("epoll_wait() failed: {}", strerror(errno));
+                std::this_thread::sleep_until(deadline);
+                break;
+            }
+
+            for (int i = 0; i < n; i++) {
+                int flags = 0;
+                if (events[i].events & EPOLLIN) {
+                    flags |= CURL_CSELECT_IN;
+                }
+                if (events[i].events & EPOLLOUT) {
+                    flags |= CURL_CSELECT_OUT;
+                }
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    flags |= CURL_CSELECT_ERR;
+                }
+                curl_multi_socket_action(multi, events[i].data.fd, flags, &running);
+            }
+
+            if (timer_active && std::chrono::steady_clock::now() >= timer_deadline) {
+                timer_active = false;
+                curl_multi_socket_action(multi, CURL_SOCKET_TIMEOUT, 0, &running);
+            }
+
+            check_completed();
+        }
+    }
+
+private:
+    static int socket_callback(CURL* easy, curl_socket_t s, int what, void* userp, void* socketp)
+    {
+        auto* client = static_cast<AsyncHttpClient*>(userp);
+        if (what == CURL_POLL_REMOVE) {
+            epoll_ctl(client->epoll_fd, EPOLL_CTL_DEL, s, nullptr);
+            return 0;
+        }
+
+        struct epoll_event ev = {};
+        ev.events = ((what & CURL_POLL_IN) ? EPOLLIN : 0) | ((what & CURL_POLL_OUT) ? EPOLLOUT : 0);
+        ev.data.fd = s;
+        if (epoll_ctl(client->epoll_fd, EPOLL_CTL_MOD, s, &ev) != 0 && errno == ENOENT) {
+            epoll_ctl(client->epoll_fd, EPOLL_CTL_ADD, s, &ev);
+        }
+        return 0;
+    }
+
+    static int timer_callback(CURLM* multi, long timeout_ms, void* userp)
+    {
+        auto* client = static_cast<AsyncHttpClient*>(userp);
+        if (timeout_ms < 0) {
+            client->timer_active = false;
+            return 0;
+        }
+        client->timer_active = true;
+        client->timer_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        return 0;
+    }
+
+    void check_completed()
+    {
+        CURLMsg* msg;
+        int msgs_left;
+        while ((msg = curl_multi_info_read(multi, &msgs_left)) != nullptr) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            CURL* easy = msg->easy_handle;
+            CURLcode result = msg->data.result;
+            curl_multi_remove_handle(multi, easy);
+
+            auto it = pending.find(easy);
+            if (it == pending.end()) {
+                continue;
+            }
+            auto done = std::move(it->second);
+            pending.erase(it);
+            done(result);
+        }
+    }
+
+    int epoll_fd = -1;
+    CURLM* multi = nullptr;
+    int running = 0;
+    bool timer_active = false;
+    std::chrono::steady_clock::time_point timer_deadline;
+    std::map<CURL*, std::function<void(CURLcode)>> pending;
+};
+
+// Exponential backoff with equal jitter: half of the delay is fixed, half is random
+std::chrono::milliseconds backoff_delay(int failures, std::mt19937& rng)
+{
+    const long base_ms = 500;
+    const long max_ms = 60000;
+    long delay_ms = base_ms << std::min(failures, 16);
+    delay_ms = std::min(delay_ms, max_ms);
+    std::uniform_int_distribution<long> jitter(0, delay_ms / 2);
+    return std::chrono::milliseconds(delay_ms / 2 + jitter(rng));
+}
+
+// Pod list of this node from the apiserver, requested once per interval. A failed
+// request is retried after a backoff that is never shorter than the interval, so
+// an unavailable apiserver is asked less often, not more.
+class ApiServerPodList {
+public:
+    ApiServerPodList(const std::string& url, const std::string& token, const std::string& ca_file,
+        std::chrono::milliseconds interval, std::chrono::milliseconds timeout)
+        : interval(interval)
+    {
+        curl = curl_easy_init();
+        if (!curl) {
+            throw std::runtime_error("curl_easy_init() failed");
+        }
+        std::string header = "Authorization: Bearer " + token;
+        headers = curl_slist_append(headers, header.c_str());
+        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(curl, CURLOPT_CAINFO, ca_file.c_str());
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
+        curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, static_cast<long>(timeout.count())); // Total timeout
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, static_cast<long>(timeout.count() / 2)); // Connection timeout
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+    }
+
+    ~ApiServerPodList()
+    {
+        curl_easy_cleanup(curl);
+        curl_slist_free_all(headers);
+    }
+
+    ApiServerPodList(const ApiServerPodList&) = delete;
+    ApiServerPodList& operator=(const ApiServerPodList&) = delete;
+
+    // Start a request when one is due, apply is called with the body of a 200
+    // response and returns whether it was a valid pod list
+    void poll(AsyncHttpClient& http_client, std::chrono::steady_clock::time_point now, std::function<bool(const std::string&)> apply)
+    {
+        if (http_client.in_flight(curl) || now < next_request) {
+            return;
+        }
+        response.clear();
+        if (http_client.start(curl, [this, apply](CURLcode res) { on_done(res, apply); })) {
+            next_request = now + interval;
+        }
+    }
+
+    bool in_flight(const AsyncHttpClient& http_client) const
+    {
+        return http_client.in_flight(curl);
+    }
+
+    std::chrono::steady_clock::time_point next_request_time() const
+    {
+        return next_request;
+    }
+
+    int consecutive_failures() const
+    {
+        return failures;
+    }
+
+private:
+    void on_done(CURLcode res, const std::function<bool(const std::string&)>& apply)
+    {
+        long http_code = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+        if (res == CURLE_OK && http_code == 200 && apply(response)) {
+            failures = 0;
+            return;
+        }
+        if (res != CURLE_OK) {
+            spdlog::error("pods request failed: {}", curl_easy_strerror(res));
+        }
+        else if (http_code != 200) {
+            spdlog::error("pods request returned HTTP {}", http_code);
+        }
+        auto delay = std::max<std::chrono::milliseconds>(interval, backoff_delay(failures++, rng));
+        spdlog::warn("retrying pods request in {} ms", delay.count());
+        next_request = std::chrono::steady_clock::now() + delay;
+    }
+
+    CURL* curl = nullptr;
+    struct curl_slist* headers = NULL;
+    std::string response;
+    std::chrono::milliseconds interval;
+    std::chrono::steady_clock::time_point next_request;
+    int failures = 0;
+    std::mt19937 rng { std::random_device {}() };
+};
+
+// Pushes delta-encoded snapshots to a node-local collector instead of waiting
+// for a scrape. Each POST body is a deflate-compressed frame:
+//
+//   "VGPS" u8 version, u8 flags (1 = full snapshot), varint sequence,
+//   varint timestamp_ms, string node,
+//   varint n, n * (varint id, string pod, varint gpu_id)            new series, pod is "<namespace>/<name>"
+//   varint n, n * (varint id, varint sm_util, varint mem, varint total)  changed values
+//   varint n, n * varint id                                          removed series
+//
+// Strings are varint length + bytes. Series ids are only valid until the next
+// full snapshot, which is sent first, after queue overflow, and whenever the
+// collector answers 409 because it lost its state.
+class SnapshotPusher {
+public:
+    SnapshotPusher(const std::string& url, const std::string& node, std::chrono::seconds interval, size_t max_queued)
+        : node(node), interval(interval), max_queued(max_queued)
+    {
+        curl = curl_easy_init();
+        if (!curl) {
+            throw std::runtime_error("curl_easy_init() failed");
+        }
+        headers = curl_slist_append(headers, "Content-Type: application/octet-stream");
+        headers = curl_slist_append(headers, "Content-Encoding: deflate");
+        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(curl, CURLOPT_POST, 1L);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, 2000L);
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, 1000L);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+    }
+
+    ~SnapshotPusher()
+    {
+        curl_easy_cleanup(curl);
+        curl_slist_free_all(headers);
+    }
+
+    SnapshotPusher(const SnapshotPusher&) = delete;
+    SnapshotPusher& operator=(const SnapshotPusher&) = delete;
+
+    // Encode the changes since the last frame once per push interval
+    void add_snapshot(const std::vector<PodGpuSample>& snapshot)
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (now < next_frame) {
+            return;
+        }
+        next_frame = now + interval;
+
+        if (need_full) {
+            series_ids.clear();
+            sent_values.clear();
+            next_series_id = 0;
+        }
+
+        std::string definitions;
+        std::string updates;
+        std::string removals;
+        uint64_t num_definitions = 0;
+        uint64_t num_updates = 0;
+        uint64_t num_removals = 0;
+        std::map<uint64_t, std::array<unsigned long long, 3>> current_values;
+
+        for (const auto& sample : snapshot) {
+            auto key = std::make_pair(sample.pod, sample.gpu_id);
+            auto it = series_ids.find(key);
+            if (it == series_ids.end()) {
+                it = series_ids.emplace(key, next_series_id++).first;
+                append_varint(definitions, it->second);
+                append_bytes(definitions, sample.pod);
+                append_varint(definitions, sample.gpu_id);
+                num_definitions++;
+            }
+
+            std::array<unsigned long long, 3> values = { sample.sm_util, sample.mem_used, sample.total_mem };
+            current_values[it->second] = values;
+            auto sent = sent_values.find(it->second);
+            if (sent != sent_values.end() && sent->second == values) {
+                continue;
+            }
+            append_varint(updates, it->second);
+            for (unsigned long long value : values) {
+                append_varint(updates, value);
+            }
+            num_updates++;
+        }
+
+        for (auto it = series_ids.begin(); it != series_ids.end();) {
+            if (current_values.find(it->second) == current_values.end()) {
+                append_varint(removals, it->second);
+                num_removals++;
+                it = series_ids.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+        sent_values = std::move(current_values);
+
+        if (!need_full && num_definitions == 0 && num_updates == 0 && num_removals == 0) {
+            return;
+        }
+
+        std::string frame = "VGPS";
+        frame.push_back(1);
+        frame.push_back(need_full ? 1 : 0);
+        append_varint(frame, sequence++);
+        append_varint(frame, std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+        append_bytes(frame, node);
+        append_varint(frame, num_definitions);
+        frame += definitions;
+        append_varint(frame, num_updates);
+        frame += updates;
+        append_varint(frame, num_removals);
+        frame += removals;
+        need_full = false;
+
+        uLongf compressed_size = compressBound(frame.size());
+        std::string compressed(compressed_size, '\0');
+        if (compress2(reinterpret_cast<Bytef*>(&compressed[0]), &compressed_size, reinterpret_cast<const Bytef*>(frame.data()), frame.size(), Z_BEST_SPEED) != Z_OK) {
+            spdlog::error("Failed to compress push frame");
+            need_full = true;
+            return;
+        }
+        compressed.resize(compressed_size);
+        spdlog::debug("push frame: {} series changed, {} bytes ({} uncompressed)", num_updates, compressed.size(), frame.size());
+
+        // Deltas only apply on top of every earlier frame, so on overflow the
+        // backlog and this frame are replaced by a full snapshot on the next
+        // interval. The frame curl is sending lives in `sending` and is left alone.
+        if (queue.size() >= max_queued) {
+            spdlog::warn("push queue full, dropping {} frames", queue.size() + 1);
+            dropped_frames += queue.size() + 1;
+            queue.clear();
+            need_full = true;
+            return;
+        }
+        queue.push_back(std::move(compressed));
+    }
+
+    // Send the oldest queued frame if the previous one finished. A failed
+    // frame stays in `sending` and is retried after the backoff.
+    void flush(AsyncHttpClient& http_client)
+    {
+        if (http_client.in_flight(curl) || std::chrono::steady_clock::now() < next_attempt) {
+            return;
+        }
+        if (sending.empty()) {
+            if (queue.empty()) {
+                return;
+            }
+            sending = std::move(queue.front());
+            queue.pop_front();
+        }
+        response.clear();
+        // CURLOPT_POSTFIELDS does not copy, `sending` must outlive the transfer
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, sending.data());
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, static_cast<long>(sending.size()));
+        http_client.start(curl, [this](CURLcode res) { on_done(res); });
+    }
+
+    uint64_t dropped() const
+    {
+        return dropped_frames;
+    }
+
+private:
+    static void append_varint(std::string& out, uint64_t value)
+    {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    static void append_bytes(std::string& out, const std::string& value)
+    {
+        append_varint(out, value.size());
+        out.append(value);
+    }
+
+    void on_done(CURLcode res)
+    {
+        long http_code = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+        if (res == CURLE_OK && http_code >= 200 && http_code < 300) {
+            sending.clear();
+            failures = 0;
+            return;
+        }
+        if (res == CURLE_OK && http_code == 409) {
+            // The collector has no state for us, queued deltas are useless
+            spdlog::warn("collector requested a full snapshot");
+            sending.clear();
+            queue.clear();
+            need_full = true;
+            next_frame = std::chrono::steady_clock::now();
+            return;
+        }
+        if (res != CURLE_OK) {
+            spdlog::error("push failed: {}", curl_easy_strerror(res));
+        }
+        else {
+            spdlog::error("push returned HTTP {}", http_code);
+        }
+        next_attempt = std::chrono::steady_clock::now() + backoff_delay(failures++, rng);
+    }
+
+    CURL* curl = nullptr;
+    struct curl_slist* headers = NULL;
+    std::string response;
+    std::string node;
+    std::chrono::seconds interval;
+    size_t max_queued;
+    std::string sending;
+    std::deque<std::string> queue;
+    std::map<std::pair<std::string, unsigned int>, uint64_t> series_ids;
+    std::map<uint64_t, std::array<unsigned long long, 3>> sent_values;
+    uint64_t next_series_id = 0;
+    uint64_t sequence = 0;
+    uint64_t dropped_frames = 0;
+    bool need_full = true;
+    int failures = 0;
+    std::mt19937 rng { std::random_device {}() };
+    std::chrono::steady_clock::time_point next_frame;
+    std::chrono::steady_clock::time_point next_attempt;
+};
+
+// Minimal protobuf wire-format reader for the kubelet PodResources messages
+struct ProtoReader {
+    const char* pos;
+    const char* end;
+
+    bool done() const
+    {
+        return pos >= end;
+    }
+
+    bool read_varint(uint64_t& value)
+    {
+        value = 0;
+        for (int shift = 0; shift < 64 && pos < end; shift += 7) {
+            uint8_t byte = static_cast<uint8_t>(*pos++);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool read_tag(uint32_t& field, uint32_t& wire_type)
+    {
+        uint64_t tag;
+        if (!read_varint(tag)) {
+            return false;
+        }
+        field = static_cast<uint32_t>(tag >> 3);
+        wire_type = static_cast<uint32_t>(tag & 0x7);
+        return true;
+    }
+
+    bool read_bytes(std::string_view& value)
+    {
+        uint64_t size;
+        if (!read_varint(size) || static_cast<uint64_t>(end - pos) < size) {
+            return false;
+        }
+        value = std::string_view(pos, size);
+        pos += size;
+        return true;
+    }
+
+    bool skip(uint32_t wire_type)
+    {
+        uint64_t varint;
+        std::string_view bytes;
+        switch (wire_type) {
+        case 0:
+            return read_varint(varint);
+        case 1:
+            if (end - pos < 8) {
+                return false;
+            }
+            pos += 8;
+            return true;
+        case 2:
+            return read_bytes(bytes);
+        case 5:
+            if (end - pos < 4) {
+                return false;
+            }
+            pos += 4;
+            return true;
+        default:
+            return false;
+        }
+    }
+};
+
+struct PodDeviceOwner {
+    std::string namespace_;
+    std::string pod;
+    std::string container;
+
+    bool operator==(const PodDeviceOwner& other) const
+    {
+        return namespace_ == other.namespace_ && pod == other.pod && container == other.container;
+    }
+};
+
+// GPU-to-pod assignment from the kubelet PodResources API. v1.PodResourcesLister/List
+// is called over the kubelet's local gRPC socket (HTTP/2 without TLS) and the
+// result is diffed against the previous one, so only pods whose devices changed
+// are reported. The kubelet does not serve Watch in the v1 API, hence the polling.
+class PodResourcesClient {
+public:
+    explicit PodResourcesClient(const std::string& socket_path)
+    {
+        curl = curl_easy_init();
+        if (!curl) {
+            throw std::runtime_error("curl_easy_init() failed");
+        }
+        headers = curl_slist_append(headers, "Content-Type: application/grpc");
+        headers = curl_slist_append(headers, "TE: trailers");
+        curl_easy_setopt(curl, CURLOPT_UNIX_SOCKET_PATH, socket_path.c_str());
+        curl_easy_setopt(curl, CURLOPT_URL, "http://localhost/v1.PodResourcesLister/List");
+        curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE);
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        // gRPC frame with an empty ListPodResourcesRequest: no compression, zero length
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, empty_request);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, static_cast<long>(sizeof(empty_request)));
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, 2000L);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, writeCallback);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, &response_headers);
+    }
+
+    ~PodResourcesClient()
+    {
+        curl_easy_cleanup(curl);
+        curl_slist_free_all(headers);
+    }
+
+    PodResourcesClient(const PodResourcesClient&) = delete;
+    PodResourcesClient& operator=(const PodResourcesClient&) = delete;
+
+    // List pod resources, on_update is called with the pods whose devices changed
+    void start(AsyncHttpClient& http_client, std::function<void(const std::set<std::string>&)> on_update)
+    {
+        if (http_client.in_flight(curl)) {
+            return;
+        }
+        response.clear();
+        response_headers.clear();
+        http_client.start(curl, [this, on_update](CURLcode res) {
+            std::set<std::string> changed_pods;
+            if (on_done(res, changed_pods)) {
+                on_update(changed_pods);
+            }
+        });
+    }
+
+    // Whether the last List succeeded, the apiserver is only needed when it did not
+    bool ready() const
+    {
+        return healthy;
+    }
+
+    // Device IDs per "<namespace>/<name>", in the order the kubelet reports them
+    const std::map<std::string, std::vector<std::string>>& pod_devices() const
+    {
+        return devices_by_pod;
+    }
+
+    const std::map<std::string, PodDeviceOwner>& device_owners() const
+    {
+        return owners;
+    }
+
+private:
+    bool on_done(CURLcode res, std::set<std::string>& changed_pods)
+    {
+        healthy = false;
+        long http_code = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+        if (res != CURLE_OK) {
+            spdlog::error("PodResources List failed: {}", curl_easy_strerror(res));
+            return false;
+        }
+        if (http_code != 200) {
+            spdlog::error("PodResources List returned HTTP {}", http_code);
+            return false;
+        }
+
+        // grpc-status arrives in the trailers, which curl hands to the header callback
+        size_t status_pos = response_headers.find("grpc-status:");
+        if (status_pos != std::string::npos) {
+            int grpc_status = std::atoi(response_headers.c_str() + status_pos + strlen("grpc-status:"));
+            if (grpc_status != 0) {
+                spdlog::error("PodResources List returned grpc-status {}", grpc_status);
+                return false;
+            }
+        }
+
+        if (response.size() < 5 || response[0] != 0) {
+            spdlog::error("Unexpected PodResources response framing");
+            return false;
+        }
+        uint32_t message_size = (static_cast<uint8_t>(response[1]) << 24) | (static_cast<uint8_t>(response[2]) << 16) | (static_cast<uint8_t>(response[3]) << 8) | static_cast<uint8_t>(response[4]);
+        if (response.size() - 5 < message_size) {
+            spdlog::error("Truncated PodResources response");
+            return false;
+        }
+
+        std::map<std::string, PodDeviceOwner> new_owners;
+        std::map<std::string, std::vector<std::string>> new_devices_by_pod;
+        ProtoReader reader { response.data() + 5, response.data() + 5 + message_size };
+        if (!parse_list_response(reader, new_owners, new_devices_by_pod)) {
+            spdlog::error("Failed to parse PodResources response");
+            return false;
+        }
+
+        for (const auto& pod : new_devices_by_pod) {
+            auto old = devices_by_pod.find(pod.first);
+            if (old == devices_by_pod.end() || old->second != pod.second) {
+                changed_pods.insert(pod.first);
+            }
+        }
+        for (const auto& pod : devices_by_pod) {
+            if (new_devices_by_pod.find(pod.first) == new_devices_by_pod.end()) {
+                changed_pods.insert(pod.first);
+            }
+        }
+
+        owners = std::move(new_owners);
+        devices_by_pod = std::move(new_devices_by_pod);
+        healthy = true;
+        return true;
+    }
+
+    // ListPodResourcesResponse { repeated PodResources pod_resources = 1; }
+    static bool parse_list_response(ProtoReader& reader, std::map<std::string, PodDeviceOwner>& new_owners,
+        std::map<std::string, std::vector<std::string>>& new_devices_by_pod)
+    {
+        uint32_t field;
+        uint32_t wire_type;
+        while (!reader.done()) {
+            if (!reader.read_tag(field, wire_type)) {
+                return false;
+            }
+            if (field != 1 || wire_type != 2) {
+                if (!reader.skip(wire_type)) {
+                    return false;
+                }
+                continue;
+            }
+            std::string_view pod_bytes;
+            if (!reader.read_bytes(pod_bytes)) {
+                return false;
+            }
+            ProtoReader pod_reader { pod_bytes.data(), pod_bytes.data() + pod_bytes.size() };
+            if (!parse_pod_resources(pod_reader, new_owners, new_devices_by_pod)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // PodResources { string name = 1; string namespace = 2; repeated ContainerResources containers = 3; }
+    static bool parse_pod_resources(ProtoReader& reader, std::map<std::string, PodDeviceOwner>& new_owners,
+        std::map<std::string, std::vector<std::string>>& new_devices_by_pod)
+    {
+        PodDeviceOwner owner;
+        std::vector<std::string_view> containers;
+        uint32_t field;
+        uint32_t wire_type;
+        while (!reader.done()) {
+            std::string_view bytes;
+            if (!reader.read_tag(field, wire_type)) {
+                return false;
+            }
+            if (wire_type != 2 || field < 1 || field > 3) {
+                if (!reader.skip(wire_type)) {
+                    return false;
+                }
+                continue;
+            }
+            if (!reader.read_bytes(bytes)) {
+                return false;
+            }
+            if (field == 1) {
+                owner.pod = std::string(bytes);
+            }
+            else if (field == 2) {
+                owner.namespace_ = std::string(bytes);
+            }
+            else {
+                containers.push_back(bytes);
+            }
+        }
+
+        // Fields may come in any order, so containers are parsed once the pod is known
+        for (const auto& container_bytes : containers) {
+            ProtoReader container_reader { container_bytes.data(), container_bytes.data() + container_bytes.size() };
+            if (!parse_container_resources(container_reader, owner, new_owners, new_devices_by_pod)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // ContainerResources { string name = 1; repeated ContainerDevices devices = 2; ... }
+    // ContainerDevices { string resource_name = 1; repeated string device_ids = 2; ... }
+    static bool parse_container_resources(ProtoReader& reader, PodDeviceOwner owner,
+        std::map<std::string, PodDeviceOwner>& new_owners, std::map<std::string, std::vector<std::string>>& new_devices_by_pod)
+    {
+        std::vector<std::string_view> devices;
+        uint32_t field;
+        uint32_t wire_type;
+        while (!reader.done()) {
+            std::string_view bytes;
+            if (!reader.read_tag(field, wire_type)) {
+                return false;
+            }
+            if (wire_type != 2 || (field != 1 && field != 2)) {
+                if (!reader.skip(wire_type)) {
+                    return false;
+                }
+                continue;
+            }
+            if (!reader.read_bytes(bytes)) {
+                return false;
+            }
+            if (field == 1) {
+                owner.container = std::string(bytes);
+            }
+            else {
+                devices.push_back(bytes);
+            }
+        }
+
+        for (const auto& device_bytes : devices) {
+            ProtoReader device_reader { device_bytes.data(), device_bytes.data() + device_bytes.size() };
+            std::string_view resource_name;
+            std::vector<std::string_view> device_ids;
+            while (!device_reader.done()) {
+                std::string_view bytes;
+                if (!device_reader.read_tag(field, wire_type)) {
+                    return false;
+                }
+                if (wire_type != 2 || (field != 1 && field != 2)) {
+                    if (!device_reader.skip(wire_type)) {
+                        return false;
+                    }
+                    continue;
+                }
+                if (!device_reader.read_bytes(bytes)) {
+                    return false;
+                }
+                if (field == 1) {
+                    resource_name = bytes;
+                }
+                else {
+                    device_ids.push_back(bytes);
+                }
+            }
+            if (!is_gpu_resource(resource_name)) {
+                continue;
+            }
+            auto& pod_devices = new_devices_by_pod[make_pod_key(owner.namespace_, owner.pod)];
+            for (const auto& device_id : device_ids) {
+                new_owners[std::string(device_id)] = owner;
+                pod_devices.push_back(std::string(device_id));
+            }
+        }
+        return true;
+    }
+
+    static constexpr char empty_request[5] = { 0, 0, 0, 0, 0 };
+
+    CURL* curl = nullptr;
+    struct curl_slist* headers = NULL;
+    std::string response;
+    std::string response_headers;
+    bool healthy = false;
+    std::map<std::string, PodDeviceOwner> owners;
+    std::map<std::string, std::vector<std::string>> devices_by_pod;
+};
+
+// Derive gpu_data slots, GPU usage counts and in-container GPU order for pods
+// whose kubelet device assignment changed, replacing the apiserver limits,
+// docker inspect and docker exec lookups for them
+void apply_pod_resources(const PodResourcesClient& pod_resources, const std::set<std::string>& changed_pods,
+    std::map<std::string, std::map<unsigned int, std::pair<unsigned int, unsigned long long>>>& gpu_data)
+{
+    if (gpu_ids.size() == 0) {
+        load_gpu_ids();
+    }
+
+    // Every listed pod is still alive, whether its devices changed or not
+    std::time_t current_time = std::time(nullptr);
+    kubelet_device_pods.clear();
+    for (const auto& pod : pod_resources.pod_devices()) {
+        pod_tombstones.touch(pod.first, current_time);
+        for (const auto& device_id : pod.second) {
+            kubelet_device_pods[device_id.substr(0, device_id.find("::"))].insert(pod.first);
+        }
+    }
+
+    for (const auto& pod_id : changed_pods) {
+        caches_changed();
+        auto devices = pod_resources.pod_devices().find(pod_id);
+        if (devices == pod_resources.pod_devices().end()) {
+            spdlog::info("pod {} released its GPUs", pod_id);
+            kubelet_gpu_usage.erase(pod_id);
+            gpu_index.erase(pod_id);
+            pod_gpu_capacity.erase(pod_id);
+            pod_mig_slots.erase(pod_id);
+            continue;
+        }
+
+        // Shared GPUs are advertised as "<uuid>::<replica>", count the replicas per GPU
+        std::map<int, int> original_usage;
+        for (const auto& device_id : devices->second) {
+            std::string_view uuid = device_id;
+            uuid = uuid.substr(0, uuid.find("::"));
+            auto it = gpu_uuid_index.find(uuid);
+            if (it == gpu_uuid_index.end()) {
+                spdlog::warn("Unknown GPU {} assigned to pod {}", device_id, pod_id);
+                continue;
+            }
+            original_usage[it->second]++;
+        }
+
+        // Slots of earlier GPUs come first, as in update_and_clean_gpu_data. MIG
+        // devices are advertised by MIG UUID, each instance is a slot of its own.
+        std::map<int, int> adjusted_usage;
+        gpu_index[pod_id].clear();
+        pod_gpu_capacity.erase(pod_id);
+        unsigned int rank = 0;
+        for (const auto& usage : original_usage) {
+            adjusted_usage[rank] = usage.second;
+            if (usage.first < static_cast<int>(gpu_ids.size())) {
+                gpu_index[pod_id][gpu_ids[usage.first]] = rank;
+            }
+            rank++;
+        }
+        assign_mig_slots(pod_id, devices->second);
+        kubelet_gpu_usage[pod_id] = adjusted_usage;
+        for (const auto& device_id : devices->second) {
+            auto owner = pod_resources.device_owners().find(device_id);
+            if (owner != pod_resources.device_owners().end() && make_pod_key(owner->second.namespace_, owner->second.pod) == pod_id) {
+                pod_containers[pod_id] = owner->second.container;
+                break;
+            }
+        }
+        if (pod_id_to_docker_id.find(pod_id) != pod_id_to_docker_id.end()) {
+            gpu_usage[pod_id_to_docker_id.at(pod_id)] = adjusted_usage;
+        }
+
+        for (unsigned int i = 0; i < devices->second.size(); i++) {
+            if (gpu_data[pod_id].find(i) == gpu_data[pod_id].end()) {
+                gpu_data[pod_id][i] = std::make_pair(0, 0);
+            }
+        }
+        spdlog::info("pod {} has {} GPUs from the kubelet", pod_id, devices->second.size());
+    }
+}
+
+// Latest published data for the JSON query API, rebuilt once per cycle and
+// swapped atomically so API reads never wait on the sampling loop
+struct ApiSnapshot {
+    struct Body {
+        std::string json;
+        std::string etag;
+    };
+    Body pods;
+    Body gpus;
+    std::unordered_map<std::string, Body> pod_by_name; // "<namespace>/<name>"
+};
+
+std::shared_ptr<const ApiSnapshot> api_snapshot;
+
+// Startup and liveness state for /readyz and /healthz. Startup waits and the main
+// loop stamp the heartbeat; a heartbeat older than liveness_timeout means it hangs.
+std::atomic<bool> first_snapshot_published { false };
+std::atomic<std::chrono::steady_clock::rep> main_loop_heartbeat { std::chrono::steady_clock::now().time_since_epoch().count() };
+std::atomic<int> liveness_timeout { 60 };
+
+void stamp_heartbeat()
+{
+    main_loop_heartbeat = std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+// Serve apiserver I/O until a startup step running on another thread is done.
+// Warm-up on a busy node can outlast liveness_timeout, so the wait counts as progress.
+template <typename T>
+T serve_until_ready(AsyncHttpClient& http_client, std::future<T>& future)
+{
+    while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        stamp_heartbeat();
+        http_client.run_until(std::chrono::steady_clock::now() + std::chrono::milliseconds(10));
+    }
+    return future.get();
+}
+
+void append_json_string(std::string& out, std::string_view value)
+{
+    out.push_back('"');
+    for (char c : value) {
+        switch (c) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            }
+            else {
+                out.push_back(c);
+            }
+        }
+    }
+    out.push_back('"');
+}
+
+void set_etag(ApiSnapshot::Body& body)
+{
+    uLong crc = crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(body.json.data()), body.json.size());
+    char etag[32];
+    snprintf(etag, sizeof(etag), "\"%08lx-%zx\"", static_cast<unsigned long>(crc), body.json.size());
+    body.etag = etag;
+}
+
+// The samples of one pod, [begin, end) of latest_snapshot
+void append_pod_json(std::string& out, std::vector<PodGpuSample>::const_iterator begin, std::vector<PodGpuSample>::const_iterator end)
+{
+    out += "{\"namespace\":";
+    append_json_string(out, pod_key_namespace(begin->pod));
+    out += ",\"name\":";
+    append_json_string(out, pod_key_name(begin->pod));
+    out += ",\"gpus\":[";
+    for (auto sample = begin; sample != end; ++sample) {
+        if (sample != begin) {
+            out.push_back(',');
+        }
+        out += "{\"gpu_id\":";
+        out += std::to_string(sample->gpu_id);
+        out += ",\"sm_util\":";
+        out += std::to_string(sample->sm_util);
+        out += ",\"memory_used_mb\":";
+        out += std::to_string(sample->mem_used);
+        out += ",\"memory_total_mb\":";
+        out += std::to_string(sample->total_mem);
+        out += "}";
+    }
+    out += "]}";
+}
+
+// Serialize latest_snapshot and the per-GPU scheduler state for the API. The
+// previous snapshot's buffers are reused once no reader holds it anymore.
+void publish_api_snapshot(const DeviceScheduler& scheduler, CycleScratch& scratch)
+{
+    std::shared_ptr<ApiSnapshot>& spare = scratch.api_spare;
+    std::shared_ptr<ApiSnapshot> snapshot;
+    if (spare && spare.use_count() == 1) {
+        snapshot = std::move(spare);
+        snapshot->pods.json.clear();
+        snapshot->gpus.json.clear();
+    }
+    else {
+        snapshot = std::make_shared<ApiSnapshot>();
+    }
 
-        if (i == 0 || gpu_memory == 0) {
-            gpu_memory = memoryInfo.total;
+    // latest_snapshot is ordered by pod, group consecutive samples. Pods keep the
+    // body they had in the reused snapshot, so an unchanged set of pods costs no
+    // allocation.
+    std::string& pods_json = snapshot->pods.json;
+    pods_json += "{\"pods\":[";
+    size_t pod_count = 0;
+    for (auto begin = latest_snapshot.cbegin(); begin != latest_snapshot.cend();) {
+        auto end = begin;
+        while (end != latest_snapshot.cend() && end->pod == begin->pod) {
+            ++end;
         }
 
-        nvml_ret = nvmlDeviceGetComputeRunningProcesses_v3(nvml_dev, &infoCount, infos);
-        if (nvml_ret != NVML_SUCCESS && nvml_ret != NVML_ERROR_INSUFFICIENT_SIZE) {
-            spdlog::error("nvmlDeviceGetComputeRunningProcesses_v3 failed with {}", nvmlErrorString(nvml_ret));
-            spdlog::error("infoCount: {}", infoCount);
-            return;
+        ApiSnapshot::Body& body = snapshot->pod_by_name.try_emplace(begin->pod).first->second;
+        body.json.clear();
+        append_pod_json(body.json, begin, end);
+        set_etag(body);
+
+        if (pod_count != 0) {
+            pods_json.push_back(',');
         }
-        else if (nvml_ret == NVML_ERROR_INSUFFICIENT_SIZE) {
-            spdlog::info("nvmlDeviceGetComputeRunningProcesses_v3 failed with {}. try again!", nvmlErrorString(nvml_ret));
-            spdlog::info("infoCount: {}", infoCount);
-            infoCount = 1024 * 10;
-            // Allocate enough memory
-            infos = new nvmlProcessInfo_t[infoCount]();
+        pods_json += body.json;
+        pod_count++;
+        begin = end;
+    }
 
-            // Second call to nvmlDeviceGetComputeRunningProcesses_v3 to get process info
-            nvml_ret = nvmlDeviceGetComputeRunningProcesses_v3(nvml_dev, &infoCount, infos);
-            if (nvml_ret != NVML_SUCCESS) {
-                spdlog::error("nvmlDeviceGetComputeRunningProcesses_v3 failed with {}", nvmlErrorString(nvml_ret));
-                delete[] infos;
-                return;
+    // Drop the pods that are gone since the reused snapshot
+    if (snapshot->pod_by_name.size() > pod_count) {
+        for (auto it = snapshot->pod_by_name.begin(); it != snapshot->pod_by_name.end();) {
+            auto sample = std::lower_bound(latest_snapshot.begin(), latest_snapshot.end(), it->first, [](const PodGpuSample& sample, const std::string& pod) {
+                return sample.pod < pod;
+            });
+            if (sample == latest_snapshot.end() || sample->pod != it->first) {
+                it = snapshot->pod_by_name.erase(it);
             }
-
+            else {
+                ++it;
+            }
+        }
+    }
+    pods_json += "]}";
+    set_etag(snapshot->pods);
+
+    std::string& gpus_json = snapshot->gpus.json;
+    gpus_json += "{\"gpus\":[";
+    for (unsigned int i = 0; i < gpu_uuids.size(); i++) {
+        if (i != 0) {
+            gpus_json.push_back(',');
         }
+        gpus_json += "{\"index\":";
+        gpus_json += std::to_string(i);
+        gpus_json += ",\"uuid\":";
+        append_json_string(gpus_json, gpu_uuids[i]);
+        gpus_json += ",\"utilization\":";
+        gpus_json += std::to_string(scheduler.utilization(i));
+        gpus_json += ",\"processes\":";
+        gpus_json += std::to_string(scheduler.process_count(i));
+        gpus_json += ",\"sample_interval_seconds\":";
+        gpus_json += std::to_string(scheduler.interval(i).count());
+        gpus_json += "}";
+    }
+    gpus_json += "]}";
+    set_etag(snapshot->gpus);
+
+    std::shared_ptr<const ApiSnapshot> published = snapshot;
+    published = std::atomic_exchange(&api_snapshot, published);
+    spare = std::const_pointer_cast<ApiSnapshot>(published);
+}
 
-        spdlog::info("nvmlDeviceGetComputeRunningProcesses_v3:");
-        for (int j = 0; infos[j].pid != 0; j++) {
-            mem_record[infos[j].pid] = infos[j].usedGpuMemory;
-            spdlog::info("pid is: {}, usedGpuMemory is: {}", infos[j].pid, infos[j].usedGpuMemory);
+// Small HTTP/1.1 server for the JSON query API, running an epoll loop on its
+// own thread. It only reads api_snapshot, so a slow client never delays sampling.
+//
+//   GET /api/v1/pods                      all pods on the node
+//   GET /api/v1/pods/{namespace}/{name}   one pod
+//   GET /api/v1/gpus                      per-GPU state
+//   GET /healthz                          200 while the main loop makes progress
+//   GET /readyz                           200 once the first snapshot is published
+//
+// Responses carry an ETag; a matching If-None-Match gets 304 without a body.
+// Constructed with serve_api false it only answers the two probes, which
+// main() serves that way whether or not the JSON API is enabled.
+class ApiServer {
+public:
+    explicit ApiServer(int port, bool serve_api = true)
+        : serve_api(serve_api)
+    {
+        // Dual-stack when the node has IPv6, plain IPv4 when it was disabled
+        // with ipv6.disable=1 (EAFNOSUPPORT) or has no IPv6 address to bind
+        listen_fd = listen_on(AF_INET6, port);
+        if (listen_fd < 0 && (errno == EAFNOSUPPORT || errno == EADDRNOTAVAIL)) {
+            spdlog::info("IPv6 unavailable for the API server, listening on IPv4 only");
+            listen_fd = listen_on(AF_INET, port);
+        }
+        if (listen_fd < 0) {
+            throw std::runtime_error("Failed to listen on port " + std::to_string(port) + ": " + strerror(errno));
         }
 
-        unsigned int processSamplesCount = 1024;
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = listen_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
 
-        // Allocate buffer
-        std::vector<nvmlProcessUtilizationSample_t> utilization(processSamplesCount);
+        // Written on shutdown to wake the loop
+        stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        ev.data.fd = stop_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &ev);
 
-        // Get utilization information
-        nvml_ret = nvmlDeviceGetProcessUtilization(nvml_dev, utilization.data(), &processSamplesCount, 0);
-        if (nvml_ret != NVML_SUCCESS) {
-            spdlog::error("Failed to get process utilization: {}", nvmlErrorString(nvml_ret));
-            // nvmlShutdown();
-            error_utilization = 1;
-        }
+        worker = std::thread([this] { run(); });
+    }
 
-        spdlog::info("");
+    ~ApiServer()
+    {
+        stopping = true;
+        uint64_t one = 1;
+        write(stop_fd, &one, sizeof(one));
+        worker.join();
+        for (auto& connection : connections) {
+            close(connection.first);
+        }
+        close(stop_fd);
+        close(epoll_fd);
+        close(listen_fd);
+    }
 
-        // Process utilization information
-        for (int k = 0; infos[k].pid != 0; k++) {
-            std::string pod_uid = "";
-            std::string docker_id = "";
-            spdlog::info("");
-            spdlog::info("pid is: {}", infos[k].pid);
-            if (read_proc_cgroup(infos[k].pid, pod_uid, docker_id) != -1) {
-                docker_id = docker_id.substr(0, 12);
-                get_docker_gpus(docker_id);
-
-                // Get pod_id
-                std::string pod_id;
-                if (pod_uid_to_id.find(pod_uid) == pod_uid_to_id.end()) {
-                    std::string get_pod_id_cmd = "docker ps -a | grep " + docker_id + " | awk '{print $NF}' | awk -F '_' '{print $3}'";
-                    if (get_pod_id(get_pod_id_cmd, pod_id) != 0) {
-                        spdlog::error("exec {} failed", get_pod_id_cmd);
-                        continue;
-                    }
-                    pod_uid_to_id[pod_uid] = pod_id;
-                }
-                else {
-                    pod_id = pod_uid_to_id[pod_uid];
-                }
+    ApiServer(const ApiServer&) = delete;
+    ApiServer& operator=(const ApiServer&) = delete;
+
+    // The bound port, useful when constructed with port 0
+    int port() const
+    {
+        struct sockaddr_storage addr = {};
+        socklen_t length = sizeof(addr);
+        getsockname(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), &length);
+        if (addr.ss_family == AF_INET6) {
+            return ntohs(reinterpret_cast<struct sockaddr_in6*>(&addr)->sin6_port);
+        }
+        return ntohs(reinterpret_cast<struct sockaddr_in*>(&addr)->sin_port);
+    }
 
-                if (pod_id_to_docker_id.find(pod_id) == pod_id_to_docker_id.end()) {
-                    pod_id_to_docker_id[pod_id] = docker_id;
-                }
+private:
+    struct Connection {
+        std::string in;
+        std::string out;
+        bool close_after_write = false;
+    };
+
+    // Returns the listening socket, or -1 with errno set
+    static int listen_on(int family, int port)
+    {
+        int fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        int result;
+        if (family == AF_INET6) {
+            int off = 0;
+            setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+            struct sockaddr_in6 addr = {};
+            addr.sin6_family = AF_INET6;
+            addr.sin6_addr = in6addr_any;
+            addr.sin6_port = htons(port);
+            result = bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+        }
+        else {
+            struct sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_ANY);
+            addr.sin_port = htons(port);
+            result = bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+        }
+        if (result != 0 || listen(fd, 128) != 0) {
+            int saved_errno = errno;
+            close(fd);
+            errno = saved_errno;
+            return -1;
+        }
+        return fd;
+    }
 
-                if (orginal_gpu_data.find(pod_id) == orginal_gpu_data.end()) {
-                    spdlog::warn("pod_id is not in orginal_gpu_data: {}", pod_id);
+    void run()
+    {
+        std::array<struct epoll_event, 64> events;
+        while (!stopping) {
+            int n = epoll_wait(epoll_fd, events.data(), events.size(), -1);
+            for (int i = 0; i < n; i++) {
+                int fd = events[i].data.fd;
+                if (fd == listen_fd) {
+                    accept_connections();
                     continue;
                 }
-
-                spdlog::info("gpu_index[pod_id].size(): {}", gpu_index[pod_id].size());
-                if (gpu_index[pod_id].size() == 0 || gpu_index.find(pod_id) == gpu_index.end()) {
-                    std::string get_gpus_in_container_cmd = "docker exec -i " + docker_id + " find /dev -name 'nvidia[0-9]*' | sort -V";
-                    if (get_gpu_id_in_pod(get_gpus_in_container_cmd, pod_id, gpu_data) != 0) {
-                        spdlog::error("exec {} failed", get_gpus_in_container_cmd);
-                        continue;
-                    }
-                }
-                spdlog::info("gpu_index[pod_id].size(): {}", gpu_index[pod_id].size());
-                if (gpu_index[pod_id].size() == 0) {
+                auto it = connections.find(fd);
+                if (it == connections.end()) {
                     continue;
                 }
-                // Accumulate previous statistics
-                if (gpu_data.find(pod_id) == gpu_data.end()) {
-                    // Initialize if pod_id does not exist
-                    gpu_data[pod_id][gpu_index[pod_id][gpu_ids[i]]] = std::make_pair(0, 0);
-                }
-                if (total_gpu_util.find(pod_id) == total_gpu_util.end()) {
-                    total_gpu_util[pod_id] = 0;
-                }
-                if (total_mem_used.find(pod_id) == total_mem_used.end()) {
-                    total_mem_used[pod_id] = 0;
-                }
-                // Accumulate smUtil and mem_used
-                total_mem_used[pod_id] += infos[k].usedGpuMemory;
-                spdlog::info("pid is: {}, usedGpuMemory is: {}", infos[k].pid, infos[k].usedGpuMemory);
-
-                if (error_utilization != 1) {
-                    for (int j = 0; utilization[j].pid != 0; j++) {
-                        if (utilization[j].pid == infos[k].pid) {
-                            total_gpu_util[pod_id] += utilization[j].smUtil;
-                            spdlog::info("pid is: {}, smUtil is: {}", infos[k].pid, utilization[j].smUtil);
-                        }
-                    }
+                if ((events[i].events & (EPOLLERR | EPOLLHUP)) || ((events[i].events & EPOLLIN) && !read_requests(fd, it->second)) || !write_responses(fd, it->second)) {
+                    close_connection(fd);
                 }
+            }
+        }
+    }
 
-                spdlog::info("pod id is: {}, total_gpu_util is: {}, total_mem_used is: {}", pod_id, total_gpu_util[pod_id], total_mem_used[pod_id]);
+    void accept_connections()
+    {
+        while (true) {
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                return;
+            }
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            struct epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.fd = fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+            connections[fd];
+        }
+    }
 
-                spdlog::info("gpu_ids[i] id is: {}, gpu id is: {}, gpu id in pod is: {}", gpu_ids[i], i, gpu_index[pod_id][gpu_ids[i]]);
+    void close_connection(int fd)
+    {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        connections.erase(fd);
+    }
 
-                gpu_data[pod_id][gpu_index[pod_id][gpu_ids[i]]].first = total_gpu_util[pod_id];
-                gpu_data[pod_id][gpu_index[pod_id][gpu_ids[i]]].second = total_mem_used[pod_id];
-                spdlog::info("gpu_data[pod_id][gpu_index[pod_id][gpu_ids[i]]].first is: {}, gpu_data[pod_id][gpu_index[pod_id][gpu_ids[i]]].second is: {}", gpu_data[pod_id][gpu_index[pod_id][gpu_ids[i]]].first, gpu_data[pod_id][gpu_index[pod_id][gpu_ids[i]]].second);
+    bool read_requests(int fd, Connection& connection)
+    {
+        char buffer[4096];
+        while (true) {
+            ssize_t n = read(fd, buffer, sizeof(buffer));
+            if (n > 0) {
+                connection.in.append(buffer, n);
+                continue;
+            }
+            if (n == 0) {
+                return false;
             }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return false;
+        }
+
+        size_t header_end;
+        while ((header_end = connection.in.find("\r\n\r\n")) != std::string::npos) {
+            handle_request(std::string_view(connection.in).substr(0, header_end), connection);
+            connection.in.erase(0, header_end + 4);
+        }
+        if (connection.in.size() > 8192) {
+            connection.in.clear();
+            connection.close_after_write = true;
+            respond(connection, "431 Request Header Fields Too Large", "", nullptr);
         }
-        delete[] infos;
+        return true;
     }
-}
 
-// Function to expose gpu_data to Prometheus
-void expose_gpu_data(std::shared_ptr<prometheus::Registry> registry,
-    std::map<std::string, std::map<unsigned int, std::pair<unsigned int, unsigned long long>>>& gpu_data,
-    prometheus::Family<prometheus::Gauge>& gauge_family_first,
-    prometheus::Family<prometheus::Gauge>& gauge_family_second,
-    prometheus::Family<prometheus::Gauge>& gauge_family_third)
-{
+    bool write_responses(int fd, Connection& connection)
+    {
+        while (!connection.out.empty()) {
+            ssize_t n = write(fd, connection.out.data(), connection.out.size());
+            if (n < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    return false;
+                }
+                break;
+            }
+            connection.out.erase(0, n);
+        }
 
-    // Iterate through gpu_data and create metrics for each Pod's GPU utilization and memory usage
-    for (const auto& pod : gpu_data) {
-        const auto& pod_id = pod.first;
-        int gpu_num = 0;
-        for (const auto& gpu : pod.second) {
-            unsigned int gpu_id = 1024;
-            for (auto& index : gpu_index[pod_id]) {
-                if (index.second == gpu.first) {
-                    gpu_id = gpu.first;
-                    gpu_num++;
-                    break;
+        struct epoll_event ev = {};
+        ev.events = connection.out.empty() ? EPOLLIN : EPOLLIN | EPOLLOUT;
+        ev.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+        return !(connection.out.empty() && connection.close_after_write);
+    }
+
+    static std::string_view header_value(std::string_view request, std::string_view name)
+    {
+        size_t pos = 0;
+        while ((pos = request.find("\r\n", pos)) != std::string_view::npos) {
+            pos += 2;
+            std::string_view line = request.substr(pos, request.find("\r\n", pos) - pos);
+            if (line.size() > name.size() && line[name.size()] == ':' && strncasecmp(line.data(), name.data(), name.size()) == 0) {
+                std::string_view value = line.substr(name.size() + 1);
+                size_t first = value.find_first_not_of(" \t");
+                if (first == std::string_view::npos) {
+                    return std::string_view();
                 }
+                return value.substr(first, value.find_last_not_of(" \t") + 1 - first);
             }
+        }
+        return std::string_view();
+    }
 
-            if (gpu_id == 1024) {
-                gpu_id = gpu_num;
-                gpu_num++;
+    // If-None-Match is "*" or a list of entity tags compared weakly, so W/"x" matches "x"
+    static bool etag_matches(std::string_view if_none_match, std::string_view etag)
+    {
+        if (if_none_match == "*") {
+            return true;
+        }
+        while (!if_none_match.empty()) {
+            size_t comma = if_none_match.find(',');
+            std::string_view tag = if_none_match.substr(0, comma);
+            size_t first = tag.find_first_not_of(" \t");
+            if (first != std::string_view::npos) {
+                tag = tag.substr(first, tag.find_last_not_of(" \t") + 1 - first);
+                if (tag.substr(0, 2) == "W/") {
+                    tag.remove_prefix(2);
+                }
+                if (tag == etag) {
+                    return true;
+                }
+            }
+            if (comma == std::string_view::npos) {
+                break;
             }
+            if_none_match.remove_prefix(comma + 1);
+        }
+        return false;
+    }
 
-            unsigned int sm_util = gpu.second.first * GPUAllocation;
-            unsigned long long mem_used = gpu.second.second / 1024 / 1024;
-            unsigned long long total_mem = gpu_memory / 1024 / 1024 / GPUAllocation;
+    void handle_request(std::string_view request, Connection& connection)
+    {
+        std::string_view request_line = request.substr(0, request.find("\r\n"));
+        size_t method_end = request_line.find(' ');
+        size_t path_end = request_line.find(' ', method_end + 1);
+        if (method_end == std::string_view::npos || path_end == std::string_view::npos) {
+            connection.close_after_write = true;
+            respond(connection, "400 Bad Request", "", nullptr);
+            return;
+        }
+        std::string_view method = request_line.substr(0, method_end);
+        std::string_view path = request_line.substr(method_end + 1, path_end - method_end - 1);
+        path = path.substr(0, path.find('?'));
+        std::string_view connection_header = header_value(request, "Connection");
+        if (request_line.substr(path_end + 1) == "HTTP/1.0" || (connection_header.size() == 5 && strncasecmp(connection_header.data(), "close", 5) == 0)) {
+            connection.close_after_write = true;
+        }
 
-            // Output metrics
-            spdlog::info("Pod ID: {}, GPU ID: {}, SM Utilization: {}, Memory Used: {}, Total Memory: {}", pod_id, gpu_id, sm_util, mem_used, total_mem);
+        if (method != "GET") {
+            respond(connection, "405 Method Not Allowed", "", nullptr);
+            return;
+        }
 
-            // Find and update SM Util Gauge (using pod_id and gpu_id)
-            prometheus::Gauge& sm_util_gauge = gauge_family_first.Add({ {"pod", pod_id}, {"gpu_id", std::to_string(gpu_id)} });
-            sm_util_gauge.Set(sm_util);
+        static const std::string ok = "{\"status\":\"ok\"}";
+        if (path == "/healthz") {
+            static const std::string stalled = "{\"status\":\"stalled\"}";
+            auto heartbeat = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(main_loop_heartbeat.load()));
+            bool alive = std::chrono::steady_clock::now() - heartbeat < std::chrono::seconds(liveness_timeout.load());
+            respond(connection, alive ? "200 OK" : "503 Service Unavailable", "", alive ? &ok : &stalled);
+            return;
+        }
+        if (path == "/readyz") {
+            static const std::string starting = "{\"status\":\"starting\"}";
+            bool ready = first_snapshot_published.load();
+            respond(connection, ready ? "200 OK" : "503 Service Unavailable", "", ready ? &ok : &starting);
+            return;
+        }
+        if (!serve_api) {
+            respond(connection, "404 Not Found", "", nullptr);
+            return;
+        }
+
+        std::shared_ptr<const ApiSnapshot> snapshot = std::atomic_load(&api_snapshot);
+        if (!snapshot) {
+            respond(connection, "503 Service Unavailable", "", nullptr);
+            return;
+        }
 
-            // Find and update Memory Used Gauge (using pod_id and gpu_id)
-            prometheus::Gauge& mem_used_gauge = gauge_family_second.Add({ {"pod", pod_id}, {"gpu_id", std::to_string(gpu_id)} });
-            mem_used_gauge.Set(mem_used);
+        const ApiSnapshot::Body* body = nullptr;
+        const std::string_view pods_prefix = "/api/v1/pods/";
+        if (path == "/api/v1/pods") {
+            body = &snapshot->pods;
+        }
+        else if (path == "/api/v1/gpus") {
+            body = &snapshot->gpus;
+        }
+        else if (path.substr(0, pods_prefix.size()) == pods_prefix) {
+            auto it = snapshot->pod_by_name.find(std::string(path.substr(pods_prefix.size())));
+            if (it != snapshot->pod_by_name.end()) {
+                body = &it->second;
+            }
+        }
+        if (!body) {
+            respond(connection, "404 Not Found", "", nullptr);
+            return;
+        }
 
-            // Find and update Total Memory Gauge (using pod_id and gpu_id)
-            prometheus::Gauge& total_mem_gauge = gauge_family_third.Add({ {"pod", pod_id}, {"gpu_id", std::to_string(gpu_id)} });
-            total_mem_gauge.Set(total_mem);
+        if (etag_matches(header_value(request, "If-None-Match"), body->etag)) {
+            respond(connection, "304 Not Modified", body->etag, nullptr);
+            return;
         }
+        respond(connection, "200 OK", body->etag, &body->json);
     }
-}
 
-size_t writeCallback(void* contents, size_t size, size_t nmemb, std::string* output)
-{
-    size_t totalSize = size * nmemb;
-    output->append((char*)contents, totalSize);
-    return totalSize;
-}
+    static void respond(Connection& connection, std::string_view status, std::string_view etag, const std::string* json)
+    {
+        std::string& out = connection.out;
+        out += "HTTP/1.1 ";
+        out += status;
+        out += "\r\nContent-Type: application/json\r\nContent-Length: ";
+        out += std::to_string(json ? json->size() : 0);
+        if (!etag.empty()) {
+            out += "\r\nETag: ";
+            out += etag;
+        }
+        if (connection.close_after_write) {
+            out += "\r\nConnection: close";
+        }
+        out += "\r\n\r\n";
+        if (json) {
+            out += *json;
+        }
+    }
+
+    bool serve_api;
+    int listen_fd = -1;
+    int epoll_fd = -1;
+    int stop_fd = -1;
+    std::atomic<bool> stopping { false };
+    std::thread worker;
+    std::map<int, Connection> connections;
+};
 
 int get_pods(std::map<std::string, std::map<unsigned int, std::pair<unsigned int, unsigned long long>>>& gpu_data,
-    CURL* curl, struct curl_slist* headers, const char* kubernetesServiceHost, const char* kubernetesServicePort, const std::string& currentNodeName, ondemand::parser& parser)
+    const std::string& podsResponse, ondemand::parser& parser)
 {
-    std::string podsResponse;
-    std::string podsUrl = "https://" + std::string(kubernetesServiceHost) + ":" + std::string(kubernetesServicePort) + "/api/v1/pods?fieldSelector=spec.nodeName=" + std::string(currentNodeName);
-
-    curl_easy_setopt(curl, CURLOPT_URL, podsUrl.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &podsResponse);
-    CURLcode res = curl_easy_perform(curl);
-    if (res != CURLE_OK) {
-        spdlog::error("curl_easy_perform() failed: {}", curl_easy_strerror(res));
-        return -1;
-    }
-
     padded_string json = padded_string(podsResponse);
     ondemand::document info;
     auto error = parser.iterate(json).get(info);
@@ -642,7 +3914,11 @@ int get_pods(std::map<std::string, std::map<unsigned int, std::pair<unsigned int
             continue;
         }
         int use_gpu = 0;
-        std::string_view gpu_num_string;
+        int gpu_num = 0;
+        std::string_view gpu_container;
+        // Size of the MIG profile requested for every slot, 0 when the slots mix profiles or whole GPUs
+        unsigned long long mig_memory = 0;
+        bool mixed_profiles = false;
         // Iterate through containers
         for (auto container_value : containers) {
             ondemand::object container;
@@ -669,16 +3945,31 @@ int get_pods(std::map<std::string, std::map<unsigned int, std::pair<unsigned int
                 continue;
             }
 
-            // Check if nvidia.com/gpu is in limits
+            // Check if nvidia.com/gpu or nvidia.com/mig-<profile> is in limits
             ondemand::object limits;
             error = resources["limits"].get_object().get(limits);
             if (!error) {
-                std::string_view limits_gpu;
-                error = limits["nvidia.com/gpu"].get_string().get(limits_gpu);
-                if (!error) {
+                for (auto field : limits) {
+                    std::string_view resource_name;
+                    std::string_view limits_gpu;
+                    if (field.unescaped_key().get(resource_name) || !is_gpu_resource(resource_name) || field.value().get_string().get(limits_gpu)) {
+                        continue;
+                    }
+                    int count = std::stoi(std::string(limits_gpu));
+                    if (count <= 0) {
+                        continue;
+                    }
+                    unsigned long long profile_memory = mig_profile_memory(resource_name);
+                    if (profile_memory == 0 || (use_gpu && profile_memory != mig_memory)) {
+                        mixed_profiles = true;
+                    }
+                    mig_memory = profile_memory;
+                    gpu_num += count;
                     use_gpu = 1;
-                    gpu_num_string = limits_gpu;
-                    // std::cout << "  GPU Limit: " << limits_gpu << std::endl;
+                }
+                if (use_gpu) {
+                    gpu_container = container_name;
+                    // std::cout << "  GPU Limit: " << gpu_num << std::endl;
                     break;
                 }
                 else {
@@ -699,7 +3990,8 @@ int get_pods(std::map<std::string, std::map<unsigned int, std::pair<unsigned int
                 error = requests["nvidia.com/gpu"].get_string().get(requests_gpu);
                 if (!error) {
                     use_gpu = 1;
-                    gpu_num_string = requests_gpu;
+                    gpu_num = std::stoi(std::string(requests_gpu));
+                    gpu_container = container_name;
                     // std::cout << "  GPU Request: " << requests_gpu << std::endl;
                     break;
                 }
@@ -753,73 +4045,166 @@ int get_pods(std::map<std::string, std::map<unsigned int, std::pair<unsigned int
             continue;
         }
 
-        int gpu_num = std::stoi(std::string(gpu_num_string));
-        std::string podname = std::string(name);
+        std::string podname = make_pod_key(namespace_, name);
 
         for (int i = 0; i < gpu_num; i++) {
             if (gpu_data[podname].find(i) == gpu_data[podname].end()) {
                 gpu_data[podname][i] = std::make_pair(0, 0);
             }
+            // Until NVML or the kubelet report the instances, assume the profile's nominal size
+            if (!mixed_profiles && mig_memory != 0) {
+                pod_gpu_capacity[podname].emplace(i, mig_memory);
+            }
+        }
+        std::string& pod_container = pod_containers[podname];
+        if (pod_container != gpu_container) {
+            pod_container = std::string(gpu_container);
         }
+        pod_tombstones.touch(podname, std::time(nullptr));
     }
 
     return 0;
 }
 
+// Forget a pod that was neither listed nor sampled for the whole tombstone period
+void evict_pod(const std::string& pod_id,
+    std::map<std::string, std::map<unsigned int, std::pair<unsigned int, unsigned long long>>>& gpu_data,
+    DeadlineQueue<std::pair<std::string, unsigned int>>& slot_expiry,
+    prometheus::Family<prometheus::Gauge>& gauge_family_first, prometheus::Family<prometheus::Gauge>& gauge_family_second, prometheus::Family<prometheus::Gauge>& gauge_family_third)
+{
+    spdlog::info("evicting pod {}", pod_id);
+
+    auto pod = gpu_data.find(pod_id);
+    if (pod != gpu_data.end()) {
+        for (const auto& gpu_item : pod->second) {
+            slot_expiry.erase({ pod_id, gpu_item.first });
+        }
+        gpu_data.erase(pod);
+    }
+
+    auto series = pod_series.find(pod_id);
+    if (series != pod_series.end()) {
+        remove_pod_series(series->second, gauge_family_first, gauge_family_second, gauge_family_third);
+        pod_series.erase(series);
+    }
+
+    auto docker_id = pod_id_to_docker_id.find(pod_id);
+    if (docker_id != pod_id_to_docker_id.end()) {
+        gpu_usage.erase(docker_id->second);
+        docker_mig_devices.erase(docker_id->second);
+        pod_id_to_docker_id.erase(docker_id);
+    }
+    auto uids = pod_id_to_uids.find(pod_id);
+    if (uids != pod_id_to_uids.end()) {
+        for (const auto& pod_uid : uids->second) {
+            pod_uid_to_id.erase(pod_uid);
+        }
+        pod_id_to_uids.erase(uids);
+    }
+    gpu_index.erase(pod_id);
+    caches_changed();
+    pod_gpu_capacity.erase(pod_id);
+    pod_mig_slots.erase(pod_id);
+    kubelet_gpu_usage.erase(pod_id);
+    pod_containers.erase(pod_id);
+}
+
 // Periodically clean and update GPU data
 void update_and_clean_gpu_data(std::map<std::string, std::map<unsigned int, std::pair<unsigned int, unsigned long long>>>& gpu_data,
-    std::map<std::string, std::map<unsigned int, std::time_t>>& last_update_times, nvmlDevice_t nvml_dev, unsigned int device_count,
+    DeadlineQueue<std::pair<std::string, unsigned int>>& slot_expiry, CycleScratch& scratch, DeviceScheduler& scheduler, std::chrono::steady_clock::time_point now,
+    nvmlDevice_t nvml_dev, unsigned int device_count,
     std::shared_ptr<prometheus::Registry> registry,
     std::chrono::time_point<std::chrono::high_resolution_clock> start,
     prometheus::Family<prometheus::Gauge>& gauge_family_first, prometheus::Family<prometheus::Gauge>& gauge_family_second, prometheus::Family<prometheus::Gauge>& gauge_family_third)
 {
-    const int expiry_time = 10; // Set data expiry time to 10 seconds
     std::time_t current_time = std::time(nullptr);
 
-    // Update GPU data
-    std::map<std::string, std::map<unsigned int, std::pair<unsigned int, unsigned long long>>> new_gpu_data, adusted_gpu_data;
-    get_usuage(gpu_data, new_gpu_data, nvml_dev, device_count, start);
+    // Update GPU data. The cycle's maps live in this block, their keys must not
+    // outlive pods evicted below.
+    {
+        CyclePodData new_gpu_data(cycle_arena.resource()), mig_gpu_data(cycle_arena.resource()), adusted_gpu_data(cycle_arena.resource());
+        CyclePodCapacity instance_memory_data(cycle_arena.resource()), adjusted_capacity(cycle_arena.resource());
+        get_usuage(gpu_data, new_gpu_data, mig_gpu_data, instance_memory_data, scratch, scheduler, now, nvml_dev, device_count, start);
 
-    for (const auto& pod : new_gpu_data) {
-        int new_index = 0;
-        for (auto& gpu_item : pod.second) {
-            unsigned int original_index = gpu_item.first;
-            unsigned int util = gpu_item.second.first;
-            unsigned long long memory = gpu_item.second.second;
+        for (const auto& pod : new_gpu_data) {
+            for (auto& gpu_item : pod.second) {
+                unsigned int original_index = gpu_item.first;
+                unsigned int util = gpu_item.second.first;
+                unsigned long long memory = gpu_item.second.second;
 
-            if(pod_id_to_docker_id.find(pod.first) == pod_id_to_docker_id.end()) {
-                continue;
-            }
-            if (gpu_usage.find(pod_id_to_docker_id.at(pod.first)) != gpu_usage.end() && gpu_usage.at(pod_id_to_docker_id.at(pod.first)).find(original_index) != gpu_usage.at(pod_id_to_docker_id.at(pod.first)).end()) {
-                std::vector<unsigned long long> split_values = split_data(memory, gpu_usage.at(pod_id_to_docker_id.at(pod.first)).at(original_index));
-                for (unsigned long long split_memory : split_values) {
-                    adusted_gpu_data[pod.first][new_index++] = std::make_pair(util, split_memory);
+                if(pod_id_to_docker_id.find(pod.first) == pod_id_to_docker_id.end()) {
+                    continue;
+                }
+                if (gpu_usage.find(pod_id_to_docker_id.at(pod.first)) != gpu_usage.end() && gpu_usage.at(pod_id_to_docker_id.at(pod.first)).find(original_index) != gpu_usage.at(pod_id_to_docker_id.at(pod.first)).end()) {
+                    const auto& pod_gpu_usage = gpu_usage.at(pod_id_to_docker_id.at(pod.first));
+                    int num_vgpu = pod_gpu_usage.at(original_index);
+                    // vGPUs of earlier GPUs come first, whether or not those GPUs were sampled this cycle
+                    int new_index = 0;
+                    for (auto usage = pod_gpu_usage.begin(); usage->first != static_cast<int>(original_index); ++usage) {
+                        new_index += usage->second;
+                    }
+                    std::pmr::vector<unsigned long long> split_values = split_data(memory, num_vgpu);
+                    unsigned long long capacity = 0;
+                    if (instance_memory_data.find(pod.first) != instance_memory_data.end() && instance_memory_data.at(pod.first).find(original_index) != instance_memory_data.at(pod.first).end()) {
+                        capacity = instance_memory_data.at(pod.first).at(original_index) / num_vgpu;
+                    }
+                    for (unsigned long long split_memory : split_values) {
+                        if (capacity != 0) {
+                            adjusted_capacity[pod.first][new_index] = capacity;
+                        }
+                        adusted_gpu_data[pod.first][new_index++] = std::make_pair(util, split_memory);
+                    }
                 }
             }
         }
-    }
 
-    // Iterate through new data and update last_update_times
-    for (const auto& pod : adusted_gpu_data) {
-        for (auto& gpu_item : pod.second) {
-            last_update_times[pod.first][gpu_item.first] = current_time;
-            spdlog::info("pod_id is: {}, gpu_id is: {}", pod.first, gpu_item.first);
-            gpu_data[pod.first][gpu_item.first] = gpu_item.second;
+        // MIG instances with a slot of their own are not split
+        for (const auto& pod : mig_gpu_data) {
+            for (const auto& gpu_item : pod.second) {
+                adusted_gpu_data[pod.first][gpu_item.first] = gpu_item.second;
+            }
+        }
+
+        // Iterate through new data and refresh the slot deadlines. The slot key is
+        // a scratch buffer, so touching a known slot allocates no string.
+        std::pair<std::string, unsigned int>& slot = scratch.slot;
+        for (const auto& pod : adusted_gpu_data) {
+            pod_tombstones.touch(pod.first, current_time);
+            slot.first = pod.first;
+            for (auto& gpu_item : pod.second) {
+                slot.second = gpu_item.first;
+                slot_expiry.touch(slot, current_time);
+                spdlog::info("pod_id is: {}, gpu_id is: {}", pod.first.get(), gpu_item.first);
+                gpu_data[pod.first][gpu_item.first] = gpu_item.second;
+            }
         }
-    }
 
-    // Clean up old data: check inactive Pods and zero out their data
-    for (auto it = gpu_data.begin(); it != gpu_data.end();) {
-        spdlog::info("pod_id is: {}", it->first);
-        const auto& pod_id = it->first;
-        for (auto& gpu_item : it->second) {
-            if (last_update_times[pod_id].find(gpu_item.first) == last_update_times[pod_id].end() || last_update_times[pod_id][gpu_item.first] + expiry_time < current_time) {
-                gpu_item.second = { 0, 0 }; // Zero out GPU utilization data
+        // Remember the real capacity of slots backed by MIG instances. The kubelet
+        // assignment covers every instance of a pod, not just the busy ones.
+        for (const auto& pod : adjusted_capacity) {
+            if (kubelet_gpu_usage.find(pod.first) != kubelet_gpu_usage.end()) {
+                continue;
+            }
+            for (const auto& capacity_item : pod.second) {
+                pod_gpu_capacity[pod.first][capacity_item.first] = capacity_item.second;
             }
         }
-        ++it;
     }
 
+    // Clean up old data: zero out slots whose deadline passed without an update
+    slot_expiry.expire(current_time, [&](const std::pair<std::string, unsigned int>& slot) {
+        auto pod = gpu_data.find(slot.first);
+        if (pod != gpu_data.end() && pod->second.find(slot.second) != pod->second.end()) {
+            spdlog::info("pod_id is: {}, gpu_id is: {} expired", slot.first, slot.second);
+            pod->second[slot.second] = { 0, 0 }; // Zero out GPU utilization data
+        }
+    });
+
+    // Evict pods that disappeared for longer than the tombstone period
+    pod_tombstones.expire(current_time, [&](const std::string& pod_id) {
+        evict_pod(pod_id, gpu_data, slot_expiry, gauge_family_first, gauge_family_second, gauge_family_third);
+    });
+
     // Output cleaned data
     for (const auto& pod_item : gpu_data) {
         spdlog::info("Pod ID: {}", pod_item.first);
@@ -830,14 +4215,87 @@ void update_and_clean_gpu_data(std::map<std::string, std::map<unsigned int, std:
 
     // Update gpu_data to Prometheus
     expose_gpu_data(registry, gpu_data, gauge_family_first, gauge_family_second, gauge_family_third);
+    if (process_metrics) {
+        process_metrics->log_cost();
+    }
 }
 
+#ifndef VGPU_MONITOR_TESTING
+class NvmlBackend : public GpuBackend {
+public:
+    nvmlReturn_t init() override
+    {
+        return nvmlInit();
+    }
+
+    nvmlReturn_t shutdown() override
+    {
+        return nvmlShutdown();
+    }
+
+    const char* error_string(nvmlReturn_t result) override
+    {
+        return nvmlErrorString(result);
+    }
+
+    nvmlReturn_t device_count(unsigned int* count) override
+    {
+        return nvmlDeviceGetCount(count);
+    }
+
+    nvmlReturn_t device_handle(unsigned int index, nvmlDevice_t* device) override
+    {
+        return nvmlDeviceGetHandleByIndex(index, device);
+    }
+
+    nvmlReturn_t device_uuid(nvmlDevice_t device, char* uuid, unsigned int length) override
+    {
+        return nvmlDeviceGetUUID(device, uuid, length);
+    }
+
+    nvmlReturn_t memory_info(nvmlDevice_t device, nvmlMemory_t* memory) override
+    {
+        return nvmlDeviceGetMemoryInfo(device, memory);
+    }
+
+    nvmlReturn_t mig_mode(nvmlDevice_t device, unsigned int* current_mode, unsigned int* pending_mode) override
+    {
+        return nvmlDeviceGetMigMode(device, current_mode, pending_mode);
+    }
+
+    nvmlReturn_t max_mig_device_count(nvmlDevice_t device, unsigned int* count) override
+    {
+        return nvmlDeviceGetMaxMigDeviceCount(device, count);
+    }
+
+    nvmlReturn_t mig_device_handle(nvmlDevice_t device, unsigned int index, nvmlDevice_t* mig_device) override
+    {
+        return nvmlDeviceGetMigDeviceHandleByIndex(device, index, mig_device);
+    }
+
+    nvmlReturn_t compute_running_processes(nvmlDevice_t device, unsigned int* count, nvmlProcessInfo_t* infos) override
+    {
+        return nvmlDeviceGetComputeRunningProcesses_v3(device, count, infos);
+    }
+
+    nvmlReturn_t process_utilization(nvmlDevice_t device, nvmlProcessUtilizationSample_t* samples, unsigned int* count, unsigned long long last_seen) override
+    {
+        return nvmlDeviceGetProcessUtilization(device, samples, count, last_seen);
+    }
+
+    nvmlReturn_t utilization_rates(nvmlDevice_t device, nvmlUtilization_t* utilization) override
+    {
+        return nvmlDeviceGetUtilizationRates(device, utilization);
+    }
+};
+
 int main()
 {
+    NvmlBackend nvml_backend;
+    gpu_backend = &nvml_backend;
     init_logger();
     auto start = std::chrono::high_resolution_clock::now();
     nvmlDevice_t nvml_dev;
-    nvmlReturn_t result;
     std::map<int, unsigned long long> mem_record;
     unsigned int device_count;
     std::map<std::string, std::map<unsigned int, std::pair<unsigned int, unsigned long long>>> gpu_data;
@@ -863,31 +4321,44 @@ int main()
         .Help("Total GPU memory per pod")
         .Register(*registry);
 
+    auto& gauge_family_interval = prometheus::BuildGauge()
+        .Name("gpu_sample_interval_seconds")
+        .Help("Current adaptive sampling interval per GPU")
+        .Register(*registry);
+
     // Register the registry with the Exposer
     exposer.RegisterCollectable(registry);
 
-    // Read GPU allocation ratio
-    if (read_allocation() != 0) {
-        return -1;
+    // The health probes are always served and available right away. The latest
+    // snapshot is only served as JSON when enabled, on its own port or on the
+    // probes' port when they match.
+    std::unique_ptr<ApiServer> api_server;
+    std::unique_ptr<ApiServer> health_server;
+    int api_port = get_env_int("VGPU_MONITOR_API_PORT", 0);
+    int health_port = get_env_int("VGPU_MONITOR_HEALTH_PORT", 8081);
+    if (health_port <= 0) {
+        spdlog::warn("Ignoring VGPU_MONITOR_HEALTH_PORT={}, the health probes cannot be turned off", health_port);
+        health_port = 8081;
     }
-
-    result = nvmlInit();
-    if (result != NVML_SUCCESS) {
-        spdlog::error("nvmlInit failed with {}", nvmlErrorString(result));
+    try {
+        if (api_port > 0) {
+            api_server = std::make_unique<ApiServer>(api_port);
+            spdlog::info("Serving JSON API on port {}", api_port);
+        }
+        if (health_port != api_port) {
+            health_server = std::make_unique<ApiServer>(health_port, false);
+        }
+        spdlog::info("Serving /healthz and /readyz on port {}", health_port);
+    }
+    catch (const std::exception& e) {
+        spdlog::error("Failed to start the HTTP server: {}", e.what());
         return -1;
     }
 
-    result = nvmlDeviceGetCount(&device_count);
-    if (NVML_SUCCESS != result) {
-        spdlog::error("Failed to query device count: {}", nvmlErrorString(result));
+    // Read GPU allocation ratio
+    if (read_allocation() != 0) {
         return -1;
     }
-    spdlog::info("Current device count is: {}", device_count);
-
-    get_gpu_uuids();
-
-    // Maintain a record of last update times
-    std::map<std::string, std::map<unsigned int, std::time_t>> last_update_times;
 
     std::ifstream tokenFile("/var/run/secrets/kubernetes.io/serviceaccount/token");
     std::string token;
@@ -918,45 +4389,183 @@ int main()
         return -1;
     }
     std::string currentNodeName(nodeNameEnv);
+    node_name = currentNodeName;
 
     if (!kubernetesServiceHost || !kubernetesServicePort || !nodeNameEnv) {
         spdlog::error("Error: Environment variables not set");
         return -1;
     }
 
-    CURL* curl = curl_easy_init();
-    if (!curl) {
-        spdlog::error("Error initializing curl");
+    std::string podsUrl = "https://" + std::string(kubernetesServiceHost) + ":" + std::string(kubernetesServicePort) + "/api/v1/pods?fieldSelector=spec.nodeName=" + currentNodeName;
+    ondemand::parser parser;
+    AsyncHttpClient http_client;
+    auto apply_pods = [&](const std::string& podsResponse) {
+        return get_pods(gpu_data, podsResponse, parser) == 0;
+    };
+
+    // Sample idle GPUs less often and busy or changing GPUs more often
+    DeviceScheduler::Config schedule;
+    schedule.interval = std::chrono::seconds(std::max(1, get_env_int("VGPU_MONITOR_INTERVAL", 5)));
+    schedule.idle_interval = std::chrono::seconds(std::max(1, get_env_int("VGPU_MONITOR_IDLE_INTERVAL", 30)));
+    schedule.burst_interval = std::chrono::seconds(std::max(1, get_env_int("VGPU_MONITOR_BURST_INTERVAL", 1)));
+    schedule.idle_samples = std::max(1, get_env_int("VGPU_MONITOR_IDLE_SAMPLES", 3));
+    schedule.burst_samples = std::max(0, get_env_int("VGPU_MONITOR_BURST_SAMPLES", 10));
+    schedule.burst_threshold = std::max(1, get_env_int("VGPU_MONITOR_BURST_THRESHOLD", 30));
+
+    // Total timeout below the sampling interval
+    ApiServerPodList pods(podsUrl, token, "/var/run/secrets/kubernetes.io/serviceaccount/ca.crt",
+        schedule.interval, std::chrono::milliseconds(4000));
+
+    // Consider the main loop hung after missing a few of its slowest wakeups
+    liveness_timeout = std::max<int>(60, 3 * schedule.idle_interval.count());
+
+    // Startup: list the pods while enumerating the GPUs
+    pods.poll(http_client, std::chrono::steady_clock::now(), apply_pods);
+    auto enumerating = std::async(std::launch::async, init_devices, std::ref(device_count));
+    if (serve_until_ready(http_client, enumerating) != 0) {
         return -1;
     }
-    std::string header = "Authorization: Bearer " + token;
-    struct curl_slist* headers = NULL;
-    headers = curl_slist_append(headers, "Connection: Keep-Alive"); // Add Keep-Alive header
-    headers = curl_slist_append(headers, header.c_str());
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
-    // curl_easy_setopt(curl, CURLOPT_TIMEOUT, 5L); // Total timeout 5 seconds
-    // curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 3L); // Connection timeout 3 seconds
 
-    ondemand::parser parser;
+    // Restore resolution caches written by a previous run
+    const char* cacheFileEnv = std::getenv("VGPU_MONITOR_CACHE_FILE");
+    std::string cacheFile = cacheFileEnv ? cacheFileEnv : "";
+    if (!cacheFile.empty()) {
+        load_caches(cacheFile);
+    }
+    bool first_cycle = true;
+
+    DeviceScheduler scheduler(device_count, schedule);
+    std::optional<std::pair<uint64_t, uint64_t>> published_generations;
+    std::vector<prometheus::Gauge*> interval_gauges;
+    for (unsigned int i = 0; i < device_count; i++) {
+        interval_gauges.push_back(&gauge_family_interval.Add({ {"gpu_id", std::to_string(i)} }));
+    }
+
+    // Maintain a record of last update times
+    // Data expires after two regular intervals, 10 seconds by default
+    const int expiry_time = std::max<int>(10, 2 * schedule.interval.count());
+    DeadlineQueue<std::pair<std::string, unsigned int>> slot_expiry(expiry_time);
+    CycleScratch scratch;
+    pod_tombstones.set_timeout(std::max(expiry_time, get_env_int("VGPU_MONITOR_TOMBSTONE_SECONDS", 300)));
+
+    // Fold the least loaded series once the node exposes more than the budget
+    series_budget = std::max(0, get_env_int("VGPU_MONITOR_MAX_SERIES", 0));
+    if (series_budget != 0) {
+        folded_series_gauge = &prometheus::BuildGauge()
+            .Name("vgpu_monitor_folded_series")
+            .Help("Series over the cardinality budget: pod GPU series folded into pod \"_other\" and process series left out")
+            .Register(*registry)
+            .Add({});
+        spdlog::info("Exposing at most {} pod GPU series", series_budget);
+    }
+
+    // Optionally break the pod series down to individual processes
+    if (get_env_int("VGPU_MONITOR_PROCESS_METRICS", 0) != 0) {
+        auto& process_sm_util_family = prometheus::BuildGauge()
+            .Name("pod_process_gpu_sm_util")
+            .Help("GPU SM utilization per process")
+            .Register(*registry);
+        auto& process_memory_family = prometheus::BuildGauge()
+            .Name("pod_process_gpu_memory_used")
+            .Help("GPU memory usage per process")
+            .Register(*registry);
+        process_metrics = std::make_unique<ProcessMetrics>(process_sm_util_family, process_memory_family,
+            std::max(1, get_env_int("VGPU_MONITOR_COMM_CACHE_SIZE", 4096)));
+        spdlog::info("Exposing per-process GPU metrics");
+    }
+
+    // Resolve the containers of running GPU processes, the pod list may still be in flight
+    std::vector<ContainerLookup> lookups = collect_container_lookups(device_count);
+    unsigned int parallelism = std::max(1, get_env_int("VGPU_MONITOR_STARTUP_PARALLELISM", 4));
+    auto resolving = std::async(std::launch::async, run_container_lookups, std::ref(lookups), parallelism);
+    serve_until_ready(http_client, resolving);
+    apply_container_lookups(lookups);
+    spdlog::info("Resolved {} containers on {} threads", lookups.size(), parallelism);
+
+    // The first cycle only reports listed pods, give the initial list its own timeout to finish
+    while (pods.in_flight(http_client)) {
+        stamp_heartbeat();
+        http_client.run_until(std::chrono::steady_clock::now() + std::chrono::milliseconds(10));
+    }
+
+    // Optionally push pre-aggregated snapshots to a node-local collector
+    std::unique_ptr<SnapshotPusher> pusher;
+    const char* pushUrlEnv = std::getenv("VGPU_MONITOR_PUSH_URL");
+    if (pushUrlEnv && *pushUrlEnv != '\0') {
+        int push_interval = std::max(1, get_env_int("VGPU_MONITOR_PUSH_INTERVAL", 15));
+        int push_queue = std::max(1, get_env_int("VGPU_MONITOR_PUSH_QUEUE", 64));
+        pusher = std::make_unique<SnapshotPusher>(pushUrlEnv, currentNodeName, std::chrono::seconds(push_interval), push_queue);
+        spdlog::info("Pushing snapshots to {} every {} seconds", pushUrlEnv, push_interval);
+    }
+
+    // Optionally take GPU-to-pod assignment from the kubelet PodResources API
+    std::unique_ptr<PodResourcesClient> pod_resources;
+    const char* kubeletSocketEnv = std::getenv("VGPU_MONITOR_KUBELET_SOCKET");
+    if (kubeletSocketEnv && *kubeletSocketEnv != '\0') {
+        pod_resources = std::make_unique<PodResourcesClient>(kubeletSocketEnv);
+        spdlog::info("Using kubelet PodResources API at {}", kubeletSocketEnv);
+    }
+
+    auto next_pod_resources_request = std::chrono::steady_clock::now();
 
     // Periodically update and clean GPU data
     while (true) {
-        get_pods(gpu_data, curl, headers, kubernetesServiceHost, kubernetesServicePort, currentNodeName, parser);
+        auto cycle_start = std::chrono::steady_clock::now();
+        stamp_heartbeat();
+
+        // The kubelet knows the GPU assignment locally, the apiserver is only a fallback
+        if (pod_resources && cycle_start >= next_pod_resources_request) {
+            pod_resources->start(http_client, [&](const std::set<std::string>& changed_pods) {
+                apply_pod_resources(*pod_resources, changed_pods, gpu_data);
+            });
+            next_pod_resources_request = cycle_start + schedule.interval;
+        }
 
-        update_and_clean_gpu_data(gpu_data, last_update_times, nvml_dev, device_count, registry, start, gauge_family_first, gauge_family_second, gauge_family_third);
+        if (!pod_resources || !pod_resources->ready()) {
+            pods.poll(http_client, cycle_start, apply_pods);
+        }
 
-        // Update every 5 seconds
-        std::this_thread::sleep_for(std::chrono::seconds(5));
-    }
+        // Only run a cycle when at least one GPU is due for sampling
+        if (scheduler.any_due(cycle_start)) {
+            update_and_clean_gpu_data(gpu_data, slot_expiry, scratch, scheduler, cycle_start, nvml_dev, device_count, registry, start, gauge_family_first, gauge_family_second, gauge_family_third);
+            cycle_arena.reset();
+            for (unsigned int i = 0; i < device_count; i++) {
+                interval_gauges[i]->Set(scheduler.interval(i).count());
+            }
+
+            if (first_cycle) {
+                drop_unverified_caches();
+                first_cycle = false;
+            }
+            if (!cacheFile.empty()) {
+                save_caches(cacheFile);
+            }
+            if (pusher) {
+                pusher->add_snapshot(latest_snapshot);
+            }
+            // Serializing the API snapshot is skipped while neither its samples nor the GPU state changed
+            auto generations = std::make_pair(snapshot_generation, scheduler.generation());
+            if (api_server && published_generations != generations) {
+                publish_api_snapshot(scheduler, scratch);
+                published_generations = generations;
+            }
+            if (!first_snapshot_published) {
+                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start);
+                spdlog::info("First snapshot published {} ms after start", elapsed.count());
+                first_snapshot_published = true;
+            }
+        }
+        if (pusher) {
+            pusher->flush(http_client);
+        }
 
-    curl_easy_cleanup(curl);
-    curl_slist_free_all(headers);
+        // Wake up at the fastest sampling cadence, serving apiserver I/O in the meantime
+        http_client.run_until(cycle_start + scheduler.tick());
+    }
 
     // Cleanup
-    nvmlShutdown();
+    gpu_backend->shutdown();
 
     return 0;
 }
+#endif